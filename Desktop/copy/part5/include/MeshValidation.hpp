@@ -0,0 +1,50 @@
+/** @file MeshValidation.hpp
+ *  @brief Checks that a closed triangle mesh has one outward winding.
+ *
+ *  Back-face culling throws away every triangle whose vertices appear
+ *  clockwise on screen, so a mesh has to list all of its triangles
+ *  counter-clockwise as seen from outside. Vertices are compared by
+ *  position, so copies made for different texture coordinates still
+ *  share their edges.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef MESHVALIDATION_HPP
+#define MESHVALIDATION_HPP
+
+#include <glad/glad.h>
+#include <vector>
+#include "glm/vec3.hpp"
+
+struct WindingReport{
+    int triangles = 0;
+    // Edges two triangles walk in the same direction, so one of them
+    // is wound the other way
+    int mixedEdges = 0;
+    // Edges with only one triangle, the mesh is not closed there
+    int openEdges = 0;
+    // Positive when the triangles face outward
+    float signedVolume = 0.0f;
+
+    bool IsConsistent() const{
+        return mixedEdges == 0;
+    }
+    bool IsOutward() const{
+        return signedVolume > 0.0f;
+    }
+};
+
+// vertices holds components floats per vertex, the first three are
+// the position
+WindingReport ValidateWinding(const std::vector<GLfloat>& vertices,
+                              const std::vector<GLuint>& indices,
+                              int components);
+
+// Triangles that are counter-clockwise, so survive back-face culling,
+// when seen from eye in the mesh's own space
+int CountFrontFacingTriangles(const std::vector<GLfloat>& vertices,
+                              const std::vector<GLuint>& indices,
+                              int components,
+                              const glm::vec3& eye);
+
+#endif
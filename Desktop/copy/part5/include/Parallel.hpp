@@ -0,0 +1,27 @@
+/** @file Parallel.hpp
+ *  @brief Splits a range of work across all hardware threads.
+ *
+ *  A tiny fork/join helper used by the CPU side of the renderer
+ *  (instance generation, animation, sorting...). Each call spawns
+ *  one std::thread per core, hands it a contiguous slice of the
+ *  range and joins before returning.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <cstddef>
+#include <functional>
+
+// Number of worker threads ParallelFor will use (at least 1).
+unsigned int GetWorkerCount();
+
+// Calls work(begin, end) on disjoint slices covering [0, count).
+// Slices smaller than minimumSlice are not split any further, so
+// small ranges run on the calling thread without spawning anything.
+void ParallelFor(std::size_t count,
+                 const std::function<void(std::size_t begin, std::size_t end)>& work,
+                 std::size_t minimumSlice = 4096);
+
+#endif
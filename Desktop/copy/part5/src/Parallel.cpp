@@ -0,0 +1,42 @@
+/** @file Parallel.cpp
+ */
+
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+unsigned int GetWorkerCount(){
+    unsigned int count = std::thread::hardware_concurrency();
+    // hardware_concurrency is allowed to return 0 if it does not know
+    return count == 0 ? 1 : count;
+}
+
+void ParallelFor(std::size_t count,
+                 const std::function<void(std::size_t begin, std::size_t end)>& work,
+                 std::size_t minimumSlice){
+    if (count == 0) {
+        return;
+    }
+    minimumSlice = std::max<std::size_t>(minimumSlice, 1);
+    std::size_t sliceCount = std::min<std::size_t>(GetWorkerCount(), (count + minimumSlice - 1) / minimumSlice);
+    if (sliceCount <= 1) {
+        work(0, count);
+        return;
+    }
+
+    std::size_t sliceSize = (count + sliceCount - 1) / sliceCount;
+    std::vector<std::thread> workers;
+    workers.reserve(sliceCount - 1);
+    // Hand out every slice but the first to a worker, the calling
+    // thread does the first one itself instead of sitting idle.
+    for (std::size_t begin = sliceSize; begin < count; begin += sliceSize) {
+        std::size_t end = std::min(begin + sliceSize, count);
+        workers.emplace_back(work, begin, end);
+    }
+    work(0, std::min(sliceSize, count));
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
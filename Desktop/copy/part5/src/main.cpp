@@ -15,6 +15,8 @@
 #include <cstdlib>
 #include "Camera.hpp"
 #include "Transform.hpp"
+#include "InstanceGenerator.hpp"
+#include "MeshValidation.hpp"
 #if defined(LINUX) || defined(MINGW)
     #include <SDL2/SDL.h>
 #else // This works for Mac
@@ -29,9 +31,9 @@ int gScreenWidth = 1024;
 SDL_Window* gGraphicsApplicationWindow = nullptr;
 SDL_GLContext gOpenGLContext = nullptr;
 Transform gTransform;
-std::vector<GLfloat> gOffsets;
+// Lattice the instanced cubes are laid out on
+InstanceGrid gInstanceGrid{-20, 20, 5.0f, 3};
 int gNumberOfInstances;
-int gNumberOfOffsets;
 
 // MainLoop flag
 bool gQuit = false;
@@ -71,27 +73,6 @@ std::string LoadShader(const std::string& fname) {
 }
 
 
-void createTranslations() {
-
-    const int start = -20;
-    const int end = 20;
-    gNumberOfOffsets = 0;
-    gNumberOfInstances = 0;
-    for (int x = start; x <end; x++) {
-        for (int y = start; y < end; y++) {
-			for (int z = start; z < end; z++) {
-				gOffsets.push_back((float)x * 5.0f);
-				gOffsets.push_back((float)y * 5.0f);
-				gOffsets.push_back((float)z * 5.0f);
-				gNumberOfOffsets += 3;
-				gNumberOfInstances++;
-            }
-        }
-    }
-
-    std::cout << "Number of instances: " << gNumberOfInstances << std::endl;
-}
-
 GLuint CompileShader(GLuint type, const std::string& source) {
 
     GLuint shaderObject;
@@ -230,6 +211,15 @@ void VertexSpecification() {
         6, 7, 3
     };
 
+    // Back-face culling drops every triangle that is not counter-clockwise
+    // seen from outside, so a wrongly wound one would leave a hole
+    WindingReport winding = ValidateWinding(vertexPosition, indices, 3);
+    if (!winding.IsConsistent() || !winding.IsOutward()) {
+        std::cout << "Cube winding is inconsistent: " << winding.mixedEdges << " mixed edges, volume "
+                  << winding.signedVolume << std::endl;
+        exit(1);
+    }
+
     for (GLuint i : indices) {
         gIndices.push_back(i);
     }
@@ -285,7 +275,7 @@ void VertexSpecification() {
     glGenBuffers(1, &gVertexBufferObject);
     glBindBuffer(GL_ARRAY_BUFFER, gVertexBufferObject);
     glBufferData(GL_ARRAY_BUFFER, 
-                 vertexPosition.size() * sizeof(GL_FLOAT), 
+                 vertexPosition.size() * sizeof(GLfloat), 
                  vertexPosition.data(),
                  GL_STATIC_DRAW);
 
@@ -299,21 +289,25 @@ void VertexSpecification() {
 
     glGenBuffers(1, &gColorBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, gColorBuffer);
-    glBufferData(GL_ARRAY_BUFFER, colorData.size() * sizeof(GL_FLOAT), colorData.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, colorData.size() * sizeof(GLfloat), colorData.data(), GL_STATIC_DRAW);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*) 0);
 
     // INDEX
     glGenBuffers(1, &gIndexBufferObject);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIndexBufferObject);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GL_UNSIGNED_INT), indices.data(), GL_STATIC_DRAW); 
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW); 
 
-    createTranslations(); 
+    // The offsets only need to live until they are uploaded
+    InstanceBuffer instances = GenerateInstances(gInstanceGrid);
+    gNumberOfInstances = (int)instances.numberOfInstances;
+    std::cout << "Number of instances: " << gNumberOfInstances
+              << " (generated in " << instances.generationTimeMs << " ms)" << std::endl;
     // Instance VBO
     glGenBuffers(1, &gInstanceVBO);
     glEnableVertexAttribArray(2);
     glBindBuffer(GL_ARRAY_BUFFER, gInstanceVBO); // this attribute comes from a different vertex buffer
-    glBufferData(GL_ARRAY_BUFFER, gNumberOfOffsets * sizeof(GLfloat), &gOffsets[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, instances.offsets.size() * sizeof(GLfloat), instances.offsets.data(), GL_STATIC_DRAW);
     //glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     //glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
@@ -415,7 +409,9 @@ void Input() {
 
 void PreDraw() {
     glEnable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glFrontFace(GL_CCW);
     glDepthFunc(GL_LESS);
     // Initialize clear color
     // This is the background of the screen.
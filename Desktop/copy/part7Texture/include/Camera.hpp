@@ -27,6 +27,9 @@ public:
     void MoveRight(float speed);
     void MoveUp(float speed);
     void MoveDown(float speed);
+    // Puts the camera at eye looking along viewDirection, for replaying
+    // a recorded path
+    void SetPose(const glm::vec3& eye, const glm::vec3& viewDirection);
     // Returns the 'eye' position which
     // is where the camera is.
     float GetEyeXPosition();
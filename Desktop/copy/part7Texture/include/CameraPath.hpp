@@ -0,0 +1,42 @@
+/** @file CameraPath.hpp
+ *  @brief Camera pose per frame, for replaying the same flight twice.
+ *
+ *  A path is a list of eye positions and view directions, one per
+ *  frame. It can be recorded from the interactive camera, saved as a
+ *  text file with one "eyeX eyeY eyeZ viewX viewY viewZ" line per
+ *  frame (lines starting with # are comments), loaded back, or made
+ *  up as one lap around a box.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef CAMERAPATH_HPP
+#define CAMERAPATH_HPP
+
+#include <string>
+#include <vector>
+#include "glm/glm.hpp"
+
+struct CameraPose{
+    glm::vec3 eye = glm::vec3(0.0f);
+    glm::vec3 viewDirection = glm::vec3(0.0f, 0.0f, -1.0f);
+};
+
+class CameraPath{
+public:
+    // Replaces the poses with those of the file. Says what is wrong
+    // and returns false if it cannot be read or has no poses.
+    bool Load(const std::string& path);
+    bool Save(const std::string& path) const;
+    void Add(const CameraPose& pose);
+    // frames poses on one lap inside the box. The view turns from the
+    // center of the box to straight ahead and back, the height goes
+    // up and down twice.
+    static CameraPath MakeOrbit(const glm::vec3& boxMin, const glm::vec3& boxMax, int frames);
+    int GetPoseCount() const;
+    // Pose of a frame, the path starts over past its end
+    const CameraPose& GetPose(int frame) const;
+private:
+    std::vector<CameraPose> m_poses;
+};
+
+#endif
@@ -0,0 +1,107 @@
+/** @file ChunkStreamer.hpp
+ *  @brief Streams an endless lattice of instance chunks around the camera.
+ *
+ *  The world is split into cubic chunks of chunkCells^3 instances.
+ *  Every Update() asks worker threads for the chunks within the
+ *  streaming radius of the eye, evicts chunks that fell out of range
+ *  and uploads finished chunks into free slots of a fixed size pool
+ *  inside the instance buffer. GPU memory therefore stays the same no
+ *  matter how far the camera travels.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef CHUNKSTREAMER_HPP
+#define CHUNKSTREAMER_HPP
+
+#include <glad/glad.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "glm/glm.hpp"
+#include "InstanceChunks.hpp"
+
+struct ChunkStreamerStats{
+    int residentChunks = 0;
+    int poolSlots = 0;
+    // Chunks waiting for or being generated by a worker
+    int pendingChunks = 0;
+    long long chunksGenerated = 0;
+    // Time from requesting a chunk until it was uploaded
+    double lastLatencyMs = 0.0;
+    double averageLatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+    int uploadsLastUpdate = 0;
+};
+
+class ChunkStreamer{
+public:
+    ChunkStreamer();
+    // Stops the workers
+    ~ChunkStreamer();
+    // chunkCells lattice points along each chunk edge, spacing between
+    // them in world units and the streaming radius in chunks. Starts
+    // the worker threads.
+    void Initialize(int chunkCells, float spacing, int radius, float instancePadding);
+    // Stops and joins the worker threads
+    void Shutdown();
+    // Size of the pool the instance buffer has to provide, in
+    // instances (3 floats each)
+    long long GetPoolInstances() const;
+    // Requests and evicts chunks around the eye, given in the model
+    // space of the instance offsets, and uploads at most maxUploads
+    // finished chunks into instanceBuffer.
+    void Update(const glm::vec3& eye, GLuint instanceBuffer, int maxUploads);
+    // Resident chunks, ready for CullChunksLod(), sorted by pool slot
+    const std::vector<InstanceChunk>& GetResidentChunks() const;
+    ChunkStreamerStats GetStats() const;
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Request{
+        glm::ivec3 coord;
+        Clock::time_point requested;
+    };
+    struct Result{
+        glm::ivec3 coord;
+        std::vector<GLfloat> offsets;
+        Clock::time_point requested;
+    };
+
+    static long long Key(const glm::ivec3& coord);
+    glm::ivec3 GetChunkCoord(const glm::vec3& position) const;
+    bool IsWanted(const glm::ivec3& coord) const;
+    void WorkerLoop();
+    void Generate(const glm::ivec3& coord, std::vector<GLfloat>& offsets) const;
+    void RebuildResidentChunks();
+
+    int m_chunkCells;
+    float m_spacing;
+    int m_radius;
+    float m_instancePadding;
+    int m_instancesPerChunk;
+    int m_poolSlots;
+    glm::ivec3 m_center;
+
+    // Main thread only
+    std::unordered_map<long long, int> m_slotOfChunk;
+    std::unordered_map<long long, glm::ivec3> m_coordOfChunk;
+    std::vector<int> m_freeSlots;
+    std::vector<InstanceChunk> m_residentChunks;
+    ChunkStreamerStats m_stats;
+    double m_totalLatencyMs;
+
+    // Shared with the workers, guarded by m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_wakeWorkers;
+    std::deque<Request> m_requests;
+    std::unordered_set<long long> m_pending;
+    std::vector<Result> m_results;
+    bool m_stopping;
+    std::vector<std::thread> m_workers;
+};
+
+#endif
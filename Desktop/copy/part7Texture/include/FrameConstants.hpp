@@ -0,0 +1,55 @@
+/** @file FrameConstants.hpp
+ *  @brief Per-frame constants shared by every program in a uniform buffer.
+ *
+ *  The matrices and camera data change once per frame, not per draw,
+ *  so they are written once into a std140 uniform block that every
+ *  program declaring FrameConstants reads from the same binding point.
+ *  The combined model-view-projection matrix is computed here on the
+ *  CPU, leaving the vertex shader one matrix-vector product.
+ *  Writes go through a RingBuffer so a new frame never waits for the
+ *  GPU to finish reading the previous one.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef FRAMECONSTANTS_HPP
+#define FRAMECONSTANTS_HPP
+
+#include <glad/glad.h>
+#include "glm/glm.hpp"
+#include "RingBuffer.hpp"
+
+// Binding point of the FrameConstants block
+const GLuint gFrameConstantsBinding = 0;
+
+// Mirrors the std140 FrameConstants block in the shaders. Only vec4
+// and mat4 members, so the C++ layout matches std140 without padding.
+struct FrameConstants{
+    glm::mat4 model;
+    glm::mat4 view;
+    glm::mat4 projection;
+    // projection * view * model
+    glm::mat4 modelViewProjection;
+    // xyz is the eye position, w is unused
+    glm::vec4 cameraPosition;
+    // Width and height in pixels, z is the point proxy scale
+    glm::vec4 viewport;
+};
+
+class FrameConstantsBuffer{
+public:
+    FrameConstantsBuffer();
+    ~FrameConstantsBuffer();
+    bool Initialize();
+    void Destroy();
+    // Points the FrameConstants block of program at the shared
+    // binding point. Programs without the block are left alone.
+    static void BindProgram(GLuint program);
+    // Writes this frame's constants and binds them
+    void Update(const FrameConstants& constants);
+    // Call after the frame's draws, see RingBuffer::FinishFrame()
+    void FinishFrame();
+private:
+    RingBuffer m_ring;
+};
+
+#endif
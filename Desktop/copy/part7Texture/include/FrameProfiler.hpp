@@ -0,0 +1,134 @@
+/** @file FrameProfiler.hpp
+ *  @brief CPU and GPU time of every stage of a frame, with percentiles.
+ *
+ *  Stages are timed with a ProfileScope around them. The CPU time is
+ *  taken with steady_clock, the GPU time, for scopes that ask for it,
+ *  with a GL_TIME_ELAPSED query. Queries are double-buffered: frames
+ *  alternate between two sets, and a set's results are read two
+ *  frames after they were issued, just before the set is reused, so
+ *  reading does not wait for the GPU. A result that is still not
+ *  available then is dropped and counted instead.
+ *
+ *  The last gProfileWindow samples of every stage are kept, the
+ *  summaries report p50/p95/p99 over them. While disabled a scope
+ *  costs one branch.
+ *
+ *  GL_TIME_ELAPSED queries cannot nest, so only stages that do not
+ *  overlap may ask for GPU time.
+ *
+ *  Every ProfileScope is a TraceScope of the stage's name as well, so
+ *  the stages show up in a trace without scopes of their own.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef FRAMEPROFILER_HPP
+#define FRAMEPROFILER_HPP
+
+#include <glad/glad.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Tracer.hpp"
+
+enum class ProfileStage{
+    // The whole frame, input to swap
+    Frame,
+    Input,
+    UpdateInstances,
+    PreDraw,
+    Draw,
+    // SDL_GL_SwapWindow, or glFinish in headless mode
+    Swap,
+    Count
+};
+
+const char* GetProfileStageName(ProfileStage stage);
+
+// Samples kept per stage for the percentiles
+const int gProfileWindow = 1024;
+
+struct ProfileSummary{
+    int samples = 0;
+    double minMs = 0.0;
+    double meanMs = 0.0;
+    double p50Ms = 0.0;
+    double p95Ms = 0.0;
+    double p99Ms = 0.0;
+    double maxMs = 0.0;
+};
+
+// Mean, nearest-rank percentiles and extremes of a set of times
+ProfileSummary SummarizeTimes(std::vector<double> ms);
+
+class FrameProfiler{
+public:
+    static FrameProfiler& Instance();
+    // Starts collecting. GPU times need a current context with timer
+    // queries (GL 3.3).
+    void Enable();
+    bool IsEnabled() const{
+        return m_enabled;
+    }
+    // Collects the GPU times of the previous frame and switches query sets
+    void BeginFrame();
+    void BeginStage(ProfileStage stage, bool gpu);
+    void EndStage(ProfileStage stage, bool gpu);
+
+    ProfileSummary GetCpuSummary(ProfileStage stage) const;
+    ProfileSummary GetGpuSummary(ProfileStage stage) const;
+    // GPU results that were not ready in time and were dropped
+    int GetDroppedGpuSamples() const;
+    // One line per stage and clock: stage, clock, samples, mean, p50,
+    // p95, p99 and max in milliseconds
+    bool WriteCSV(const std::string& path) const;
+    void Print() const;
+    // Releases the queries
+    void Destroy();
+private:
+    FrameProfiler();
+    // Rolling window of one stage on one clock
+    struct Samples{
+        std::vector<double> ms;
+        // Next slot to overwrite once the window is full
+        int next = 0;
+        void Add(double value);
+        ProfileSummary Summarize() const;
+    };
+    static const int kQuerySets = 2;
+
+    bool m_enabled;
+    int m_querySet;
+    int m_droppedGpuSamples;
+    int m_framesProfiled;
+    std::chrono::steady_clock::time_point m_stageStart[(int)ProfileStage::Count];
+    Samples m_cpu[(int)ProfileStage::Count];
+    Samples m_gpu[(int)ProfileStage::Count];
+    GLuint m_queries[kQuerySets][(int)ProfileStage::Count];
+    // Whether the query was begun in the frame the set belongs to
+    bool m_queryPending[kQuerySets][(int)ProfileStage::Count];
+};
+
+// Times the enclosing block as stage, on the GPU as well if gpu is set
+class ProfileScope{
+public:
+    ProfileScope(ProfileStage stage, bool gpu = false)
+        : m_trace(GetProfileStageName(stage), gpu),
+          m_stage(stage), m_gpu(gpu), m_active(FrameProfiler::Instance().IsEnabled()){
+        if (m_active) {
+            FrameProfiler::Instance().BeginStage(m_stage, m_gpu);
+        }
+    }
+    ~ProfileScope(){
+        if (m_active) {
+            FrameProfiler::Instance().EndStage(m_stage, m_gpu);
+        }
+    }
+private:
+    // Constructed first and destroyed last, around the profiled part
+    TraceScope m_trace;
+    ProfileStage m_stage;
+    bool m_gpu;
+    bool m_active;
+};
+
+#endif
@@ -0,0 +1,30 @@
+/** @file Frustum.hpp
+ *  @brief View frustum used for visibility tests on the CPU.
+ *
+ *  The six planes are extracted straight from a combined
+ *  projection * view matrix (Gribb/Hartmann), so it always matches
+ *  what the vertex shader does with the same matrices.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include "glm/glm.hpp"
+
+class Frustum{
+public:
+    // An empty frustum accepts everything
+    Frustum();
+    // Builds the frustum of a projection * view matrix
+    explicit Frustum(const glm::mat4& viewProjection);
+    // Returns true if the axis aligned box is at least partially inside
+    bool IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+    // Plane i as (normal.xyz, distance), normals point inwards.
+    // Order is left, right, bottom, top, near, far.
+    const glm::vec4& GetPlane(int i) const;
+private:
+    glm::vec4 m_planes[6];
+};
+
+#endif
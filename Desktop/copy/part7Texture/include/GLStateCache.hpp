@@ -0,0 +1,81 @@
+/** @file GLStateCache.hpp
+ *  @brief Shadows GL state and drops calls that would not change it.
+ *
+ *  Per-frame code sets state through GLStateCache::Instance() instead
+ *  of calling glad directly. Every setter compares against the value
+ *  it last issued and only forwards real changes. State the cache has
+ *  not seen yet, or that was forgotten by Invalidate(), is always
+ *  issued. Setup code may still call GL directly as long as it calls
+ *  Invalidate() before the first frame.
+ *
+ *  Bindings set through the cache are left in place rather than reset
+ *  to 0, the next bind of the same object is then filtered.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef GLSTATECACHE_HPP
+#define GLSTATECACHE_HPP
+
+#include <glad/glad.h>
+#include <unordered_map>
+
+struct GLStateStats{
+    // Calls forwarded to GL
+    int issued = 0;
+    // Calls dropped because the state already matched
+    int filtered = 0;
+};
+
+class GLStateCache{
+public:
+    static GLStateCache& Instance();
+    // Forgets all shadowed state, the next call of each kind is issued
+    void Invalidate();
+
+    void Enable(GLenum capability);
+    void Disable(GLenum capability);
+    void DepthFunc(GLenum function);
+    void CullFace(GLenum mode);
+    void FrontFace(GLenum mode);
+    void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    void ClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+    void UseProgram(GLuint program);
+    // Also forgets GL_ELEMENT_ARRAY_BUFFER, which belongs to the VAO
+    void BindVertexArray(GLuint vertexArray);
+    void BindBuffer(GLenum target, GLuint buffer);
+    // Indexed bindings are not shadowed and always issued, but they
+    // also change the generic binding of target
+    void BindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void ActiveTexture(GLenum unit);
+    // Binds to the active texture unit
+    void BindTexture(GLenum target, GLuint texture);
+
+    // Starts counting a new frame, the finished one becomes GetLastFrameStats()
+    void BeginFrame();
+    GLStateStats GetLastFrameStats() const;
+private:
+    GLStateCache();
+    // Counts the call, returns true if it has to be issued
+    bool Changed(bool changed);
+
+    std::unordered_map<GLenum, bool> m_capabilities;
+    std::unordered_map<GLenum, GLuint> m_buffers;
+    // Keyed by unit * 0x10000 + target
+    std::unordered_map<GLuint, GLuint> m_textures;
+    // -1 while unknown
+    GLint m_depthFunction;
+    GLint m_cullFace;
+    GLint m_frontFace;
+    GLint m_program;
+    GLint m_vertexArray;
+    GLint m_activeTexture;
+    bool m_viewportValid;
+    GLint m_viewport[4];
+    bool m_clearColorValid;
+    GLfloat m_clearColor[4];
+    GLStateStats m_frameStats;
+    GLStateStats m_lastFrameStats;
+};
+
+#endif
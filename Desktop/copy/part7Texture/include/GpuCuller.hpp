@@ -0,0 +1,54 @@
+/** @file GpuCuller.hpp
+ *  @brief Frustum culling of every instance in a compute shader.
+ *
+ *  shaders/cull.glsl tests each instance offset against the frustum
+ *  and appends the visible ones to a second buffer, counting them in
+ *  a DrawElementsIndirectCommand. Drawing then goes through
+ *  glDrawElementsIndirect so the CPU never touches per-instance data.
+ *  Needs a GL 4.3 context; IsSupported() tells the caller when it
+ *  has to fall back to the regular Draw() path.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef GPUCULLER_HPP
+#define GPUCULLER_HPP
+
+#include <glad/glad.h>
+#include "Frustum.hpp"
+#include "MeshRegistry.hpp"
+
+class GpuCuller{
+public:
+    GpuCuller();
+    ~GpuCuller();
+    // True if the current context can run the compute path
+    static bool IsSupported();
+    // program is the linked shaders/cull.glsl, instanceBuffer holds the
+    // float x, y, z offsets. Returns false if the culler cannot be used.
+    bool Initialize(GLuint program, GLuint instanceBuffer, GLsizei numberOfInstances, GLsizei indexCount);
+    // Releases the GL objects
+    void Destroy();
+    bool IsInitialized() const;
+    // Runs the compute pass for this frame
+    void Cull(const Frustum& frustum, float instancePadding);
+    // Issues the indirect draw. The bound VAO must read attribute 2
+    // from GetVisibleBuffer() as 3 floats.
+    void Draw(GLenum indexType) const;
+    // Buffer with the offsets of the visible instances
+    GLuint GetVisibleBuffer() const;
+    // Reads back how many instances survived the last Cull().
+    // This waits for the GPU, so only use it for statistics.
+    GLuint ReadVisibleCount() const;
+private:
+    GLuint m_program;
+    GLuint m_instanceBuffer;
+    GLuint m_visibleBuffer;
+    GLuint m_commandBuffer;
+    GLsizei m_numberOfInstances;
+    GLsizei m_indexCount;
+    GLint m_planesLocation;
+    GLint m_paddingLocation;
+    GLint m_countLocation;
+};
+
+#endif
@@ -0,0 +1,45 @@
+/** @file HeadlessContext.hpp
+ *  @brief OpenGL context without a window, rendering into an FBO.
+ *
+ *  For machines without a display: the context comes from EGL instead
+ *  of SDL, on Mesa's surfaceless platform if it is there, so the
+ *  llvmpipe software driver is enough. libEGL is loaded at run time,
+ *  the windowed build does not link against it. Everything is drawn
+ *  into a framebuffer object of the requested size that stays bound
+ *  for the whole run. Only available on Linux.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef HEADLESSCONTEXT_HPP
+#define HEADLESSCONTEXT_HPP
+
+#include <glad/glad.h>
+#include <string>
+
+class HeadlessContext{
+public:
+    HeadlessContext();
+    ~HeadlessContext();
+    // Creates the context, loads glad and binds a width x height
+    // framebuffer with color and depth. Returns false and says why if
+    // any step fails.
+    bool Create(int width, int height);
+    // Releases the framebuffer and the context
+    void Destroy();
+    bool IsCreated() const;
+    // Writes the color buffer as a binary PPM, top row first
+    bool WritePPM(const std::string& path) const;
+private:
+    int m_width;
+    int m_height;
+    GLuint m_framebuffer;
+    GLuint m_colorBuffer;
+    GLuint m_depthBuffer;
+    // EGL handles, opaque here so this header does not pull in EGL
+    void* m_library;
+    void* m_display;
+    void* m_surface;
+    void* m_context;
+};
+
+#endif
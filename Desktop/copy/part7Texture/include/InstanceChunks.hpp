@@ -0,0 +1,110 @@
+/** @file InstanceChunks.hpp
+ *  @brief Groups instances into spatial chunks for coarse culling.
+ *
+ *  A chunk is a contiguous range of the instance buffer with a world
+ *  space bounding box. Visible chunks that sit next to each other in
+ *  the buffer are merged into runs, and every run is drawn with one
+ *  base-instance draw.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef INSTANCECHUNKS_HPP
+#define INSTANCECHUNKS_HPP
+
+#include <glad/glad.h>
+#include <vector>
+#include "glm/vec3.hpp"
+#include "Frustum.hpp"
+#include "InstanceGenerator.hpp"
+
+struct InstanceChunk{
+    GLint firstInstance = 0;
+    GLsizei instanceCount = 0;
+    // Bounds of the instance offsets grown by the instance padding,
+    // so they enclose the whole meshes and not only their origins.
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // Id in the MeshRegistry every instance of the chunk is drawn with
+    int mesh = 0;
+};
+
+// A range of instances of the same mesh to draw with one call
+struct InstanceRun{
+    GLint firstInstance = 0;
+    GLsizei instanceCount = 0;
+    int mesh = 0;
+};
+
+// Per-frame culling statistics
+struct CullStats{
+    int chunksTotal = 0;
+    int chunksCulled = 0;
+    long long instancesTotal = 0;
+    long long instancesCulled = 0;
+    // Visible instances beyond the LOD distance, drawn as points
+    long long instancesFar = 0;
+    // Draw calls needed for the visible runs
+    int runs = 0;
+};
+
+// Cost of ordering the near chunks front to back
+struct DepthOrderStats{
+    int chunks = 0;
+    double sortMs = 0.0;
+};
+
+// Precision of the view depth the near chunks are sorted by, two
+// radix passes
+const int gDepthKeyBits = 16;
+
+// Reorders the instances so that all instances falling into the same
+// cube of chunkExtent world units are contiguous, and returns one
+// chunk per non-empty cube. Cubes are visited x, then y, then z so
+// that neighbouring chunks are also neighbours in the buffer. An
+// extent that would give more cubes than instances is grown until it
+// does not.
+std::vector<InstanceChunk> SortInstancesIntoChunks(InstanceBuffer& instances,
+                                                   float chunkExtent,
+                                                   float instancePadding);
+
+// Chunks for the procedural format, where the instance order is fixed
+// by gl_InstanceID: one chunk per brick of brickCells lattice points
+// per axis, in the order of GetBrickInstancePosition().
+std::vector<InstanceChunk> BuildGridChunks(const InstanceGrid& grid,
+                                           int brickCells,
+                                           float instancePadding);
+
+// Picks one of meshCount meshes for every chunk. The choice is a hash
+// of where the chunk is, so streamed chunks keep their mesh no matter
+// which pool slot they land in.
+void AssignChunkMeshes(std::vector<InstanceChunk>& chunks, int meshCount);
+
+// Tests every chunk against the frustum and picks a level of detail
+// for the visible ones: chunks whose bounds are all further than
+// lodDistance from the eye end up in farRuns, the rest in nearRuns.
+// Chunks that are adjacent in the instance buffer merge into one run,
+// near ones only if they use the same mesh. Far runs are drawn as
+// points, so they merge across meshes. An infinite lodDistance puts
+// every visible chunk in nearRuns.
+CullStats CullChunksLod(const std::vector<InstanceChunk>& chunks,
+                        const Frustum& frustum,
+                        const glm::vec3& eye,
+                        float lodDistance,
+                        std::vector<InstanceRun>& nearRuns,
+                        std::vector<InstanceRun>& farRuns);
+
+// Same as CullChunksLod, but the near runs come out front to back
+// along viewDirection so early depth testing rejects the fragments of
+// hidden instances before they are shaded. The near chunks are radix
+// sorted by the quantized view depth of their closest point, and only
+// chunks that are still neighbours after sorting merge into runs.
+CullStats CullChunksLodFrontToBack(const std::vector<InstanceChunk>& chunks,
+                                   const Frustum& frustum,
+                                   const glm::vec3& eye,
+                                   const glm::vec3& viewDirection,
+                                   float lodDistance,
+                                   std::vector<InstanceRun>& nearRuns,
+                                   std::vector<InstanceRun>& farRuns,
+                                   DepthOrderStats& orderStats);
+
+#endif
@@ -0,0 +1,66 @@
+/** @file InstanceFormat.hpp
+ *  @brief Compact encodings for the per-instance offset attribute.
+ *
+ *  At millions of instances the instance buffer is fetched every
+ *  frame, so its size matters. The offsets produced by
+ *  GenerateInstances() can be re-encoded in one of several formats
+ *  which vert.glsl knows how to decode (see u_InstanceFormat).
+ *
+ *  @bug No known bugs.
+ */
+#ifndef INSTANCEFORMAT_HPP
+#define INSTANCEFORMAT_HPP
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include "glm/vec4.hpp"
+#include "InstanceGenerator.hpp"
+
+// The values match the u_InstanceFormat switch in shaders/vert.glsl
+enum class InstanceFormat{
+    Float32 = 0, // 3 x 32-bit float, 12 bytes
+    Half16 = 1,  // 4 x half float (glm::packHalf4x16), 8 bytes
+    Snorm16 = 2, // 4 x snorm16 (glm::packSnorm4x16) + per-chunk scale/bias, 8 bytes
+    Grid16 = 3,  // 4 x int16 lattice coordinates times the grid spacing, 8 bytes
+    Procedural = 4 // nothing stored, vert.glsl computes the offset from gl_InstanceID
+};
+
+// Instances that share one scale/bias pair in the Snorm16 format
+const int gInstanceFormatChunkSize = 4096;
+
+// Vertex attribute layout of one encoded instance, the arguments
+// of glVertexAttribPointer.
+struct InstanceAttribute{
+    GLint components = 3;
+    GLenum type = GL_FLOAT;
+    GLboolean normalized = GL_FALSE;
+    GLsizei stride = 3 * sizeof(GLfloat);
+};
+
+// Instance data ready to be handed to glBufferData/glVertexAttribPointer.
+struct EncodedInstances{
+    InstanceFormat format = InstanceFormat::Float32;
+    std::vector<unsigned char> data;
+    InstanceAttribute attribute;
+    // Snorm16 only: for each chunk of gInstanceFormatChunkSize instances
+    // a (scale.xyz, 0) texel followed by a (bias.xyz, 0) texel.
+    std::vector<glm::vec4> chunkScaleBias;
+};
+
+// Parses "float", "half", "snorm16", "grid16" or "procedural". Returns false on an
+// unknown name and leaves format untouched.
+bool ParseInstanceFormat(const std::string& name, InstanceFormat& format);
+// Human readable name of a format
+const char* GetInstanceFormatName(InstanceFormat format);
+// Size in bytes of one encoded instance
+GLsizei GetInstanceFormatStride(InstanceFormat format);
+
+// Re-encodes the generated offsets. The grid is needed by Grid16
+// which stores lattice coordinates instead of positions. Procedural
+// has no storage and yields an empty buffer.
+EncodedInstances EncodeInstances(const InstanceBuffer& instances,
+                                 const InstanceGrid& grid,
+                                 InstanceFormat format);
+
+#endif
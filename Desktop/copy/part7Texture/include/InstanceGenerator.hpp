@@ -0,0 +1,66 @@
+/** @file InstanceGenerator.hpp
+ *  @brief Builds the per-instance offsets for the cube lattice.
+ *
+ *  The lattice is described by an InstanceGrid. The output buffer
+ *  is sized once up front and filled in parallel, so startup cost
+ *  stays reasonable when the grid is pushed towards millions of
+ *  instances.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef INSTANCEGENERATOR_HPP
+#define INSTANCEGENERATOR_HPP
+
+#include <glad/glad.h>
+#include <vector>
+#include "glm/vec3.hpp"
+
+// Describes a regular lattice of instances.
+struct InstanceGrid{
+    // Lattice coordinates run from start (inclusive) to end (exclusive)
+    // along every used axis.
+    int start = -15;
+    int end = 15;
+    // World space distance between two neighbouring instances
+    float spacing = 5.0f;
+    // How many axes the lattice spreads over (1 = line along x,
+    // 2 = plane in x/y, 3 = volume). Unused axes stay at 0.
+    int dimensions = 3;
+
+    // Number of lattice points along one axis
+    int GetCellsPerAxis() const;
+    // Total number of instances in the lattice
+    long long GetNumberOfInstances() const;
+};
+
+// Owned result of a generation pass.
+struct InstanceBuffer{
+    // Tightly packed x, y, z offsets, one triple per instance
+    std::vector<GLfloat> offsets;
+    long long numberOfInstances = 0;
+    // Wall clock time spent generating, in milliseconds
+    double generationTimeMs = 0.0;
+};
+
+// Returns the world space offset of the instance with the given index.
+// Instances are ordered with z varying fastest, then y, then x, which
+// matches the original nested createTranslations() loops.
+glm::vec3 GetInstancePosition(const InstanceGrid& grid, long long index);
+
+// Same for the order of the procedural instance format, which goes
+// brick by brick so that every brick is one range of gl_InstanceID to
+// cull as a chunk. The lattice is cut into bricks of brickCells points
+// per axis, smaller where the lattice ends. Bricks are visited x, then
+// y, then z, and inside a brick z varies fastest, then y, then x.
+// This is the CPU reference of DecodeOffset() in vert.glsl, which must
+// produce the same mapping.
+glm::vec3 GetBrickInstancePosition(const InstanceGrid& grid, int brickCells, long long index);
+
+// Stateless hash of an instance index to [0, 1). Different seeds give
+// independent values, e.g. one per component of a random vector.
+float GetInstanceRandom(long long index, unsigned int seed);
+
+// Generates the offsets for every instance of the grid across all cores.
+InstanceBuffer GenerateInstances(const InstanceGrid& grid);
+
+#endif
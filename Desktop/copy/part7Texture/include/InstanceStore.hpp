@@ -0,0 +1,73 @@
+/** @file InstanceStore.hpp
+ *  @brief Structure-of-arrays instance data and the animation kernels.
+ *
+ *  Every instance keeps its rest position, a velocity and a phase in
+ *  separate arrays, so the kernels can process 4 (SSE) or 8 (AVX2)
+ *  instances per instruction. Positions are a pure function of time,
+ *  nothing accumulates between frames. Update() splits the instances
+ *  across all cores and writes interleaved x, y, z floats straight
+ *  into the instance buffer.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef INSTANCESTORE_HPP
+#define INSTANCESTORE_HPP
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include "InstanceGenerator.hpp"
+
+enum class InstanceAnimation{
+    // Rest positions
+    None = 0,
+    // Bob up and down in a wave travelling across the lattice
+    Wave = 1,
+    // Circle around the rest position in the x/z plane
+    Orbit = 2,
+    // Move with a per-instance velocity, wrapped around the own cell
+    Drift = 3
+};
+
+// Parses "none", "wave", "orbit" or "drift". Returns false otherwise.
+bool ParseInstanceAnimation(const std::string& name, InstanceAnimation& animation);
+const char* GetInstanceAnimationName(InstanceAnimation animation);
+
+struct InstanceStoreStats{
+    long long updates = 0;
+    // Wall clock time of Update(), in milliseconds
+    double lastUpdateMs = 0.0;
+    double averageUpdateMs = 0.0;
+    double maxUpdateMs = 0.0;
+};
+
+class InstanceStore{
+public:
+    InstanceStore();
+    // Takes the rest positions from the interleaved offsets and seeds
+    // velocity and phase. spacing is the lattice spacing.
+    void Initialize(const InstanceBuffer& instances, float spacing);
+    bool IsInitialized() const;
+    long long GetNumberOfInstances() const;
+    // Furthest any animation moves an instance from its rest position
+    // along one axis. Chunk bounds have to grow by this much.
+    static float GetMaxDisplacement(float spacing);
+    // Writes the positions at time (in seconds) of every instance as
+    // x, y, z floats into destination
+    void Update(InstanceAnimation animation, float time, GLfloat* destination);
+    // "avx2", "sse2" or "scalar", whichever Update() runs
+    const char* GetKernelName() const;
+    InstanceStoreStats GetStats() const;
+private:
+    std::vector<float> m_restX;
+    std::vector<float> m_restY;
+    std::vector<float> m_restZ;
+    std::vector<float> m_velocityX;
+    std::vector<float> m_velocityY;
+    std::vector<float> m_velocityZ;
+    std::vector<float> m_phase;
+    float m_spacing;
+    InstanceStoreStats m_stats;
+};
+
+#endif
@@ -0,0 +1,65 @@
+/** @file InstanceTransform.hpp
+ *  @brief Per-instance rotation and scale on top of the instance offset.
+ *
+ *  The compact format stores a unit quaternion packed with
+ *  glm::packSnorm4x16 and a uniform scale, 12 bytes per instance next
+ *  to the offset. vert.glsl reads the quaternion as four normalized
+ *  shorts and rotates the vertex with it. The mat4 format stores the
+ *  whole model matrix, translation included, in 64 bytes per instance
+ *  and only exists to compare against.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef INSTANCETRANSFORM_HPP
+#define INSTANCETRANSFORM_HPP
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include "glm/gtc/quaternion.hpp"
+
+// Must match u_InstanceTransform in vert.glsl
+enum class InstanceTransformFormat{
+    // Translation only, every cube is axis aligned and unscaled
+    None = 0,
+    // Offset plus a snorm16 quaternion and a float scale
+    Packed = 1,
+    // One mat4 per instance, the offset attribute is not used
+    Matrix = 2
+};
+
+// Parses "none", "packed" or "matrix". Returns false otherwise.
+bool ParseInstanceTransformFormat(const std::string& name, InstanceTransformFormat& format);
+const char* GetInstanceTransformFormatName(InstanceTransformFormat format);
+
+// One Packed transform as laid out in the buffer
+struct PackedInstanceTransform{
+    // x, y, z, w of the quaternion as snorm16, the result of
+    // glm::packSnorm4x16 split into two words to keep 4 byte alignment
+    GLuint rotation[2];
+    GLfloat scale;
+};
+
+struct InstanceTransforms{
+    InstanceTransformFormat format = InstanceTransformFormat::None;
+    std::vector<unsigned char> data;
+    // Bytes per instance
+    GLsizei stride = 0;
+};
+
+// Largest scale GetInstanceScale() hands out. A rotated cube reaches
+// sqrt(3) times its half size, chunk bounds have to allow for both.
+const float gInstanceMaxScale = 1.5f;
+// Smallest scale GetInstanceScale() hands out
+const float gInstanceMinScale = 0.5f;
+
+// Random but repeatable rotation and scale of the instance with the
+// given index
+glm::quat GetInstanceRotation(long long index);
+float GetInstanceScale(long long index);
+
+// Builds the transforms of every instance. offsets holds 3 floats
+// per instance and is only read by the Matrix format.
+InstanceTransforms BuildInstanceTransforms(InstanceTransformFormat format, long long numberOfInstances, const GLfloat* offsets);
+
+#endif
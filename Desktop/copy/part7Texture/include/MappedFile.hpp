@@ -0,0 +1,43 @@
+/** @file MappedFile.hpp
+ *  @brief Read-only memory mapping of a whole file.
+ *
+ *  mmap on Linux and macOS, a file mapping on Windows. Pages are read
+ *  in as they are touched and shared with the page cache, so nothing
+ *  is copied until the data is used.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile{
+public:
+    MappedFile();
+    // Unmaps the file
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    // Maps path, replacing any earlier mapping. False if the file
+    // cannot be opened or is empty.
+    bool Open(const std::string& path);
+    void Close();
+    bool IsOpen() const;
+    const unsigned char* GetData() const;
+    std::size_t GetSize() const;
+private:
+    const unsigned char* m_data;
+    std::size_t m_size;
+    // Windows file and mapping handles
+    void* m_file;
+    void* m_mapping;
+};
+
+// Size and last modification time of a file, in nanoseconds on
+// systems that keep them that precisely. False if it does not exist.
+bool GetFileStamp(const std::string& path, std::uint64_t& size, std::int64_t& modifiedNs);
+
+#endif
@@ -0,0 +1,38 @@
+/** @file MeshOptimizer.hpp
+ *  @brief Reorders triangle lists for the post-transform vertex cache.
+ *
+ *  The GPU keeps the outputs of recently shaded vertices and reuses
+ *  them when the same index comes around again soon. Triangle order
+ *  decides how often that happens, and every miss is a vertex shader
+ *  invocation paid again for every instance of the mesh.
+ *  OptimizeVertexCache() implements Tom Forsyth's linear-speed
+ *  greedy ordering, SimulateVertexCache() counts the invocations a
+ *  FIFO cache of gVertexCacheSize entries would need.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef MESHOPTIMIZER_HPP
+#define MESHOPTIMIZER_HPP
+
+#include <glad/glad.h>
+#include <vector>
+
+// Cache size the invocation counts are reported for. Real caches
+// differ between GPUs, 16 is a conservative middle.
+const int gVertexCacheSize = 16;
+
+// Vertex shader invocations a FIFO cache of cacheSize entries needs
+// for one draw of the triangle list
+int SimulateVertexCache(const std::vector<GLuint>& indices, int cacheSize = gVertexCacheSize);
+
+// Reorders the triangles of indices for vertex cache reuse. The
+// triangles themselves and their winding stay the same.
+void OptimizeVertexCache(std::vector<GLuint>& indices, GLsizei vertexCount);
+
+// Renumbers the vertices in the order the indices first use them and
+// moves their data along, so the vertex fetch reads memory mostly
+// front to back. Vertices no index uses are dropped. vertices holds
+// components floats per vertex.
+void OptimizeVertexFetch(std::vector<GLfloat>& vertices, std::vector<GLuint>& indices, int components);
+
+#endif
@@ -0,0 +1,151 @@
+/** @file MeshRegistry.hpp
+ *  @brief Packs many meshes into one vertex and one index buffer.
+ *
+ *  Every mesh registered with AddMesh() is appended to shared
+ *  mega-buffers and remembered as a (firstIndex, indexCount,
+ *  baseVertex) range, so a single VAO can draw all of them. The
+ *  draws of a frame are collected as DrawElementsIndirectCommands and
+ *  submitted with one glMultiDrawElementsIndirect (GL 4.3). Without
+ *  it MultiDraw() loops over base-vertex/base-instance draws instead.
+ *
+ *  Meshes are added as x, y, z, u, v floats like the original cube.
+ *  AddMesh() reorders their triangles for the vertex cache and their
+ *  vertices for fetch order. Upload() then packs them in the selected
+ *  MeshVertexFormat and picks the smallest index type that can
+ *  address every mesh. Meshes must be closed and wound counter-clockwise
+ *  from outside, see MeshValidation.hpp, since the cubes are drawn with
+ *  back-face culling. The generated meshes stay inside the cube's
+ *  [-extent, extent] box so the existing instance padding still
+ *  bounds them.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef MESHREGISTRY_HPP
+#define MESHREGISTRY_HPP
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include "RingBuffer.hpp"
+#include "glm/vec3.hpp"
+
+// Layout mandated by glDrawElementsIndirect and glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Floats per vertex: position and texture coordinate
+const int gMeshVertexComponents = 5;
+
+// How vertices are stored in the vertex mega-buffer. The packed
+// formats keep positions as normalized fractions of
+// MeshRegistry::GetPositionScale() and texture coordinates as unorm16.
+// GL 4.1 contexts still decode snorm with the older (2c + 1) / (2^b - 1)
+// rule, which moves positions by up to half a step.
+enum class MeshVertexFormat{
+    // 3 + 2 floats, 20 bytes
+    Float32,
+    // snorm16 x4 position and unorm16 x2 uv, 12 bytes
+    Snorm16,
+    // snorm8 x4 position and unorm16 x2 uv, 8 bytes
+    Snorm8
+};
+
+// Parses float, snorm16 or snorm8, returns false for anything else
+bool ParseMeshVertexFormat(const std::string& name, MeshVertexFormat& format);
+const char* GetMeshVertexFormatName(MeshVertexFormat format);
+
+struct MeshData{
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> indices;
+};
+
+// Where a registered mesh lives inside the mega-buffers
+struct Mesh{
+    std::string name;
+    GLuint firstIndex = 0;
+    GLsizei indexCount = 0;
+    GLint baseVertex = 0;
+    GLsizei vertexCount = 0;
+    // Vertex shader invocations per instance, see SimulateVertexCache()
+    int invocationsBefore = 0;
+    int invocations = 0;
+};
+
+// Submission counts of the mesh draws of one frame
+struct MeshDrawStats{
+    int commands = 0;
+    int drawCalls = 0;
+    long long vertices = 0;
+};
+
+// Latitude/longitude sphere of the given radius with counter-clockwise
+// outward faces. roughness > 0 pushes every vertex in or out by up to
+// that fraction of the radius, which turns the sphere into a rock.
+MeshData BuildSphereMesh(int rings, int segments, float radius, float roughness = 0.0f, unsigned int seed = 0);
+
+class MeshRegistry{
+public:
+    MeshRegistry();
+    ~MeshRegistry();
+    // Appends a mesh before Upload() and returns its id, or -1 if its
+    // triangles are not all wound counter-clockwise seen from outside
+    int AddMesh(const std::string& name, const MeshData& data);
+    // Creates the mega-buffers from all added meshes and frees the CPU copies
+    void Upload(MeshVertexFormat format);
+    // Points attributes 0 and 1 and the element buffer of the bound VAO
+    // at the mega-buffers
+    void AttachToVertexArray() const;
+    // Releases the GL objects
+    void Destroy();
+
+    int GetMeshCount() const;
+    const Mesh& GetMesh(int id) const;
+    // Triangles of the mesh that face eye, given in the mesh's own space,
+    // and so survive back-face culling
+    int CountFrontFacing(int id, const glm::vec3& eye) const;
+    GLuint GetVertexBuffer() const;
+    GLuint GetIndexBuffer() const;
+    // GL_UNSIGNED_SHORT unless a mesh has more than 65536 vertices
+    GLenum GetIndexType() const;
+    GLsizei GetIndexSize() const;
+    GLsizei GetVertexStride() const;
+    // Multiplier vert.glsl applies to the stored positions
+    float GetPositionScale() const;
+    // Largest position error the packing introduced, in model units
+    float GetMaxPositionError() const;
+
+    // True if the context has glMultiDrawElementsIndirect
+    static bool IsMultiDrawSupported();
+    // Reserves per-frame indirect command storage for up to maxCommands
+    // commands. Without it, or on older contexts, MultiDraw() loops.
+    void InitializeMultiDraw(int maxCommands, int frameCount = 3);
+    bool IsMultiDrawInitialized() const;
+    // Draws the commands with the bound VAO and returns the number of
+    // draw calls it took. Needs GL 4.2 base-instance draws when the
+    // indirect path is not available.
+    int MultiDraw(const std::vector<DrawElementsIndirectCommand>& commands);
+    // Fences the indirect commands of this frame
+    void FinishFrame();
+private:
+    std::vector<Mesh> m_meshes;
+    // CPU copies until Upload()
+    std::vector<GLfloat> m_vertices;
+    std::vector<GLuint> m_indices;
+    // Float geometry of every mesh, kept for CountFrontFacing()
+    std::vector<MeshData> m_shapes;
+    GLuint m_vertexBuffer;
+    GLuint m_indexBuffer;
+    MeshVertexFormat m_vertexFormat;
+    GLenum m_indexType;
+    float m_positionScale;
+    float m_maxPositionError;
+    RingBuffer m_commandRing;
+    int m_maxCommands;
+};
+
+#endif
@@ -0,0 +1,51 @@
+/** @file MipChain.hpp
+ *  @brief Mip levels of an image, computed on the CPU.
+ *
+ *  Every level is half the size of the one above it, rounded down and
+ *  at least 1, down to 1x1. With the box filter a texel is the rounded
+ *  average of the 2x2 texels above it; where a side of 1 cannot be
+ *  halved the single row or column is averaged with itself. The Kaiser
+ *  filter weighs the 8x8 texels around that 2x2 block with a windowed
+ *  sinc instead, which keeps more detail in the smaller levels and
+ *  aliases less, at about four times the cost; texels past an edge
+ *  repeat the edge.
+ *
+ *  Rows of a level are split across the worker threads, and each row
+ *  is filtered 16 samples at a time with SSE2 where the compiler
+ *  targets it. On x86 with GCC or Clang the vertical pass takes 32
+ *  samples at a time with AVX2 when the CPU running us has it. The box
+ *  filter gives the same bytes either way, the Kaiser filter the same
+ *  bytes with and without AVX2.
+ *
+ *  @bug An odd sized level drops its last row or column, like most
+ *  glGenerateMipmap implementations do.
+ */
+#ifndef MIPCHAIN_HPP
+#define MIPCHAIN_HPP
+
+#include <string>
+#include <vector>
+#include "PPMImage.hpp"
+
+enum class MipFilter{
+    Box,
+    Kaiser
+};
+
+// Accepts "box" and "kaiser"
+bool ParseMipFilter(const std::string& name, MipFilter& filter);
+const char* GetMipFilterName(MipFilter filter);
+
+// "avx2", "sse2" or "scalar", the widest row pass DownsampleImage() runs
+const char* GetMipKernelName();
+// Levels of a width x height image, the base level included
+int GetMipLevelCount(int width, int height);
+// Writes the next smaller level of source into destination
+void DownsampleImage(const Image& source, Image& destination, MipFilter filter = MipFilter::Box);
+// The box filter one texel at a time on the calling thread, what
+// DownsampleImage() is checked and measured against
+void DownsampleImageScalar(const Image& source, Image& destination);
+// Replaces levels with levels 1 to the 1x1 one of base
+void BuildMipChain(const Image& base, std::vector<Image>& levels, MipFilter filter = MipFilter::Box);
+
+#endif
@@ -0,0 +1,78 @@
+/** @file OcclusionCuller.hpp
+ *  @brief Hierarchical-Z occlusion culling of instance chunks on the CPU.
+ *
+ *  Occluders are software rasterized into a small depth buffer that
+ *  keeps, per pixel, the view depth of the nearest occluder. A pyramid
+ *  of max-depth levels is built on top of it, so a level-n texel holds
+ *  the furthest depth of the 2^n x 2^n pixels under it. A chunk is
+ *  occluded when the nearest point of its bounds lies behind every
+ *  texel its screen rectangle touches, which takes only a handful of
+ *  texel reads at the right level.
+ *
+ *  Every occluder triangle is written with the furthest depth of its
+ *  three corners and occluders crossing the near plane are skipped,
+ *  so the buffer never claims more than the occluders cover. It does
+ *  not need a GL context at all.
+ *
+ *  @bug Coverage is sampled at pixel centers, an occludee that only
+ *  shows through a sliver of a pixel can be culled.
+ */
+#ifndef OCCLUSIONCULLER_HPP
+#define OCCLUSIONCULLER_HPP
+
+#include <chrono>
+#include <vector>
+#include "glm/glm.hpp"
+#include "Frustum.hpp"
+#include "InstanceChunks.hpp"
+
+// Results of the last CullChunks()
+struct OcclusionStats{
+    int occluders = 0;
+    // Chunks inside the frustum, only those are tested
+    int chunksTested = 0;
+    int chunksOccluded = 0;
+    long long instancesTested = 0;
+    long long instancesOccluded = 0;
+    double rasterizeMs = 0.0;
+    double testMs = 0.0;
+};
+
+class OcclusionCuller{
+public:
+    OcclusionCuller();
+    // Size of the depth buffer, the pyramid halves it down to 1x1
+    void Initialize(int width, int height);
+    bool IsInitialized() const;
+    // Clears the depth buffer for a frame seen from eye through
+    // viewProjection
+    void BeginFrame(const glm::mat4& viewProjection, const glm::vec3& eye);
+    // Rasterizes a solid axis aligned box, it has to lie inside what
+    // is actually drawn there
+    void AddOccluder(const glm::vec3& boxMin, const glm::vec3& boxMax);
+    // Builds the max-depth levels once all occluders are in
+    void BuildPyramid();
+    // True if the box is hidden behind the occluders wherever it is on screen
+    bool IsOccluded(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+    // Copies the chunks that are not occluded to visible. Chunks outside
+    // the frustum are copied untested, the frustum culling drops them.
+    OcclusionStats CullChunks(const std::vector<InstanceChunk>& chunks,
+                              const Frustum& frustum,
+                              std::vector<InstanceChunk>& visible);
+private:
+    // Pixel position and view depth of a world space point. False if it
+    // is too close to or behind the eye to project.
+    bool Project(const glm::vec3& point, glm::vec3& screen) const;
+    void RasterizeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+    glm::mat4 m_viewProjection;
+    glm::vec3 m_eye;
+    // Level 0 is the depth buffer, every further level half the size
+    std::vector<std::vector<float>> m_levels;
+    std::vector<glm::ivec2> m_levelSizes;
+    int m_occluders;
+    double m_rasterizeMs;
+    std::chrono::steady_clock::time_point m_frameStart;
+};
+
+#endif
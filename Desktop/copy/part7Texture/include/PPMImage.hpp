@@ -0,0 +1,49 @@
+/** @file PPMImage.hpp
+ *  @brief Netpbm image loading straight from a memory-mapped file.
+ *
+ *  Reads ASCII P3 and binary P6 (RGB) and P5 (grey) files. The file
+ *  is mapped instead of read, ASCII samples are parsed by a scanner
+ *  that walks the mapping once, and every pixel is written where it
+ *  ends up, so flipping costs no second copy. Samples with a maximum
+ *  other than 255 are rescaled to 8 bits, 16 bit binary samples
+ *  included.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef PPMIMAGE_HPP
+#define PPMIMAGE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// 8 bit image that owns its pixels, rows tightly packed
+class Image{
+public:
+    Image();
+    // Replaces the pixels with uninitialized ones of the given size
+    void Allocate(int width, int height, int channels);
+    void Release();
+    bool IsEmpty() const;
+    int GetWidth() const;
+    int GetHeight() const;
+    // 1 for grey, 3 for RGB
+    int GetChannels() const;
+    std::size_t GetSize() const;
+    unsigned char* GetPixels();
+    const unsigned char* GetPixels() const;
+private:
+    int m_width;
+    int m_height;
+    int m_channels;
+    std::unique_ptr<unsigned char[]> m_pixels;
+};
+
+// Loads a P3, P5 or P6 file into image. With flip the pixel order is
+// reversed, the same as the original loader did: the first pixel of
+// the file ends up last, which turns the image upside down and
+// mirrors it. Says what is wrong and returns false if the file cannot
+// be read or is not a valid image, image is left empty then.
+bool LoadPPMImage(const std::string& path, bool flip, Image& image);
+
+#endif
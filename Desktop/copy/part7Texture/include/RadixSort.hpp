@@ -0,0 +1,35 @@
+/** @file RadixSort.hpp
+ *  @brief Stable parallel LSD radix sort of key/value pairs.
+ *
+ *  Every pass sorts by 8 bits of the key. The input is cut into one
+ *  block per worker, the workers count the digits of their block,
+ *  a prefix sum over (digit, block) turns the counts into write
+ *  positions and the workers scatter their block in parallel. Blocks
+ *  keep their order within every digit, so the sort is stable and
+ *  the result does not depend on the number of threads.
+ *
+ *  A block holds at least 1024 keys; below that the counting is
+ *  cheaper than starting a thread. The few hundred chunks of the
+ *  default --chunk-extent therefore sort as one block on the calling
+ *  thread, and the thousands of a fine one across the workers.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef RADIXSORT_HPP
+#define RADIXSORT_HPP
+
+#include <cstdint>
+#include <vector>
+
+// Sorts keys ascending and moves values along. Only the low keyBits
+// bits of the keys are looked at, rounded up to whole passes of 8 bits,
+// so narrow keys take fewer passes. keys and values must be the same
+// size.
+void RadixSortByKey(std::vector<std::uint32_t>& keys, std::vector<std::uint32_t>& values, int keyBits = 32);
+// RadixSortByKey() with the input cut into blockCount blocks however
+// few keys or workers there are, what the self test checks the block
+// merging with
+void RadixSortByKeyInBlocks(std::vector<std::uint32_t>& keys, std::vector<std::uint32_t>& values, int keyBits,
+                            std::size_t blockCount);
+
+#endif
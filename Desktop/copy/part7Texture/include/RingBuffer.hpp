@@ -0,0 +1,68 @@
+/** @file RingBuffer.hpp
+ *  @brief Buffer of several frame slots for data rewritten every frame.
+ *
+ *  Each frame the CPU writes into the next slot while the GPU may
+ *  still be reading the slots of the previous frames. A fence is
+ *  placed after the draws of every slot and only waited on when the
+ *  CPU comes back around to that slot, so with three slots the CPU
+ *  writes frame N+2 while the GPU reads frame N.
+ *
+ *  With GL 4.4 the buffer is mapped once, persistently and coherently.
+ *  Older contexts map each slot with GL_MAP_UNSYNCHRONIZED_BIT, which
+ *  is safe because the fences already do the synchronization.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef RINGBUFFER_HPP
+#define RINGBUFFER_HPP
+
+#include <glad/glad.h>
+#include <vector>
+
+struct RingBufferStats{
+    long long frames = 0;
+    // Frames that found their slot still in use by the GPU
+    long long stalls = 0;
+    double stallTimeMs = 0.0;
+    bool persistent = false;
+};
+
+class RingBuffer{
+public:
+    RingBuffer();
+    ~RingBuffer();
+    // Creates frameCount slots of at least frameSize bytes each,
+    // bound to target while mapping. Returns false on failure.
+    bool Initialize(GLenum target, GLsizeiptr frameSize, int frameCount = 3);
+    // Waits for outstanding fences and releases the GL objects
+    void Destroy();
+    bool IsInitialized() const;
+    // Waits until the GPU is done with the current slot and returns
+    // frameSize writable bytes
+    void* BeginWrite();
+    // Ends the writes of this frame, draws may read the slot after it
+    void EndWrite();
+    // Fences the current slot after the draws that read it and moves
+    // on to the next slot
+    void FinishFrame();
+    GLuint GetBuffer() const;
+    // Byte offset of the current slot inside GetBuffer()
+    GLintptr GetWriteOffset() const;
+    GLsizeiptr GetFrameSize() const;
+    RingBufferStats GetStats() const;
+private:
+    GLenum m_target;
+    GLuint m_buffer;
+    GLsizeiptr m_frameSize;
+    // Slot size rounded up to the offset alignment of the target
+    GLsizeiptr m_slotStride;
+    int m_frameCount;
+    int m_current;
+    // Whole buffer when persistently mapped, null otherwise
+    unsigned char* m_persistentData;
+    bool m_mapped;
+    std::vector<GLsync> m_fences;
+    RingBufferStats m_stats;
+};
+
+#endif
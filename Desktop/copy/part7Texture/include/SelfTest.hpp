@@ -0,0 +1,16 @@
+/** @file SelfTest.hpp
+ *  @brief Checks of CPU code whose mistakes a frame would not show,
+ *  run with --self-test.
+ *
+ *  Every check prints one line with its result. None needs a window
+ *  or a GL context, so they run before either is made.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef SELFTEST_HPP
+#define SELFTEST_HPP
+
+// Runs every check, true when all of them pass
+bool RunSelfTests();
+
+#endif
@@ -0,0 +1,94 @@
+/** @file ShaderProgram.hpp
+ *  @brief Linked program with reflected uniforms and attributes.
+ *
+ *  The active uniforms and attributes are queried once after linking,
+ *  so setting a uniform never goes through glGetUniformLocation. The
+ *  setters take a UniformHandle that FindUniform() resolved once, so a
+ *  frame neither builds nor hashes uniform names. Each uniform
+ *  remembers the value last uploaded and the setters skip the
+ *  glUniform call when nothing changed. Uploads and skips are counted
+ *  per frame.
+ *
+ *  Uniforms are set with glUniform*, so the program has to be in use
+ *  when a setter is called.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef SHADERPROGRAM_HPP
+#define SHADERPROGRAM_HPP
+
+#include <glad/glad.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "glm/glm.hpp"
+
+struct UniformUploadStats{
+    // glUniform calls issued
+    int uploads = 0;
+    // Setter calls that matched the value already in the program
+    int skipped = 0;
+    // Setter calls for uniforms the program does not use
+    int inactive = 0;
+};
+
+// A uniform of one ShaderProgram, from FindUniform(). The default one
+// and those of names the program does not use set nothing.
+struct UniformHandle{
+    int index = -1;
+};
+
+class ShaderProgram{
+public:
+    ShaderProgram();
+    ~ShaderProgram();
+    // Takes over a linked program object and reflects it. A program
+    // that failed to link is kept but reports no uniforms.
+    void Attach(GLuint program);
+    // Deletes the program object
+    void Destroy();
+    GLuint GetID() const;
+    void Use() const;
+    int GetUniformCount() const;
+    int GetAttributeCount() const;
+    // Location of an active uniform, -1 if the program does not use it.
+    // Arrays are found by their name without the [0].
+    GLint GetUniformLocation(const std::string& name) const;
+    GLint GetAttributeLocation(const std::string& name) const;
+    // Handle of a uniform for the setters, found the same way as
+    // GetUniformLocation(). Valid until the next Attach().
+    UniformHandle FindUniform(const std::string& name) const;
+
+    void SetUniform(UniformHandle uniform, GLint value);
+    void SetUniform(UniformHandle uniform, bool value);
+    void SetUniform(UniformHandle uniform, GLfloat value);
+    void SetUniform(UniformHandle uniform, const glm::vec2& value);
+    void SetUniform(UniformHandle uniform, const glm::vec3& value);
+    void SetUniform(UniformHandle uniform, const glm::vec4& value);
+    void SetUniform(UniformHandle uniform, const glm::mat4& value);
+    void SetUniform(UniformHandle uniform, const glm::vec4* values, GLsizei count);
+
+    // Starts counting a new frame, the finished one becomes GetLastFrameStats()
+    void BeginFrame();
+    UniformUploadStats GetLastFrameStats() const;
+private:
+    struct Uniform{
+        GLint location;
+        // Last uploaded value, empty until the first upload
+        std::vector<unsigned char> value;
+    };
+    // Records value for the uniform. Returns null when the upload can
+    // be skipped, either because the uniform is inactive or because it
+    // already holds value.
+    Uniform* Record(UniformHandle handle, const void* value, std::size_t size);
+
+    GLuint m_program;
+    std::vector<Uniform> m_uniforms;
+    // Index into m_uniforms by name
+    std::unordered_map<std::string, int> m_uniformIndices;
+    std::unordered_map<std::string, GLint> m_attributes;
+    UniformUploadStats m_frameStats;
+    UniformUploadStats m_lastFrameStats;
+};
+
+#endif
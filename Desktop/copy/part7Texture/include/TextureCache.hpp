@@ -0,0 +1,99 @@
+/** @file TextureCache.hpp
+ *  @brief Decoded textures with their mip chain, kept on disk between runs.
+ *
+ *  The first time a source image is loaded it is decoded, its mip
+ *  chain computed, and everything is written to one file in the cache
+ *  directory. Later loads map that file and hand out pointers into the
+ *  mapping, level by level, so nothing is parsed or copied before the
+ *  upload. A cache file is only used if it was made from a file at
+ *  the same path with the same size and modification time, and with
+ *  the same flip and mip filter, otherwise it is rebuilt.
+ *
+ *  The file is a fixed header, the source path, one entry per level
+ *  and the levels, each starting 64 byte aligned. Numbers are stored
+ *  in the byte order of the machine that wrote them, a file from the
+ *  other byte order fails the magic check and is rebuilt.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef TEXTURECACHE_HPP
+#define TEXTURECACHE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "MappedFile.hpp"
+#include "MipChain.hpp"
+#include "PPMImage.hpp"
+
+// One mip level, tightly packed rows
+struct TextureLevel{
+    int width = 0;
+    int height = 0;
+    const unsigned char* pixels = nullptr;
+    std::size_t size = 0;
+};
+
+// Levels of a loaded texture, valid while this object lives. They
+// point into the mapped cache file, or into images of its own when
+// the cache could not be used.
+class CachedTexture{
+public:
+    int GetChannels() const;
+    int GetLevelCount() const;
+    const TextureLevel& GetLevel(int level) const;
+    // True if the levels come from an existing cache file
+    bool IsFromCache() const;
+private:
+    friend class TextureCache;
+    void Clear();
+
+    int m_channels = 0;
+    bool m_fromCache = false;
+    std::vector<TextureLevel> m_levels;
+    MappedFile m_file;
+    std::vector<Image> m_images;
+};
+
+struct TextureCacheStats{
+    int hits = 0;
+    // No cache file yet, or a stale or broken one
+    int misses = 0;
+    // Misses whose new cache file could not be written
+    int writeFailures = 0;
+    double lastLoadMs = 0.0;
+    double totalLoadMs = 0.0;
+};
+
+class TextureCache{
+public:
+    TextureCache();
+    // Where the cache files go, created when the first one is written
+    void SetDirectory(const std::string& directory);
+    // Disabled, every load decodes the source and builds the chain
+    void SetEnabled(bool enabled);
+    bool IsEnabled() const;
+    // Filter of the mip levels, box unless set. Each filter has its own
+    // cache files.
+    void SetMipFilter(MipFilter filter);
+    // Loads source, flipped as LoadPPMImage() would, with all of its
+    // mip levels. False if the source cannot be loaded either.
+    bool Load(const std::string& source, bool flip, CachedTexture& texture);
+    TextureCacheStats GetStats() const;
+    // Cache file of a source, whether it exists or not
+    std::string GetCachePath(const std::string& source, bool flip) const;
+private:
+    // Maps path and checks it against the source stamp. False, with
+    // texture cleared, if the file is missing, stale or malformed.
+    bool MapCacheFile(const std::string& path, const std::string& source, bool flip,
+                      std::uint64_t sourceSize, std::int64_t sourceModifiedNs, CachedTexture& texture) const;
+    bool WriteCacheFile(const std::string& path, const std::string& source, bool flip,
+                        std::uint64_t sourceSize, std::int64_t sourceModifiedNs, const CachedTexture& texture) const;
+
+    std::string m_directory;
+    bool m_enabled;
+    MipFilter m_mipFilter;
+    TextureCacheStats m_stats;
+};
+
+#endif
@@ -0,0 +1,58 @@
+/** @file TextureSampling.hpp
+ *  @brief Where the mip levels of a texture come from and how it is
+ *  filtered.
+ *
+ *  The levels are either computed on the CPU (see MipChain.hpp) and
+ *  uploaded with the base level, made by the driver with
+ *  glGenerateMipmap, or left out. Sampling is plain linear, bilinear
+ *  from the nearest level or trilinear between two levels, optionally
+ *  anisotropic. Anisotropic filtering is core only from GL 4.6 and
+ *  comes from GL_EXT_texture_filter_anisotropic or
+ *  GL_ARB_texture_filter_anisotropic before that; without either it is
+ *  left off.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef TEXTURESAMPLING_HPP
+#define TEXTURESAMPLING_HPP
+
+#include <glad/glad.h>
+#include <string>
+
+enum class MipGeneration{
+    None,
+    Cpu,
+    Gpu
+};
+
+enum class TextureFilter{
+    // The base level only
+    Linear,
+    // Linear within the nearest level
+    Bilinear,
+    // Linear within and between the two nearest levels
+    Trilinear
+};
+
+struct TextureSampling{
+    TextureFilter filter = TextureFilter::Trilinear;
+    // Most texels taken along the axis of stretch, 1 is off. Clamped
+    // to what the driver supports.
+    float anisotropy = 1.0f;
+};
+
+// Accepts "none", "cpu" and "gpu"
+bool ParseMipGeneration(const std::string& name, MipGeneration& generation);
+const char* GetMipGenerationName(MipGeneration generation);
+// Accepts "linear", "bilinear" and "trilinear"
+bool ParseTextureFilter(const std::string& name, TextureFilter& filter);
+const char* GetTextureFilterName(TextureFilter filter);
+
+// Largest anisotropy of the current context, 1 if it has none
+float GetMaxTextureAnisotropy();
+// Sets the filtering of the texture bound to GL_TEXTURE_2D and returns
+// the anisotropy actually used. Without mip levels (GL_TEXTURE_MAX_LEVEL
+// 0) bilinear and trilinear sample like linear.
+float ApplyTextureSampling(const TextureSampling& sampling);
+
+#endif
@@ -0,0 +1,156 @@
+/** @file Tracer.hpp
+ *  @brief Timeline of named scopes written as Chrome trace-event JSON.
+ *
+ *  A TraceScope records when a block started and how long it took on
+ *  the thread that ran it. Every thread appends to a buffer of its
+ *  own, a list of fixed-size blocks that only ever grows at the end,
+ *  so recording neither locks nor reallocates and the file can be
+ *  written while workers are still running. Only a thread's first
+ *  scope takes a lock, to get a buffer. Threads that exit hand their
+ *  buffer to the next new thread, so ParallelFor workers of later
+ *  frames share the same few rows in the viewer.
+ *
+ *  Scopes can also put GL_TIMESTAMP queries around their GL commands.
+ *  The GPU clock is compared to steady_clock once when the context is
+ *  there, and the resolved GPU spans are placed on a row of their own
+ *  on the CPU time line.
+ *
+ *  Recording runs from Enable() through the chosen frame range, the
+ *  file is written once the last frame of the range is done (or by
+ *  Finish() if the program ends first) and nothing is recorded after
+ *  that. Scope names must be string literals, only the pointer is kept.
+ *
+ *  @bug No known bugs.
+ */
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <glad/glad.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Tracer{
+public:
+    static Tracer& Instance();
+    // Starts recording, startup included, and writes path after frame
+    // lastFrame. Frames count from 0.
+    void Enable(const std::string& path, int firstFrame, int lastFrame);
+    bool IsRecording() const{
+        return m_recording.load(std::memory_order_relaxed);
+    }
+    // Compares the GPU and CPU clocks. Needs the current context, GPU
+    // scopes are recorded on the CPU row only until this was called.
+    void InitializeGpu();
+    // Name of the calling thread's row
+    void SetThreadName(const std::string& name);
+    // Collects finished GPU spans, moves to the next frame and writes
+    // the file once the range is over
+    void BeginFrame();
+    // Writes the file now if it has not been written yet
+    void Finish();
+
+    std::int64_t Now() const;
+    void Record(const char* name, std::int64_t startNs, std::int64_t endNs);
+    // Returns the begin query, 0 without GPU timing
+    GLuint BeginGpuScope(const char* name);
+    void EndGpuScope(GLuint beginQuery);
+private:
+    Tracer();
+    struct Event{
+        const char* name;
+        std::int64_t startNs;
+        std::int64_t durationNs;
+        // -1 during startup
+        int frame;
+    };
+    static const int kBlockEvents = 1024;
+    struct Block{
+        Event events[kBlockEvents];
+        // Published by the owning thread after the event is written
+        std::atomic<int> count{0};
+        std::atomic<Block*> next{nullptr};
+    };
+    struct ThreadBuffer{
+        int id = 0;
+        std::string name;
+        Block* head = nullptr;
+        // Only touched by the thread currently owning the buffer
+        Block* tail = nullptr;
+    };
+    // Gives the buffer back when its thread exits
+    struct ThreadSlot{
+        ThreadBuffer* buffer = nullptr;
+        ~ThreadSlot();
+    };
+    struct GpuScope{
+        const char* name;
+        GLuint beginQuery;
+        GLuint endQuery;
+        int frame;
+        bool ended;
+    };
+
+    ThreadBuffer* GetThreadBuffer();
+    ThreadBuffer* CreateBuffer(const std::string& name);
+    void Append(ThreadBuffer* buffer, const Event& event);
+    // Turns GPU spans whose queries are done into events. wait reads
+    // every ended span, blocking until the GPU is there.
+    void ResolveGpuScopes(bool wait);
+    bool Write() const;
+
+    std::atomic<bool> m_recording;
+    std::atomic<int> m_frame;
+    bool m_written;
+    std::string m_path;
+    int m_firstFrame;
+    int m_lastFrame;
+    std::chrono::steady_clock::time_point m_epoch;
+
+    // Guards the buffer lists, not the buffers
+    mutable std::mutex m_buffersMutex;
+    std::vector<ThreadBuffer*> m_buffers;
+    std::vector<ThreadBuffer*> m_freeBuffers;
+
+    // GPU row, only the GL thread uses these
+    bool m_gpuInitialized;
+    std::int64_t m_gpuOffsetNs;
+    ThreadBuffer* m_gpuBuffer;
+    std::vector<GpuScope> m_gpuScopes;
+    std::vector<GLuint> m_freeQueries;
+
+    static thread_local ThreadSlot t_slot;
+};
+
+// Records the enclosing block on the calling thread's row, and on the
+// GPU row as well if gpu is set (GL thread only)
+class TraceScope{
+public:
+    TraceScope(const char* name, bool gpu = false)
+        : m_name(name), m_active(Tracer::Instance().IsRecording()), m_gpuQuery(0), m_startNs(0){
+        if (m_active) {
+            if (gpu) {
+                m_gpuQuery = Tracer::Instance().BeginGpuScope(name);
+            }
+            m_startNs = Tracer::Instance().Now();
+        }
+    }
+    ~TraceScope(){
+        if (m_active) {
+            Tracer::Instance().Record(m_name, m_startNs, Tracer::Instance().Now());
+            if (m_gpuQuery != 0) {
+                Tracer::Instance().EndGpuScope(m_gpuQuery);
+            }
+        }
+    }
+private:
+    const char* m_name;
+    bool m_active;
+    GLuint m_gpuQuery;
+    std::int64_t m_startNs;
+};
+
+#endif
@@ -0,0 +1,52 @@
+// ==================================================================
+#version 430 core
+// Frustum culls every instance and compacts the survivors so that
+// glDrawElementsIndirect can draw them without a CPU round trip.
+layout (local_size_x = 256) in;
+
+// Tightly packed x, y, z offsets of every instance (gInstanceVBO)
+layout (std430, binding = 0) readonly buffer InstanceOffsets {
+  float offsets[];
+};
+// Offsets of the visible instances, same packing
+layout (std430, binding = 1) writeonly buffer VisibleOffsets {
+  float visible[];
+};
+// DrawElementsIndirectCommand, instanceCount is the output counter
+layout (std430, binding = 2) buffer DrawCommand {
+  uint count;
+  uint instanceCount;
+  uint firstIndex;
+  int baseVertex;
+  uint baseInstance;
+};
+
+// Planes as (normal, distance) with normals pointing inwards
+uniform vec4 u_FrustumPlanes[6];
+// Half extent of the mesh around each offset
+uniform float u_InstancePadding;
+uniform uint u_NumberOfInstances;
+
+void main()
+{
+  uint index = gl_GlobalInvocationID.x;
+  if (index >= u_NumberOfInstances) {
+    return;
+  }
+
+  vec3 position = vec3(offsets[index * 3], offsets[index * 3 + 1], offsets[index * 3 + 2]);
+  for (int i = 0; i < 6; ++i) {
+    vec4 plane = u_FrustumPlanes[i];
+    // Projected radius of the instance box onto the plane normal
+    float radius = u_InstancePadding * (abs(plane.x) + abs(plane.y) + abs(plane.z));
+    if (dot(plane.xyz, position) + plane.w < -radius) {
+      return;
+    }
+  }
+
+  uint slot = atomicAdd(instanceCount, 1u);
+  visible[slot * 3] = position.x;
+  visible[slot * 3 + 1] = position.y;
+  visible[slot * 3 + 2] = position.z;
+}
+// ==================================================================
@@ -1,21 +1,131 @@
 // ==================================================================
 #version 410 core
+// Scaled by u_MeshPositionScale, see MeshVertexFormat in MeshRegistry.hpp
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 texCoord;
-layout (location = 2) in vec3 aOffset;
+// xyz is the instance offset in the encoding selected by u_InstanceFormat
+layout (location = 2) in vec4 aOffset;
+// Per-instance rotation and scale, see u_InstanceTransform
+layout (location = 3) in vec4 aRotation;
+layout (location = 4) in float aScale;
+layout (location = 5) in mat4 aModel;
 
 out vec2 v_texCoord;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Written once per frame, see FrameConstants in FrameConstants.hpp
+layout (std140) uniform FrameConstants
+{
+  mat4 u_Model;
+  mat4 u_View;
+  mat4 u_Projection;
+  // u_Projection * u_View * u_Model
+  mat4 u_ModelViewProjection;
+  vec4 u_CameraPosition;
+  // Width, height and the point proxy scale
+  vec4 u_Viewport;
+};
+// Multiplies the three matrices per vertex like the shader used to,
+// only there to compare frame times against the precomputed one
+uniform bool u_PerVertexMvp;
+// Packed mesh positions are stored relative to the largest mesh extent
+uniform float u_MeshPositionScale;
+
+// Matches the InstanceFormat enum in InstanceFormat.hpp
+// 0 = float, 1 = half, 2 = snorm16, 3 = grid16, 4 = procedural
+uniform int u_InstanceFormat;
+// Index of the first instance of the current draw, gl_InstanceID
+// restarts at 0 for every draw of a culled run.
+uniform int u_BaseInstance;
+// grid16: lattice coordinates are scaled by the grid spacing
+uniform float u_GridSpacing;
+// snorm16: instances per chunk and a (scale, bias) texel pair per chunk
+uniform int u_ChunkSize;
+uniform samplerBuffer u_ChunkScaleBias;
+// procedural: the lattice, see InstanceGrid in InstanceGenerator.hpp
+uniform int u_GridStart;
+uniform int u_GridCells;
+uniform int u_GridDimensions;
+// Lattice points per axis of a brick, the procedural instance order
+uniform int u_GridBrickCells;
+
+vec3 DecodeOffset()
+{
+  if (u_InstanceFormat == 2) {
+    int chunk = (gl_InstanceID + u_BaseInstance) / u_ChunkSize;
+    vec3 scale = texelFetch(u_ChunkScaleBias, chunk * 2).xyz;
+    vec3 bias = texelFetch(u_ChunkScaleBias, chunk * 2 + 1).xyz;
+    return aOffset.xyz * scale + bias;
+  } else if (u_InstanceFormat == 3) {
+    return aOffset.xyz * u_GridSpacing;
+  } else if (u_InstanceFormat == 4) {
+    // Same mapping as GetBrickInstancePosition() on the CPU, which
+    // --self-test checks: first the brick, then the lattice point
+    // inside it. Change both together.
+    int index = gl_InstanceID + u_BaseInstance;
+    ivec3 origin = ivec3(0);
+    ivec3 size = ivec3(1);
+    int step = 1;
+    for (int axis = 1; axis < u_GridDimensions; ++axis) {
+      step *= u_GridCells;
+    }
+    for (int axis = 0; axis < u_GridDimensions; ++axis) {
+      int layer = u_GridBrickCells * step;
+      int brick = index / layer;
+      index -= brick * layer;
+      origin[axis] = brick * u_GridBrickCells;
+      size[axis] = min(u_GridBrickCells, u_GridCells - origin[axis]);
+      if (axis + 1 < u_GridDimensions) {
+        step = step / u_GridCells * size[axis];
+      }
+    }
+    ivec3 lattice = ivec3(0);
+    for (int axis = u_GridDimensions - 1; axis >= 0; --axis) {
+      lattice[axis] = u_GridStart + origin[axis] + index % size[axis];
+      index /= size[axis];
+    }
+    return vec3(lattice) * u_GridSpacing;
+  }
+  // float and half are expanded by the vertex fetch already
+  return aOffset.xyz;
+}
+
+// Matches the InstanceTransformFormat enum in InstanceTransform.hpp
+// 0 = translation only, 1 = packed quaternion and scale, 2 = mat4
+uniform int u_InstanceTransform;
+
+// Places a model space position of the cube in the world
+vec3 TransformInstance(vec3 position)
+{
+  if (u_InstanceTransform == 2) {
+    return (aModel * vec4(position, 1.0f)).xyz;
+  }
+  if (u_InstanceTransform == 1) {
+    // snorm16 rounding leaves the quaternion slightly off unit length
+    vec4 q = normalize(aRotation);
+    position *= aScale;
+    position += 2.0f * cross(q.xyz, cross(q.xyz, position) + q.w * position);
+  }
+  return position + DecodeOffset();
+}
+
+// Far level of detail: each instance is a single point instead of a
+// cube. u_Viewport.z turns 1/w into the cube's size in pixels.
+uniform bool u_PointProxy;
 
 void main()
 {
 
-  mat4 MVP = projection * view * model;
+  mat4 MVP = u_PerVertexMvp ? u_Projection * u_View * u_Model : u_ModelViewProjection;
+
+  if (u_PointProxy) {
+    gl_Position = MVP * vec4(TransformInstance(vec3(0.0f)), 1.0f);
+    gl_PointSize = max(1.0f, u_Viewport.z / gl_Position.w);
+    // Middle of the texture stands in for the whole cube
+    v_texCoord = vec2(0.5f, 0.5f);
+    return;
+  }
 
-  gl_Position = MVP * (vec4(aPos + aOffset, 1.0f));
+  gl_Position = MVP * (vec4(TransformInstance(aPos * u_MeshPositionScale), 1.0f));
 
   v_texCoord = texCoord;
 }
@@ -92,6 +92,11 @@ void Camera::MoveDown(float speed){
     m_eyePosition.y -= speed;
 }
 
+void Camera::SetPose(const glm::vec3& eye, const glm::vec3& viewDirection){
+    m_eyePosition = eye;
+    m_viewDirection = glm::normalize(viewDirection);
+}
+
 float Camera::GetEyeXPosition(){
     return m_eyePosition.x;
 }
@@ -0,0 +1,96 @@
+/** @file CameraPath.cpp
+ */
+
+#include "CameraPath.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+bool CameraPath::Load(const std::string& path){
+    std::ifstream file(path.c_str());
+    if (!file.is_open()) {
+        std::cout << "Could not open camera path " << path << std::endl;
+        return false;
+    }
+    std::vector<CameraPose> poses;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        std::size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        std::istringstream values(line);
+        CameraPose pose;
+        if (!(values >> pose.eye.x >> pose.eye.y >> pose.eye.z
+                     >> pose.viewDirection.x >> pose.viewDirection.y >> pose.viewDirection.z)
+            || glm::length(pose.viewDirection) == 0.0f) {
+            std::cout << "Camera path " << path << ", line " << lineNumber
+                      << ": expected eye x y z and a non-zero view direction x y z" << std::endl;
+            return false;
+        }
+        poses.push_back(pose);
+    }
+    if (poses.empty()) {
+        std::cout << "Camera path " << path << " has no poses" << std::endl;
+        return false;
+    }
+    m_poses = poses;
+    return true;
+}
+
+bool CameraPath::Save(const std::string& path) const{
+    std::ofstream file(path.c_str());
+    if (!file.is_open()) {
+        std::cout << "Could not write " << path << std::endl;
+        return false;
+    }
+    file << "# eyeX eyeY eyeZ viewX viewY viewZ, one frame per line\n";
+    // Enough digits that a replay sees the same floats
+    file << std::setprecision(9);
+    for (const CameraPose& pose : m_poses) {
+        file << pose.eye.x << " " << pose.eye.y << " " << pose.eye.z << " "
+             << pose.viewDirection.x << " " << pose.viewDirection.y << " " << pose.viewDirection.z << "\n";
+    }
+    return true;
+}
+
+void CameraPath::Add(const CameraPose& pose){
+    m_poses.push_back(pose);
+}
+
+CameraPath CameraPath::MakeOrbit(const glm::vec3& boxMin, const glm::vec3& boxMax, int frames){
+    CameraPath path;
+    glm::vec3 center = 0.5f * (boxMin + boxMax);
+    glm::vec3 halfSize = 0.5f * (boxMax - boxMin);
+    // Inside the box, so the far side is behind plenty of instances
+    float radius = 0.6f * std::max(halfSize.x, halfSize.z);
+    const float twoPi = 6.28318530718f;
+    for (int frame = 0; frame < frames; ++frame) {
+        float angle = twoPi * frame / frames;
+        CameraPose pose;
+        pose.eye = center + glm::vec3(radius * std::cos(angle),
+                                      0.5f * halfSize.y * std::sin(2.0f * angle),
+                                      radius * std::sin(angle));
+        glm::vec3 toCenter = glm::normalize(center - pose.eye);
+        glm::vec3 along(-std::sin(angle), 0.0f, std::cos(angle));
+        // Turns from the center to along the lap and back once per lap
+        float blend = 0.5f - 0.5f * std::cos(angle);
+        pose.viewDirection = glm::normalize((1.0f - blend) * toCenter + blend * along);
+        path.Add(pose);
+    }
+    return path;
+}
+
+int CameraPath::GetPoseCount() const{
+    return (int)m_poses.size();
+}
+
+const CameraPose& CameraPath::GetPose(int frame) const{
+    return m_poses[frame % m_poses.size()];
+}
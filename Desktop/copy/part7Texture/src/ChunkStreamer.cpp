@@ -0,0 +1,260 @@
+/** @file ChunkStreamer.cpp
+ */
+
+#include "ChunkStreamer.hpp"
+#include "Parallel.hpp"
+#include "GLStateCache.hpp"
+#include "Tracer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+ChunkStreamer::ChunkStreamer()
+    : m_chunkCells(16), m_spacing(5.0f), m_radius(3), m_instancePadding(0.0f),
+      m_instancesPerChunk(0), m_poolSlots(0), m_center(0),
+      m_totalLatencyMs(0.0), m_stopping(false){
+}
+
+ChunkStreamer::~ChunkStreamer(){
+    Shutdown();
+}
+
+void ChunkStreamer::Initialize(int chunkCells, float spacing, int radius, float instancePadding){
+    Shutdown();
+    m_chunkCells = chunkCells;
+    m_spacing = spacing;
+    m_radius = radius;
+    m_instancePadding = instancePadding;
+    m_instancesPerChunk = chunkCells * chunkCells * chunkCells;
+    // Exactly the chunks of one streaming cube can be resident
+    int edge = 2 * radius + 1;
+    m_poolSlots = edge * edge * edge;
+    m_freeSlots.clear();
+    for (int slot = m_poolSlots - 1; slot >= 0; --slot) {
+        m_freeSlots.push_back(slot);
+    }
+    m_slotOfChunk.clear();
+    m_coordOfChunk.clear();
+    m_residentChunks.clear();
+    m_stats = ChunkStreamerStats();
+    m_stats.poolSlots = m_poolSlots;
+    m_totalLatencyMs = 0.0;
+
+    m_stopping = false;
+    // Leave one core to the render thread
+    unsigned int workerCount = std::max(1u, GetWorkerCount() - 1);
+    for (unsigned int i = 0; i < workerCount; ++i) {
+        m_workers.emplace_back(&ChunkStreamer::WorkerLoop, this);
+    }
+}
+
+void ChunkStreamer::Shutdown(){
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_requests.clear();
+    }
+    m_wakeWorkers.notify_all();
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+    m_workers.clear();
+    m_pending.clear();
+    m_results.clear();
+}
+
+long long ChunkStreamer::GetPoolInstances() const{
+    return (long long)m_poolSlots * m_instancesPerChunk;
+}
+
+long long ChunkStreamer::Key(const glm::ivec3& coord){
+    // 21 bits per axis is plenty for any distance the camera can fly
+    const long long mask = (1LL << 21) - 1;
+    return ((coord.x & mask) << 42) | ((coord.y & mask) << 21) | (coord.z & mask);
+}
+
+glm::ivec3 ChunkStreamer::GetChunkCoord(const glm::vec3& position) const{
+    float chunkExtent = m_chunkCells * m_spacing;
+    return glm::ivec3(glm::floor(position / chunkExtent));
+}
+
+bool ChunkStreamer::IsWanted(const glm::ivec3& coord) const{
+    glm::ivec3 distance = glm::abs(coord - m_center);
+    return distance.x <= m_radius && distance.y <= m_radius && distance.z <= m_radius;
+}
+
+void ChunkStreamer::Generate(const glm::ivec3& coord, std::vector<GLfloat>& offsets) const{
+    offsets.resize((std::size_t)m_instancesPerChunk * 3);
+    glm::ivec3 first = coord * m_chunkCells;
+    std::size_t i = 0;
+    for (int x = 0; x < m_chunkCells; ++x) {
+        for (int y = 0; y < m_chunkCells; ++y) {
+            for (int z = 0; z < m_chunkCells; ++z) {
+                offsets[i++] = (float)(first.x + x) * m_spacing;
+                offsets[i++] = (float)(first.y + y) * m_spacing;
+                offsets[i++] = (float)(first.z + z) * m_spacing;
+            }
+        }
+    }
+}
+
+void ChunkStreamer::WorkerLoop(){
+    Tracer::Instance().SetThreadName("chunk streamer");
+    while (true) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeWorkers.wait(lock, [this]{ return m_stopping || !m_requests.empty(); });
+            if (m_stopping) {
+                return;
+            }
+            request = m_requests.front();
+            m_requests.pop_front();
+        }
+
+        Result result;
+        result.coord = request.coord;
+        result.requested = request.requested;
+        {
+            TraceScope scope("GenerateChunk");
+            Generate(request.coord, result.offsets);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_results.push_back(std::move(result));
+    }
+}
+
+void ChunkStreamer::Update(const glm::vec3& eye, GLuint instanceBuffer, int maxUploads){
+    m_center = GetChunkCoord(eye);
+    bool changed = false;
+
+    // Evict everything outside the streaming cube
+    for (auto it = m_slotOfChunk.begin(); it != m_slotOfChunk.end();) {
+        if (!IsWanted(m_coordOfChunk[it->first])) {
+            m_freeSlots.push_back(it->second);
+            m_coordOfChunk.erase(it->first);
+            it = m_slotOfChunk.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+
+    std::vector<Result> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Take at most maxUploads results, the rest waits for the next frame
+        std::size_t take = std::min<std::size_t>(m_results.size(), (std::size_t)std::max(0, maxUploads));
+        finished.assign(std::make_move_iterator(m_results.begin()),
+                        std::make_move_iterator(m_results.begin() + take));
+        m_results.erase(m_results.begin(), m_results.begin() + take);
+        for (const Result& result : finished) {
+            m_pending.erase(Key(result.coord));
+        }
+        // Forget requests nobody has started on, they are rebuilt below
+        // but keep their original request time for the latency stats
+        std::unordered_map<long long, Clock::time_point> requestedAt;
+        for (const Request& request : m_requests) {
+            m_pending.erase(Key(request.coord));
+            requestedAt[Key(request.coord)] = request.requested;
+        }
+        m_requests.clear();
+        // Results still queued for later frames stay pending
+        for (const Result& result : m_results) {
+            m_pending.insert(Key(result.coord));
+        }
+
+        std::vector<Request> wanted;
+        Clock::time_point now = Clock::now();
+        for (int x = -m_radius; x <= m_radius; ++x) {
+            for (int y = -m_radius; y <= m_radius; ++y) {
+                for (int z = -m_radius; z <= m_radius; ++z) {
+                    glm::ivec3 coord = m_center + glm::ivec3(x, y, z);
+                    long long key = Key(coord);
+                    if (m_slotOfChunk.count(key) || m_pending.count(key)) {
+                        continue;
+                    }
+                    bool justFinished = false;
+                    for (const Result& result : finished) {
+                        justFinished = justFinished || Key(result.coord) == key;
+                    }
+                    if (!justFinished) {
+                        Request request;
+                        request.coord = coord;
+                        auto previous = requestedAt.find(key);
+                        request.requested = previous != requestedAt.end() ? previous->second : now;
+                        wanted.push_back(request);
+                    }
+                }
+            }
+        }
+        // Nearest chunks first
+        std::sort(wanted.begin(), wanted.end(), [this](const Request& a, const Request& b){
+            glm::vec3 da(a.coord - m_center);
+            glm::vec3 db(b.coord - m_center);
+            return glm::dot(da, da) < glm::dot(db, db);
+        });
+        for (const Request& request : wanted) {
+            m_requests.push_back(request);
+            m_pending.insert(Key(request.coord));
+        }
+        m_stats.pendingChunks = (int)m_pending.size();
+    }
+    m_wakeWorkers.notify_all();
+
+    m_stats.uploadsLastUpdate = 0;
+    GLStateCache::Instance().BindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    const GLsizeiptr slotBytes = (GLsizeiptr)m_instancesPerChunk * 3 * sizeof(GLfloat);
+    for (const Result& result : finished) {
+        long long key = Key(result.coord);
+        if (!IsWanted(result.coord) || m_slotOfChunk.count(key) || m_freeSlots.empty()) {
+            continue;
+        }
+        int slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        glBufferSubData(GL_ARRAY_BUFFER, slot * slotBytes, slotBytes, result.offsets.data());
+        m_slotOfChunk[key] = slot;
+        m_coordOfChunk[key] = result.coord;
+        changed = true;
+
+        double latencyMs = std::chrono::duration<double, std::milli>(Clock::now() - result.requested).count();
+        ++m_stats.chunksGenerated;
+        ++m_stats.uploadsLastUpdate;
+        m_stats.lastLatencyMs = latencyMs;
+        m_stats.maxLatencyMs = std::max(m_stats.maxLatencyMs, latencyMs);
+        m_totalLatencyMs += latencyMs;
+        m_stats.averageLatencyMs = m_totalLatencyMs / m_stats.chunksGenerated;
+    }
+
+    if (changed) {
+        RebuildResidentChunks();
+    }
+    m_stats.residentChunks = (int)m_slotOfChunk.size();
+}
+
+void ChunkStreamer::RebuildResidentChunks(){
+    m_residentChunks.clear();
+    const float chunkExtent = m_chunkCells * m_spacing;
+    for (const auto& entry : m_slotOfChunk) {
+        glm::vec3 origin = glm::vec3(m_coordOfChunk[entry.first]) * chunkExtent;
+        InstanceChunk chunk;
+        chunk.firstInstance = entry.second * m_instancesPerChunk;
+        chunk.instanceCount = m_instancesPerChunk;
+        chunk.boundsMin = origin - glm::vec3(m_instancePadding);
+        chunk.boundsMax = origin + glm::vec3((m_chunkCells - 1) * m_spacing + m_instancePadding);
+        m_residentChunks.push_back(chunk);
+    }
+    // Adjacent slots can then be merged into one draw
+    std::sort(m_residentChunks.begin(), m_residentChunks.end(), [](const InstanceChunk& a, const InstanceChunk& b){
+        return a.firstInstance < b.firstInstance;
+    });
+}
+
+const std::vector<InstanceChunk>& ChunkStreamer::GetResidentChunks() const{
+    return m_residentChunks;
+}
+
+ChunkStreamerStats ChunkStreamer::GetStats() const{
+    return m_stats;
+}
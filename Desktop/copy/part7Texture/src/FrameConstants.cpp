@@ -0,0 +1,43 @@
+/** @file FrameConstants.cpp
+ */
+
+#include "FrameConstants.hpp"
+#include "GLStateCache.hpp"
+
+#include <cstring>
+
+FrameConstantsBuffer::FrameConstantsBuffer(){
+}
+
+FrameConstantsBuffer::~FrameConstantsBuffer(){
+    // GL objects are released in Destroy() while the context is alive
+}
+
+bool FrameConstantsBuffer::Initialize(){
+    return m_ring.Initialize(GL_UNIFORM_BUFFER, sizeof(FrameConstants));
+}
+
+void FrameConstantsBuffer::Destroy(){
+    m_ring.Destroy();
+}
+
+void FrameConstantsBuffer::BindProgram(GLuint program){
+    GLuint blockIndex = glGetUniformBlockIndex(program, "FrameConstants");
+    if (blockIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, blockIndex, gFrameConstantsBinding);
+    }
+}
+
+void FrameConstantsBuffer::Update(const FrameConstants& constants){
+    void* data = m_ring.BeginWrite();
+    if (data != nullptr) {
+        std::memcpy(data, &constants, sizeof(constants));
+    }
+    m_ring.EndWrite();
+    GLStateCache::Instance().BindBufferRange(GL_UNIFORM_BUFFER, gFrameConstantsBinding, m_ring.GetBuffer(),
+                                             m_ring.GetWriteOffset(), sizeof(FrameConstants));
+}
+
+void FrameConstantsBuffer::FinishFrame(){
+    m_ring.FinishFrame();
+}
@@ -0,0 +1,196 @@
+/** @file FrameProfiler.cpp
+ */
+
+#include "FrameProfiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+const char* GetProfileStageName(ProfileStage stage){
+    switch (stage) {
+        case ProfileStage::Frame: return "frame";
+        case ProfileStage::Input: return "input";
+        case ProfileStage::UpdateInstances: return "update instances";
+        case ProfileStage::PreDraw: return "predraw";
+        case ProfileStage::Draw: return "draw";
+        case ProfileStage::Swap: return "swap";
+        case ProfileStage::Count: break;
+    }
+    return "unknown";
+}
+
+void FrameProfiler::Samples::Add(double value){
+    if ((int)ms.size() < gProfileWindow) {
+        ms.push_back(value);
+        return;
+    }
+    ms[next] = value;
+    next = (next + 1) % gProfileWindow;
+}
+
+// Nearest-rank percentile of sorted values
+static double Percentile(const std::vector<double>& sorted, double fraction){
+    std::size_t rank = (std::size_t)std::ceil(fraction * sorted.size());
+    return sorted[std::min(std::max<std::size_t>(rank, 1), sorted.size()) - 1];
+}
+
+ProfileSummary SummarizeTimes(std::vector<double> ms){
+    ProfileSummary summary;
+    summary.samples = (int)ms.size();
+    if (ms.empty()) {
+        return summary;
+    }
+    std::sort(ms.begin(), ms.end());
+    double total = 0.0;
+    for (double value : ms) {
+        total += value;
+    }
+    summary.minMs = ms.front();
+    summary.meanMs = total / ms.size();
+    summary.p50Ms = Percentile(ms, 0.50);
+    summary.p95Ms = Percentile(ms, 0.95);
+    summary.p99Ms = Percentile(ms, 0.99);
+    summary.maxMs = ms.back();
+    return summary;
+}
+
+ProfileSummary FrameProfiler::Samples::Summarize() const{
+    return SummarizeTimes(ms);
+}
+
+FrameProfiler& FrameProfiler::Instance(){
+    static FrameProfiler* instance = new FrameProfiler();
+    return *instance;
+}
+
+FrameProfiler::FrameProfiler()
+    : m_enabled(false), m_querySet(0), m_droppedGpuSamples(0), m_framesProfiled(0){
+    for (int set = 0; set < kQuerySets; ++set) {
+        for (int stage = 0; stage < (int)ProfileStage::Count; ++stage) {
+            m_queries[set][stage] = 0;
+            m_queryPending[set][stage] = false;
+        }
+    }
+}
+
+void FrameProfiler::Enable(){
+    if (m_queries[0][0] == 0) {
+        glGenQueries(kQuerySets * (int)ProfileStage::Count, &m_queries[0][0]);
+    }
+    m_enabled = true;
+    m_framesProfiled = 0;
+}
+
+void FrameProfiler::BeginFrame(){
+    if (!m_enabled) {
+        return;
+    }
+    // The set was last used two frames ago, its results are normally
+    // there without waiting
+    m_querySet = (m_querySet + 1) % kQuerySets;
+    // The results are those of kQuerySets frames back. The first
+    // profiled frame pays for driver setup, and llvmpipe returns a
+    // timestamp instead of a duration for the very first query of a
+    // context, so its GPU times are left out.
+    bool warmup = m_framesProfiled++ - kQuerySets == 0;
+    for (int stage = 0; stage < (int)ProfileStage::Count; ++stage) {
+        if (!m_queryPending[m_querySet][stage]) {
+            continue;
+        }
+        m_queryPending[m_querySet][stage] = false;
+        GLuint query = m_queries[m_querySet][stage];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            m_droppedGpuSamples++;
+            continue;
+        }
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsedNs);
+        if (!warmup) {
+            m_gpu[stage].Add(elapsedNs / 1.0e6);
+        }
+    }
+}
+
+void FrameProfiler::BeginStage(ProfileStage stage, bool gpu){
+    if (gpu) {
+        glBeginQuery(GL_TIME_ELAPSED, m_queries[m_querySet][(int)stage]);
+    }
+    m_stageStart[(int)stage] = std::chrono::steady_clock::now();
+}
+
+void FrameProfiler::EndStage(ProfileStage stage, bool gpu){
+    auto end = std::chrono::steady_clock::now();
+    m_cpu[(int)stage].Add(std::chrono::duration<double, std::milli>(end - m_stageStart[(int)stage]).count());
+    if (gpu) {
+        glEndQuery(GL_TIME_ELAPSED);
+        m_queryPending[m_querySet][(int)stage] = true;
+    }
+}
+
+ProfileSummary FrameProfiler::GetCpuSummary(ProfileStage stage) const{
+    return m_cpu[(int)stage].Summarize();
+}
+
+ProfileSummary FrameProfiler::GetGpuSummary(ProfileStage stage) const{
+    return m_gpu[(int)stage].Summarize();
+}
+
+int FrameProfiler::GetDroppedGpuSamples() const{
+    return m_droppedGpuSamples;
+}
+
+bool FrameProfiler::WriteCSV(const std::string& path) const{
+    std::ofstream file(path.c_str());
+    if (!file.is_open()) {
+        std::cout << "Could not write " << path << std::endl;
+        return false;
+    }
+    file << "stage,clock,samples,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+    for (int stage = 0; stage < (int)ProfileStage::Count; ++stage) {
+        for (int gpu = 0; gpu < 2; ++gpu) {
+            ProfileSummary summary = gpu ? m_gpu[stage].Summarize() : m_cpu[stage].Summarize();
+            if (summary.samples == 0) {
+                continue;
+            }
+            file << GetProfileStageName((ProfileStage)stage) << "," << (gpu ? "gpu" : "cpu") << ","
+                 << summary.samples << "," << summary.meanMs << "," << summary.p50Ms << ","
+                 << summary.p95Ms << "," << summary.p99Ms << "," << summary.maxMs << "\n";
+        }
+    }
+    return true;
+}
+
+void FrameProfiler::Print() const{
+    for (int stage = 0; stage < (int)ProfileStage::Count; ++stage) {
+        for (int gpu = 0; gpu < 2; ++gpu) {
+            ProfileSummary summary = gpu ? m_gpu[stage].Summarize() : m_cpu[stage].Summarize();
+            if (summary.samples == 0) {
+                continue;
+            }
+            std::cout << "Profile " << GetProfileStageName((ProfileStage)stage) << " (" << (gpu ? "gpu" : "cpu")
+                      << "): p50 " << summary.p50Ms << " ms, p95 " << summary.p95Ms << " ms, p99 "
+                      << summary.p99Ms << " ms, max " << summary.maxMs << " ms over " << summary.samples
+                      << " frames" << std::endl;
+        }
+    }
+    if (m_droppedGpuSamples > 0) {
+        std::cout << "Profile: " << m_droppedGpuSamples << " GPU samples were not ready and dropped" << std::endl;
+    }
+}
+
+void FrameProfiler::Destroy(){
+    if (m_queries[0][0] != 0) {
+        glDeleteQueries(kQuerySets * (int)ProfileStage::Count, &m_queries[0][0]);
+    }
+    for (int set = 0; set < kQuerySets; ++set) {
+        for (int stage = 0; stage < (int)ProfileStage::Count; ++stage) {
+            m_queries[set][stage] = 0;
+            m_queryPending[set][stage] = false;
+        }
+    }
+    m_enabled = false;
+}
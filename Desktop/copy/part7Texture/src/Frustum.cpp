@@ -0,0 +1,50 @@
+/** @file Frustum.cpp
+ */
+
+#include "Frustum.hpp"
+
+Frustum::Frustum(){
+    // Planes that every point is in front of
+    for (int i = 0; i < 6; ++i) {
+        m_planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+}
+
+Frustum::Frustum(const glm::mat4& viewProjection){
+    // glm is column major, so row r of the matrix is m[0][r], m[1][r]...
+    glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+    glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+    glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+    glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+    m_planes[0] = row3 + row0; // left
+    m_planes[1] = row3 - row0; // right
+    m_planes[2] = row3 + row1; // bottom
+    m_planes[3] = row3 - row1; // top
+    m_planes[4] = row3 + row2; // near
+    m_planes[5] = row3 - row2; // far
+
+    for (int i = 0; i < 6; ++i) {
+        float length = glm::length(glm::vec3(m_planes[i]));
+        m_planes[i] /= length;
+    }
+}
+
+bool Frustum::IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const{
+    for (int i = 0; i < 6; ++i) {
+        const glm::vec4& plane = m_planes[i];
+        // Test the corner furthest along the plane normal, if even
+        // that one is behind the plane the whole box is outside.
+        glm::vec3 corner(plane.x >= 0.0f ? boxMax.x : boxMin.x,
+                         plane.y >= 0.0f ? boxMax.y : boxMin.y,
+                         plane.z >= 0.0f ? boxMax.z : boxMin.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const glm::vec4& Frustum::GetPlane(int i) const{
+    return m_planes[i];
+}
@@ -0,0 +1,165 @@
+/** @file GLStateCache.cpp
+ */
+
+#include "GLStateCache.hpp"
+
+GLStateCache& GLStateCache::Instance(){
+    static GLStateCache* instance = new GLStateCache();
+    return *instance;
+}
+
+GLStateCache::GLStateCache(){
+    Invalidate();
+}
+
+void GLStateCache::Invalidate(){
+    m_capabilities.clear();
+    m_buffers.clear();
+    m_textures.clear();
+    m_depthFunction = -1;
+    m_cullFace = -1;
+    m_frontFace = -1;
+    m_program = -1;
+    m_vertexArray = -1;
+    m_activeTexture = -1;
+    m_viewportValid = false;
+    m_clearColorValid = false;
+}
+
+bool GLStateCache::Changed(bool changed){
+    if (changed) {
+        m_frameStats.issued++;
+    } else {
+        m_frameStats.filtered++;
+    }
+    return changed;
+}
+
+void GLStateCache::Enable(GLenum capability){
+    auto found = m_capabilities.find(capability);
+    if (Changed(found == m_capabilities.end() || !found->second)) {
+        glEnable(capability);
+        m_capabilities[capability] = true;
+    }
+}
+
+void GLStateCache::Disable(GLenum capability){
+    auto found = m_capabilities.find(capability);
+    if (Changed(found == m_capabilities.end() || found->second)) {
+        glDisable(capability);
+        m_capabilities[capability] = false;
+    }
+}
+
+void GLStateCache::DepthFunc(GLenum function){
+    if (Changed(m_depthFunction != (GLint)function)) {
+        glDepthFunc(function);
+        m_depthFunction = (GLint)function;
+    }
+}
+
+void GLStateCache::CullFace(GLenum mode){
+    if (Changed(m_cullFace != (GLint)mode)) {
+        glCullFace(mode);
+        m_cullFace = (GLint)mode;
+    }
+}
+
+void GLStateCache::FrontFace(GLenum mode){
+    if (Changed(m_frontFace != (GLint)mode)) {
+        glFrontFace(mode);
+        m_frontFace = (GLint)mode;
+    }
+}
+
+void GLStateCache::Viewport(GLint x, GLint y, GLsizei width, GLsizei height){
+    bool same = m_viewportValid && m_viewport[0] == x && m_viewport[1] == y &&
+                m_viewport[2] == width && m_viewport[3] == height;
+    if (Changed(!same)) {
+        glViewport(x, y, width, height);
+        m_viewport[0] = x;
+        m_viewport[1] = y;
+        m_viewport[2] = width;
+        m_viewport[3] = height;
+        m_viewportValid = true;
+    }
+}
+
+void GLStateCache::ClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha){
+    bool same = m_clearColorValid && m_clearColor[0] == red && m_clearColor[1] == green &&
+                m_clearColor[2] == blue && m_clearColor[3] == alpha;
+    if (Changed(!same)) {
+        glClearColor(red, green, blue, alpha);
+        m_clearColor[0] = red;
+        m_clearColor[1] = green;
+        m_clearColor[2] = blue;
+        m_clearColor[3] = alpha;
+        m_clearColorValid = true;
+    }
+}
+
+void GLStateCache::UseProgram(GLuint program){
+    if (Changed(m_program != (GLint)program)) {
+        glUseProgram(program);
+        m_program = (GLint)program;
+    }
+}
+
+void GLStateCache::BindVertexArray(GLuint vertexArray){
+    if (Changed(m_vertexArray != (GLint)vertexArray)) {
+        glBindVertexArray(vertexArray);
+        m_vertexArray = (GLint)vertexArray;
+        m_buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+    }
+}
+
+void GLStateCache::BindBuffer(GLenum target, GLuint buffer){
+    auto found = m_buffers.find(target);
+    if (Changed(found == m_buffers.end() || found->second != buffer)) {
+        glBindBuffer(target, buffer);
+        m_buffers[target] = buffer;
+    }
+}
+
+void GLStateCache::BindBufferBase(GLenum target, GLuint index, GLuint buffer){
+    Changed(true);
+    glBindBufferBase(target, index, buffer);
+    m_buffers[target] = buffer;
+}
+
+void GLStateCache::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size){
+    Changed(true);
+    glBindBufferRange(target, index, buffer, offset, size);
+    m_buffers[target] = buffer;
+}
+
+void GLStateCache::ActiveTexture(GLenum unit){
+    if (Changed(m_activeTexture != (GLint)unit)) {
+        glActiveTexture(unit);
+        m_activeTexture = (GLint)unit;
+    }
+}
+
+void GLStateCache::BindTexture(GLenum target, GLuint texture){
+    // Without a known active unit the binding cannot be attributed
+    if (m_activeTexture < 0) {
+        Changed(true);
+        glBindTexture(target, texture);
+        return;
+    }
+    GLuint key = (GLuint)(m_activeTexture - GL_TEXTURE0) * 0x10000u + (target & 0xFFFFu);
+    auto found = m_textures.find(key);
+    if (Changed(found == m_textures.end() || found->second != texture)) {
+        glBindTexture(target, texture);
+        m_textures[key] = texture;
+    }
+}
+
+void GLStateCache::BeginFrame(){
+    m_lastFrameStats = m_frameStats;
+    m_frameStats = GLStateStats();
+}
+
+GLStateStats GLStateCache::GetLastFrameStats() const{
+    return m_lastFrameStats;
+}
@@ -0,0 +1,117 @@
+/** @file GpuCuller.cpp
+ */
+
+#include "GpuCuller.hpp"
+#include "GLStateCache.hpp"
+
+// Must match local_size_x in shaders/cull.glsl
+static const GLuint kWorkGroupSize = 256;
+
+GpuCuller::GpuCuller()
+    : m_program(0), m_instanceBuffer(0), m_visibleBuffer(0), m_commandBuffer(0),
+      m_numberOfInstances(0), m_indexCount(0),
+      m_planesLocation(-1), m_paddingLocation(-1), m_countLocation(-1){
+}
+
+GpuCuller::~GpuCuller(){
+    // GL objects are released in Destroy() while the context is alive
+}
+
+bool GpuCuller::IsSupported(){
+    return GLAD_GL_VERSION_4_3 && glDispatchCompute != nullptr && glDrawElementsIndirect != nullptr;
+}
+
+bool GpuCuller::Initialize(GLuint program, GLuint instanceBuffer, GLsizei numberOfInstances, GLsizei indexCount){
+    if (!IsSupported() || program == 0 || instanceBuffer == 0) {
+        return false;
+    }
+    // One work group per kWorkGroupSize instances along x only
+    GLint maxGroups = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxGroups);
+    if ((GLuint)(numberOfInstances + kWorkGroupSize - 1) / kWorkGroupSize > (GLuint)maxGroups) {
+        return false;
+    }
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked == GL_FALSE) {
+        return false;
+    }
+
+    m_program = program;
+    m_instanceBuffer = instanceBuffer;
+    m_numberOfInstances = numberOfInstances;
+    m_indexCount = indexCount;
+    m_planesLocation = glGetUniformLocation(m_program, "u_FrustumPlanes");
+    m_paddingLocation = glGetUniformLocation(m_program, "u_InstancePadding");
+    m_countLocation = glGetUniformLocation(m_program, "u_NumberOfInstances");
+
+    // Worst case every instance is visible
+    glGenBuffers(1, &m_visibleBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visibleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)numberOfInstances * 3 * sizeof(GLfloat), nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &m_commandBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return true;
+}
+
+void GpuCuller::Destroy(){
+    glDeleteBuffers(1, &m_visibleBuffer);
+    glDeleteBuffers(1, &m_commandBuffer);
+    m_visibleBuffer = 0;
+    m_commandBuffer = 0;
+    m_program = 0;
+}
+
+bool GpuCuller::IsInitialized() const{
+    return m_program != 0;
+}
+
+void GpuCuller::Cull(const Frustum& frustum, float instancePadding){
+    // Start from an empty draw, the shader counts the instances up
+    DrawElementsIndirectCommand command = {(GLuint)m_indexCount, 0, 0, 0, 0};
+    GLStateCache& state = GLStateCache::Instance();
+    state.BindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), &command);
+
+    state.UseProgram(m_program);
+    GLfloat planes[6 * 4];
+    for (int i = 0; i < 6; ++i) {
+        const glm::vec4& plane = frustum.GetPlane(i);
+        planes[i * 4 + 0] = plane.x;
+        planes[i * 4 + 1] = plane.y;
+        planes[i * 4 + 2] = plane.z;
+        planes[i * 4 + 3] = plane.w;
+    }
+    glUniform4fv(m_planesLocation, 6, planes);
+    glUniform1f(m_paddingLocation, instancePadding);
+    glUniform1ui(m_countLocation, (GLuint)m_numberOfInstances);
+
+    state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_instanceBuffer);
+    state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_visibleBuffer);
+    state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_commandBuffer);
+    glDispatchCompute((m_numberOfInstances + kWorkGroupSize - 1) / kWorkGroupSize, 1, 1);
+    // The draw reads the count as a command and the offsets as vertex data
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void GpuCuller::Draw(GLenum indexType) const{
+    GLStateCache::Instance().BindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    glDrawElementsIndirect(GL_TRIANGLES, indexType, nullptr);
+}
+
+GLuint GpuCuller::GetVisibleBuffer() const{
+    return m_visibleBuffer;
+}
+
+GLuint GpuCuller::ReadVisibleCount() const{
+    DrawElementsIndirectCommand command = {0, 0, 0, 0, 0};
+    // The atomic count of the last Cull() is only ordered before buffer
+    // reads with this barrier, which only the readback pays for
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    GLStateCache::Instance().BindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), &command);
+    return command.instanceCount;
+}
@@ -0,0 +1,251 @@
+/** @file HeadlessContext.cpp
+ */
+
+#include "HeadlessContext.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#if defined(LINUX)
+    // Keep eglplatform.h from including the X11 headers
+    #define EGL_NO_X11
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+    #include <dlfcn.h>
+#endif
+
+#if defined(LINUX)
+// Entry points of libEGL, resolved with dlsym
+static PFNEGLGETPROCADDRESSPROC sGetProcAddress = nullptr;
+static PFNEGLGETDISPLAYPROC sGetDisplay = nullptr;
+static PFNEGLINITIALIZEPROC sInitialize = nullptr;
+static PFNEGLTERMINATEPROC sTerminate = nullptr;
+static PFNEGLQUERYSTRINGPROC sQueryString = nullptr;
+static PFNEGLBINDAPIPROC sBindAPI = nullptr;
+static PFNEGLCHOOSECONFIGPROC sChooseConfig = nullptr;
+static PFNEGLCREATECONTEXTPROC sCreateContext = nullptr;
+static PFNEGLDESTROYCONTEXTPROC sDestroyContext = nullptr;
+static PFNEGLCREATEPBUFFERSURFACEPROC sCreatePbufferSurface = nullptr;
+static PFNEGLDESTROYSURFACEPROC sDestroySurface = nullptr;
+static PFNEGLMAKECURRENTPROC sMakeCurrent = nullptr;
+
+// glad wants a plain function taking the name
+static void* GetProcAddress(const char* name){
+    return (void*)sGetProcAddress(name);
+}
+
+static bool HasExtension(const char* extensions, const char* name){
+    if (extensions == nullptr) {
+        return false;
+    }
+    std::size_t length = std::strlen(name);
+    for (const char* found = std::strstr(extensions, name); found != nullptr; found = std::strstr(found + 1, name)) {
+        bool starts = found == extensions || found[-1] == ' ';
+        bool ends = found[length] == ' ' || found[length] == '\0';
+        if (starts && ends) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Surfaceless Mesa first, it needs neither a display server nor a
+// GPU, then the first EGL device, then whatever the default is
+static EGLDisplay OpenDisplay(){
+    const char* clientExtensions = sQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)sGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay != nullptr && HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display != EGL_NO_DISPLAY) {
+            return display;
+        }
+    }
+    auto queryDevices = (PFNEGLQUERYDEVICESEXTPROC)sGetProcAddress("eglQueryDevicesEXT");
+    if (getPlatformDisplay != nullptr && queryDevices != nullptr && HasExtension(clientExtensions, "EGL_EXT_platform_device")) {
+        EGLDeviceEXT device;
+        EGLint deviceCount = 0;
+        if (queryDevices(1, &device, &deviceCount) && deviceCount > 0) {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+            if (display != EGL_NO_DISPLAY) {
+                return display;
+            }
+        }
+    }
+    return sGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+#endif
+
+HeadlessContext::HeadlessContext()
+    : m_width(0), m_height(0), m_framebuffer(0), m_colorBuffer(0), m_depthBuffer(0),
+      m_library(nullptr), m_display(nullptr), m_surface(nullptr), m_context(nullptr){
+}
+
+HeadlessContext::~HeadlessContext(){
+    // Released in Destroy() while the context is current
+}
+
+bool HeadlessContext::Create(int width, int height){
+#if defined(LINUX)
+    m_library = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (m_library == nullptr) {
+        std::cout << "Headless mode needs libEGL.so.1: " << dlerror() << std::endl;
+        return false;
+    }
+    sGetProcAddress = (PFNEGLGETPROCADDRESSPROC)dlsym(m_library, "eglGetProcAddress");
+    sGetDisplay = (PFNEGLGETDISPLAYPROC)dlsym(m_library, "eglGetDisplay");
+    sInitialize = (PFNEGLINITIALIZEPROC)dlsym(m_library, "eglInitialize");
+    sTerminate = (PFNEGLTERMINATEPROC)dlsym(m_library, "eglTerminate");
+    sQueryString = (PFNEGLQUERYSTRINGPROC)dlsym(m_library, "eglQueryString");
+    sBindAPI = (PFNEGLBINDAPIPROC)dlsym(m_library, "eglBindAPI");
+    sChooseConfig = (PFNEGLCHOOSECONFIGPROC)dlsym(m_library, "eglChooseConfig");
+    sCreateContext = (PFNEGLCREATECONTEXTPROC)dlsym(m_library, "eglCreateContext");
+    sDestroyContext = (PFNEGLDESTROYCONTEXTPROC)dlsym(m_library, "eglDestroyContext");
+    sCreatePbufferSurface = (PFNEGLCREATEPBUFFERSURFACEPROC)dlsym(m_library, "eglCreatePbufferSurface");
+    sDestroySurface = (PFNEGLDESTROYSURFACEPROC)dlsym(m_library, "eglDestroySurface");
+    sMakeCurrent = (PFNEGLMAKECURRENTPROC)dlsym(m_library, "eglMakeCurrent");
+    if (sGetProcAddress == nullptr || sGetDisplay == nullptr || sInitialize == nullptr || sTerminate == nullptr ||
+        sQueryString == nullptr || sBindAPI == nullptr || sChooseConfig == nullptr || sCreateContext == nullptr ||
+        sDestroyContext == nullptr || sCreatePbufferSurface == nullptr || sDestroySurface == nullptr ||
+        sMakeCurrent == nullptr) {
+        std::cout << "libEGL.so.1 is missing EGL 1.4 functions" << std::endl;
+        return false;
+    }
+
+    EGLDisplay display = OpenDisplay();
+    EGLint major = 0;
+    EGLint minor = 0;
+    if (display == EGL_NO_DISPLAY || !sInitialize(display, &major, &minor)) {
+        std::cout << "No EGL display could be initialized" << std::endl;
+        return false;
+    }
+    m_display = display;
+    std::cout << "EGL " << major << "." << minor << ", " << sQueryString(display, EGL_VENDOR) << std::endl;
+    if (!sBindAPI(EGL_OPENGL_API)) {
+        std::cout << "EGL display does not support desktop OpenGL" << std::endl;
+        return false;
+    }
+    const EGLint configAttributes[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_NONE
+    };
+    EGLConfig config = nullptr;
+    EGLint configCount = 0;
+    if (!sChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+        std::cout << "No EGL config for desktop OpenGL" << std::endl;
+        return false;
+    }
+    // Same versions the windowed path asks SDL for
+    const int contextVersions[][2] = {{4, 5}, {4, 3}, {4, 1}};
+    EGLContext context = EGL_NO_CONTEXT;
+    for (const auto& version : contextVersions) {
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, version[0],
+            EGL_CONTEXT_MINOR_VERSION, version[1],
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = sCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context != EGL_NO_CONTEXT) {
+            break;
+        }
+    }
+    if (context == EGL_NO_CONTEXT) {
+        std::cout << "OpenGL context not available." << std::endl;
+        return false;
+    }
+    m_context = context;
+    // Without EGL_KHR_surfaceless_context a context needs some surface
+    // to be current, a 1x1 pbuffer that is never drawn to does
+    EGLSurface surface = EGL_NO_SURFACE;
+    if (!HasExtension(sQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        const EGLint surfaceAttributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        surface = sCreatePbufferSurface(display, config, surfaceAttributes);
+        m_surface = surface;
+    }
+    if (!sMakeCurrent(display, surface, surface, context)) {
+        std::cout << "EGL context could not be made current" << std::endl;
+        return false;
+    }
+    if (!gladLoadGLLoader(GetProcAddress)) {
+        std::cout << "glad was not initialized" << std::endl;
+        return false;
+    }
+
+    m_width = width;
+    m_height = height;
+    glGenRenderbuffers(1, &m_colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Offscreen framebuffer of " << width << "x" << height << " is not complete" << std::endl;
+        return false;
+    }
+    // The framebuffer stays bound, every draw lands in it
+    return true;
+#else
+    (void)width;
+    (void)height;
+    std::cout << "Headless mode needs EGL and is only available on Linux" << std::endl;
+    return false;
+#endif
+}
+
+void HeadlessContext::Destroy(){
+#if defined(LINUX)
+    if (m_context != nullptr) {
+        glDeleteFramebuffers(1, &m_framebuffer);
+        glDeleteRenderbuffers(1, &m_colorBuffer);
+        glDeleteRenderbuffers(1, &m_depthBuffer);
+        sMakeCurrent((EGLDisplay)m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        sDestroyContext((EGLDisplay)m_display, (EGLContext)m_context);
+    }
+    if (m_surface != nullptr) {
+        sDestroySurface((EGLDisplay)m_display, (EGLSurface)m_surface);
+    }
+    if (m_display != nullptr) {
+        sTerminate((EGLDisplay)m_display);
+    }
+    if (m_library != nullptr) {
+        dlclose(m_library);
+    }
+#endif
+    m_framebuffer = 0;
+    m_colorBuffer = 0;
+    m_depthBuffer = 0;
+    m_library = nullptr;
+    m_display = nullptr;
+    m_surface = nullptr;
+    m_context = nullptr;
+}
+
+bool HeadlessContext::IsCreated() const{
+    return m_framebuffer != 0;
+}
+
+bool HeadlessContext::WritePPM(const std::string& path) const{
+    std::vector<unsigned char> pixels((std::size_t)m_width * m_height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Could not write " << path << std::endl;
+        return false;
+    }
+    file << "P6\n" << m_width << " " << m_height << "\n255\n";
+    // GL rows start at the bottom
+    for (int y = m_height - 1; y >= 0; --y) {
+        file.write((const char*)&pixels[(std::size_t)y * m_width * 3], (std::streamsize)m_width * 3);
+    }
+    return true;
+}
@@ -0,0 +1,252 @@
+/** @file InstanceChunks.cpp
+ */
+
+#include "InstanceChunks.hpp"
+#include "Parallel.hpp"
+#include "RadixSort.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include "glm/glm.hpp"
+
+std::vector<InstanceChunk> SortInstancesIntoChunks(InstanceBuffer& instances,
+                                                   float chunkExtent,
+                                                   float instancePadding){
+    std::vector<InstanceChunk> chunks;
+    const long long count = instances.numberOfInstances;
+    if (count == 0) {
+        return chunks;
+    }
+    const GLfloat* offsets = instances.offsets.data();
+
+    // Find the range of cells that is actually used
+    glm::vec3 minimum(offsets[0], offsets[1], offsets[2]);
+    glm::vec3 maximum = minimum;
+    for (long long i = 1; i < count; ++i) {
+        glm::vec3 p(offsets[i * 3], offsets[i * 3 + 1], offsets[i * 3 + 2]);
+        minimum = glm::min(minimum, p);
+        maximum = glm::max(maximum, p);
+    }
+    // The cell counts come in doubles first, a tiny extent over a large
+    // lattice would overflow an int. More cells than instances would
+    // only mean empty cells, so the extent grows until they fit.
+    glm::dvec3 size = glm::dvec3(maximum - minimum);
+    double extent = chunkExtent;
+    glm::dvec3 cellsPerAxis = glm::floor(size / extent) + 1.0;
+    while (cellsPerAxis.x * cellsPerAxis.y * cellsPerAxis.z > (double)count) {
+        extent *= 1.25;
+        cellsPerAxis = glm::floor(size / extent) + 1.0;
+    }
+    const float cellExtent = (float)extent;
+    const glm::ivec3 cells = glm::ivec3(cellsPerAxis);
+    const std::size_t cellCount = (std::size_t)cells.x * cells.y * cells.z;
+
+    // Counting sort on the cell key keeps the original order inside a cell
+    std::vector<std::uint64_t> keys(count);
+    ParallelFor(count, [&](std::size_t begin, std::size_t end){
+        for (std::size_t i = begin; i < end; ++i) {
+            glm::vec3 p(offsets[i * 3], offsets[i * 3 + 1], offsets[i * 3 + 2]);
+            glm::ivec3 cell = glm::min(glm::ivec3((p - minimum) / cellExtent), cells - 1);
+            keys[i] = ((std::uint64_t)cell.x * cells.y + cell.y) * cells.z + cell.z;
+        }
+    });
+    std::vector<long long> cellStart(cellCount + 1, 0);
+    for (long long i = 0; i < count; ++i) {
+        ++cellStart[keys[i] + 1];
+    }
+    for (std::size_t cell = 0; cell < cellCount; ++cell) {
+        cellStart[cell + 1] += cellStart[cell];
+    }
+
+    std::vector<GLfloat> sorted(instances.offsets.size());
+    std::vector<long long> cursor(cellStart.begin(), cellStart.end() - 1);
+    for (long long i = 0; i < count; ++i) {
+        long long target = cursor[keys[i]]++;
+        sorted[target * 3 + 0] = offsets[i * 3 + 0];
+        sorted[target * 3 + 1] = offsets[i * 3 + 1];
+        sorted[target * 3 + 2] = offsets[i * 3 + 2];
+    }
+    instances.offsets.swap(sorted);
+    offsets = instances.offsets.data();
+
+    for (std::size_t cell = 0; cell < cellCount; ++cell) {
+        long long first = cellStart[cell];
+        long long last = cellStart[cell + 1];
+        if (first == last) {
+            continue;
+        }
+        InstanceChunk chunk;
+        chunk.firstInstance = (GLint)first;
+        chunk.instanceCount = (GLsizei)(last - first);
+        chunk.boundsMin = glm::vec3(offsets[first * 3], offsets[first * 3 + 1], offsets[first * 3 + 2]);
+        chunk.boundsMax = chunk.boundsMin;
+        for (long long i = first + 1; i < last; ++i) {
+            glm::vec3 p(offsets[i * 3], offsets[i * 3 + 1], offsets[i * 3 + 2]);
+            chunk.boundsMin = glm::min(chunk.boundsMin, p);
+            chunk.boundsMax = glm::max(chunk.boundsMax, p);
+        }
+        chunk.boundsMin -= glm::vec3(instancePadding);
+        chunk.boundsMax += glm::vec3(instancePadding);
+        chunks.push_back(chunk);
+    }
+    return chunks;
+}
+
+std::vector<InstanceChunk> BuildGridChunks(const InstanceGrid& grid,
+                                           int brickCells,
+                                           float instancePadding){
+    const int cells = grid.GetCellsPerAxis();
+    std::vector<InstanceChunk> chunks;
+    if (cells == 0) {
+        return chunks;
+    }
+    glm::ivec3 bricks(1);
+    for (int axis = 0; axis < grid.dimensions; ++axis) {
+        bricks[axis] = (cells + brickCells - 1) / brickCells;
+    }
+    chunks.reserve((std::size_t)bricks.x * bricks.y * bricks.z);
+
+    // The bricks follow each other in the instance order, so every
+    // chunk starts where the one before it ends
+    long long first = 0;
+    glm::ivec3 brick;
+    for (brick.x = 0; brick.x < bricks.x; ++brick.x) {
+        for (brick.y = 0; brick.y < bricks.y; ++brick.y) {
+            for (brick.z = 0; brick.z < bricks.z; ++brick.z) {
+                InstanceChunk chunk;
+                long long count = 1;
+                // Unused axes stay at 0
+                chunk.boundsMin = glm::vec3(0.0f);
+                chunk.boundsMax = glm::vec3(0.0f);
+                for (int axis = 0; axis < grid.dimensions; ++axis) {
+                    int origin = brick[axis] * brickCells;
+                    int size = std::min(brickCells, cells - origin);
+                    count *= size;
+                    chunk.boundsMin[axis] = (float)(grid.start + origin) * grid.spacing;
+                    chunk.boundsMax[axis] = (float)(grid.start + origin + size - 1) * grid.spacing;
+                }
+                chunk.firstInstance = (GLint)first;
+                chunk.instanceCount = (GLsizei)count;
+                chunk.boundsMin -= glm::vec3(instancePadding);
+                chunk.boundsMax += glm::vec3(instancePadding);
+                chunks.push_back(chunk);
+                first += count;
+            }
+        }
+    }
+    return chunks;
+}
+
+void AssignChunkMeshes(std::vector<InstanceChunk>& chunks, int meshCount){
+    for (InstanceChunk& chunk : chunks) {
+        glm::ivec3 cell = glm::ivec3(glm::floor((chunk.boundsMin + chunk.boundsMax) * 0.5f));
+        unsigned int hash = (unsigned int)cell.x * 73856093u ^ (unsigned int)cell.y * 19349663u ^ (unsigned int)cell.z * 83492791u;
+        chunk.mesh = meshCount > 1 ? (int)(hash % (unsigned int)meshCount) : 0;
+    }
+}
+
+// Appends a chunk to runs, growing the last run if the chunk follows it
+// directly in the instance buffer and, if byMesh, has the same mesh.
+static void AppendToRuns(const InstanceChunk& chunk, std::vector<InstanceRun>& runs, bool byMesh){
+    if (!runs.empty() && (!byMesh || runs.back().mesh == chunk.mesh) &&
+        runs.back().firstInstance + runs.back().instanceCount == chunk.firstInstance) {
+        runs.back().instanceCount += chunk.instanceCount;
+    } else {
+        InstanceRun run;
+        run.firstInstance = chunk.firstInstance;
+        run.instanceCount = chunk.instanceCount;
+        run.mesh = chunk.mesh;
+        runs.push_back(run);
+    }
+}
+
+// CullChunksLod, with the near chunks collected as indices into chunks
+// instead of runs if nearChunks is given
+static CullStats ClassifyChunks(const std::vector<InstanceChunk>& chunks,
+                                const Frustum& frustum,
+                                const glm::vec3& eye,
+                                float lodDistance,
+                                std::vector<InstanceRun>& nearRuns,
+                                std::vector<InstanceRun>& farRuns,
+                                std::vector<std::uint32_t>* nearChunks){
+    CullStats stats;
+    nearRuns.clear();
+    farRuns.clear();
+    stats.chunksTotal = (int)chunks.size();
+    const float lodDistanceSquared = lodDistance * lodDistance;
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+        const InstanceChunk& chunk = chunks[c];
+        stats.instancesTotal += chunk.instanceCount;
+        if (!frustum.IntersectsBox(chunk.boundsMin, chunk.boundsMax)) {
+            ++stats.chunksCulled;
+            stats.instancesCulled += chunk.instanceCount;
+            continue;
+        }
+        // Distance from the eye to the closest point of the bounds
+        glm::vec3 closest = glm::clamp(eye, chunk.boundsMin, chunk.boundsMax);
+        glm::vec3 toChunk = closest - eye;
+        if (glm::dot(toChunk, toChunk) > lodDistanceSquared) {
+            stats.instancesFar += chunk.instanceCount;
+            // Points look the same for every mesh
+            AppendToRuns(chunk, farRuns, false);
+        } else if (nearChunks != nullptr) {
+            nearChunks->push_back((std::uint32_t)c);
+        } else {
+            AppendToRuns(chunk, nearRuns, true);
+        }
+    }
+    stats.runs = (int)(nearRuns.size() + farRuns.size());
+    return stats;
+}
+
+CullStats CullChunksLod(const std::vector<InstanceChunk>& chunks,
+                        const Frustum& frustum,
+                        const glm::vec3& eye,
+                        float lodDistance,
+                        std::vector<InstanceRun>& nearRuns,
+                        std::vector<InstanceRun>& farRuns){
+    return ClassifyChunks(chunks, frustum, eye, lodDistance, nearRuns, farRuns, nullptr);
+}
+
+CullStats CullChunksLodFrontToBack(const std::vector<InstanceChunk>& chunks,
+                                   const Frustum& frustum,
+                                   const glm::vec3& eye,
+                                   const glm::vec3& viewDirection,
+                                   float lodDistance,
+                                   std::vector<InstanceRun>& nearRuns,
+                                   std::vector<InstanceRun>& farRuns,
+                                   DepthOrderStats& orderStats){
+    std::vector<std::uint32_t> nearChunks;
+    CullStats stats = ClassifyChunks(chunks, frustum, eye, lodDistance, nearRuns, farRuns, &nearChunks);
+
+    auto startTime = std::chrono::steady_clock::now();
+    // View depth of the closest point of every near chunk
+    glm::vec3 direction = glm::normalize(viewDirection);
+    std::vector<float> depths(nearChunks.size());
+    float maxDepth = 0.0f;
+    for (std::size_t i = 0; i < nearChunks.size(); ++i) {
+        const InstanceChunk& chunk = chunks[nearChunks[i]];
+        glm::vec3 center = 0.5f * (chunk.boundsMin + chunk.boundsMax);
+        glm::vec3 halfExtent = 0.5f * (chunk.boundsMax - chunk.boundsMin);
+        float depth = glm::dot(center - eye, direction) - glm::dot(halfExtent, glm::abs(direction));
+        depths[i] = std::max(depth, 0.0f);
+        maxDepth = std::max(maxDepth, depths[i]);
+    }
+    std::vector<std::uint32_t> keys(nearChunks.size());
+    float scale = maxDepth > 0.0f ? ((1 << gDepthKeyBits) - 1) / maxDepth : 0.0f;
+    for (std::size_t i = 0; i < nearChunks.size(); ++i) {
+        keys[i] = (std::uint32_t)(depths[i] * scale);
+    }
+    RadixSortByKey(keys, nearChunks, gDepthKeyBits);
+    // Only chunks that stay neighbours after sorting merge
+    for (std::uint32_t c : nearChunks) {
+        AppendToRuns(chunks[c], nearRuns, true);
+    }
+    auto endTime = std::chrono::steady_clock::now();
+
+    orderStats.chunks = (int)nearChunks.size();
+    orderStats.sortMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    stats.runs = (int)(nearRuns.size() + farRuns.size());
+    return stats;
+}
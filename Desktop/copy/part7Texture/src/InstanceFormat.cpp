@@ -0,0 +1,139 @@
+/** @file InstanceFormat.cpp
+ */
+
+#include "InstanceFormat.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "glm/glm.hpp"
+#include "glm/gtc/packing.hpp"
+
+bool ParseInstanceFormat(const std::string& name, InstanceFormat& format){
+    if (name == "float") {
+        format = InstanceFormat::Float32;
+    } else if (name == "half") {
+        format = InstanceFormat::Half16;
+    } else if (name == "snorm16") {
+        format = InstanceFormat::Snorm16;
+    } else if (name == "grid16") {
+        format = InstanceFormat::Grid16;
+    } else if (name == "procedural") {
+        format = InstanceFormat::Procedural;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* GetInstanceFormatName(InstanceFormat format){
+    switch (format) {
+        case InstanceFormat::Float32: return "float";
+        case InstanceFormat::Half16: return "half";
+        case InstanceFormat::Snorm16: return "snorm16";
+        case InstanceFormat::Grid16: return "grid16";
+        case InstanceFormat::Procedural: return "procedural";
+    }
+    return "unknown";
+}
+
+GLsizei GetInstanceFormatStride(InstanceFormat format){
+    switch (format) {
+        case InstanceFormat::Float32: return 3 * sizeof(GLfloat);
+        case InstanceFormat::Procedural: return 0;
+        default: return 4 * sizeof(GLshort);
+    }
+}
+
+// Computes the scale/bias pair of every Snorm16 chunk so that the
+// chunk's offsets map onto [-1, 1].
+static std::vector<glm::vec4> ComputeChunkScaleBias(const InstanceBuffer& instances){
+    const long long count = instances.numberOfInstances;
+    const long long chunks = (count + gInstanceFormatChunkSize - 1) / gInstanceFormatChunkSize;
+    std::vector<glm::vec4> scaleBias(chunks * 2);
+    const GLfloat* offsets = instances.offsets.data();
+
+    ParallelFor(chunks, [&](std::size_t begin, std::size_t end){
+        for (std::size_t chunk = begin; chunk < end; ++chunk) {
+            long long first = chunk * gInstanceFormatChunkSize;
+            long long last = std::min<long long>(first + gInstanceFormatChunkSize, count);
+            glm::vec3 minimum(offsets[first * 3], offsets[first * 3 + 1], offsets[first * 3 + 2]);
+            glm::vec3 maximum = minimum;
+            for (long long i = first + 1; i < last; ++i) {
+                glm::vec3 p(offsets[i * 3], offsets[i * 3 + 1], offsets[i * 3 + 2]);
+                minimum = glm::min(minimum, p);
+                maximum = glm::max(maximum, p);
+            }
+            glm::vec3 scale = (maximum - minimum) * 0.5f;
+            // A flat chunk would otherwise divide by zero
+            scale = glm::max(scale, glm::vec3(1e-6f));
+            scaleBias[chunk * 2 + 0] = glm::vec4(scale, 0.0f);
+            scaleBias[chunk * 2 + 1] = glm::vec4((maximum + minimum) * 0.5f, 0.0f);
+        }
+    }, 16);
+    return scaleBias;
+}
+
+EncodedInstances EncodeInstances(const InstanceBuffer& instances,
+                                 const InstanceGrid& grid,
+                                 InstanceFormat format){
+    EncodedInstances result;
+    result.format = format;
+    result.attribute.stride = GetInstanceFormatStride(format);
+    const long long count = instances.numberOfInstances;
+    const GLfloat* offsets = instances.offsets.data();
+
+    if (format == InstanceFormat::Procedural) {
+        return result;
+    }
+    if (format == InstanceFormat::Float32) {
+        result.data.resize(count * result.attribute.stride);
+        std::memcpy(result.data.data(), offsets, result.data.size());
+        return result;
+    }
+
+    result.attribute.components = 4;
+    result.data.resize(count * result.attribute.stride);
+    std::uint64_t* packed = reinterpret_cast<std::uint64_t*>(result.data.data());
+
+    if (format == InstanceFormat::Half16) {
+        result.attribute.type = GL_HALF_FLOAT;
+        ParallelFor(count, [&](std::size_t begin, std::size_t end){
+            for (std::size_t i = begin; i < end; ++i) {
+                glm::vec4 p(offsets[i * 3], offsets[i * 3 + 1], offsets[i * 3 + 2], 0.0f);
+                packed[i] = glm::packHalf4x16(p);
+            }
+        });
+    } else if (format == InstanceFormat::Snorm16) {
+        result.attribute.type = GL_SHORT;
+        result.attribute.normalized = GL_TRUE;
+        result.chunkScaleBias = ComputeChunkScaleBias(instances);
+        const glm::vec4* scaleBias = result.chunkScaleBias.data();
+        ParallelFor(count, [&](std::size_t begin, std::size_t end){
+            for (std::size_t i = begin; i < end; ++i) {
+                std::size_t chunk = i / gInstanceFormatChunkSize;
+                glm::vec3 scale(scaleBias[chunk * 2]);
+                glm::vec3 bias(scaleBias[chunk * 2 + 1]);
+                glm::vec3 p(offsets[i * 3], offsets[i * 3 + 1], offsets[i * 3 + 2]);
+                packed[i] = glm::packSnorm4x16(glm::vec4((p - bias) / scale, 0.0f));
+            }
+        });
+    } else if (format == InstanceFormat::Grid16) {
+        // Non-normalized shorts arrive in the shader as whole numbers,
+        // vert.glsl multiplies them by u_GridSpacing.
+        result.attribute.type = GL_SHORT;
+        const float inverseSpacing = 1.0f / grid.spacing;
+        ParallelFor(count, [&](std::size_t begin, std::size_t end){
+            GLshort* lattice = reinterpret_cast<GLshort*>(packed);
+            for (std::size_t i = begin; i < end; ++i) {
+                lattice[i * 4 + 0] = (GLshort)std::lround(offsets[i * 3] * inverseSpacing);
+                lattice[i * 4 + 1] = (GLshort)std::lround(offsets[i * 3 + 1] * inverseSpacing);
+                lattice[i * 4 + 2] = (GLshort)std::lround(offsets[i * 3 + 2] * inverseSpacing);
+                lattice[i * 4 + 3] = 0;
+            }
+        });
+    }
+    return result;
+}
@@ -0,0 +1,99 @@
+/** @file InstanceGenerator.cpp
+ */
+
+#include "InstanceGenerator.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+int InstanceGrid::GetCellsPerAxis() const{
+    return end > start ? end - start : 0;
+}
+
+long long InstanceGrid::GetNumberOfInstances() const{
+    long long count = 1;
+    for (int axis = 0; axis < dimensions; ++axis) {
+        count *= GetCellsPerAxis();
+    }
+    return count;
+}
+
+glm::vec3 GetInstancePosition(const InstanceGrid& grid, long long index){
+    const long long cells = grid.GetCellsPerAxis();
+    // Peel lattice coordinates off the flat index, fastest axis first
+    int lattice[3] = {0, 0, 0};
+    for (int axis = grid.dimensions - 1; axis >= 0; --axis) {
+        lattice[axis] = grid.start + (int)(index % cells);
+        index /= cells;
+    }
+    // A 2D grid lies in x/y and a 1D grid along x, so the used axes
+    // are always the leading ones.
+    return glm::vec3((float)lattice[0] * grid.spacing,
+                     (float)lattice[1] * grid.spacing,
+                     (float)lattice[2] * grid.spacing);
+}
+
+glm::vec3 GetBrickInstancePosition(const InstanceGrid& grid, int brickCells, long long index){
+    const long long cells = grid.GetCellsPerAxis();
+    int origin[3] = {0, 0, 0};
+    int size[3] = {1, 1, 1};
+    // Instances per lattice step along the axis, within the bricks
+    // picked on the axes before it
+    long long step = 1;
+    for (int axis = 1; axis < grid.dimensions; ++axis) {
+        step *= cells;
+    }
+    for (int axis = 0; axis < grid.dimensions; ++axis) {
+        long long layer = brickCells * step;
+        long long brick = index / layer;
+        index -= brick * layer;
+        origin[axis] = (int)brick * brickCells;
+        size[axis] = std::min(brickCells, (int)cells - origin[axis]);
+        if (axis + 1 < grid.dimensions) {
+            step = step / cells * size[axis];
+        }
+    }
+    int lattice[3] = {0, 0, 0};
+    for (int axis = grid.dimensions - 1; axis >= 0; --axis) {
+        lattice[axis] = grid.start + origin[axis] + (int)(index % size[axis]);
+        index /= size[axis];
+    }
+    return glm::vec3((float)lattice[0] * grid.spacing,
+                     (float)lattice[1] * grid.spacing,
+                     (float)lattice[2] * grid.spacing);
+}
+
+float GetInstanceRandom(long long index, unsigned int seed){
+    std::uint32_t h = (std::uint32_t)index * 0x9E3779B1u ^ seed * 0x85EBCA77u;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
+}
+
+InstanceBuffer GenerateInstances(const InstanceGrid& grid){
+    auto startTime = std::chrono::steady_clock::now();
+
+    InstanceBuffer result;
+    result.numberOfInstances = grid.GetNumberOfInstances();
+    // Size the output exactly once, every thread then writes its own slice
+    result.offsets.resize(result.numberOfInstances * 3);
+
+    GLfloat* offsets = result.offsets.data();
+    ParallelFor(result.numberOfInstances, [&grid, offsets](std::size_t begin, std::size_t end){
+        for (std::size_t i = begin; i < end; ++i) {
+            glm::vec3 position = GetInstancePosition(grid, (long long)i);
+            offsets[i * 3 + 0] = position.x;
+            offsets[i * 3 + 1] = position.y;
+            offsets[i * 3 + 2] = position.z;
+        }
+    });
+
+    auto endTime = std::chrono::steady_clock::now();
+    result.generationTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    return result;
+}
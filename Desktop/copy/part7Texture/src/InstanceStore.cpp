@@ -0,0 +1,343 @@
+/** @file InstanceStore.cpp
+ */
+
+#include "InstanceStore.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+    #define INSTANCESTORE_X86 1
+    #include <immintrin.h>
+#endif
+
+// Animation parameters, as fractions of the lattice spacing where
+// they are distances
+static const float kWaveAmplitude = 0.3f;
+static const float kWaveSpeed = 2.0f;
+static const float kOrbitRadius = 0.25f;
+static const float kOrbitSpeed = 1.5f;
+static const float kDriftSpeed = 0.2f;
+
+// Constants of the parabola sine approximation, good to about 0.001
+static const float kPi = 3.14159265f;
+static const float kTwoPi = 6.28318531f;
+static const float kInvTwoPi = 0.159154943f;
+static const float kHalfPi = 1.57079633f;
+static const float kSinB = 4.0f / kPi;
+static const float kSinC = -4.0f / (kPi * kPi);
+static const float kSinP = 0.225f;
+
+bool ParseInstanceAnimation(const std::string& name, InstanceAnimation& animation){
+    for (int i = 0; i <= (int)InstanceAnimation::Drift; ++i) {
+        if (name == GetInstanceAnimationName((InstanceAnimation)i)) {
+            animation = (InstanceAnimation)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetInstanceAnimationName(InstanceAnimation animation){
+    switch (animation) {
+        case InstanceAnimation::None: return "none";
+        case InstanceAnimation::Wave: return "wave";
+        case InstanceAnimation::Orbit: return "orbit";
+        case InstanceAnimation::Drift: return "drift";
+    }
+    return "unknown";
+}
+
+namespace{
+
+// Everything a kernel needs for one Update()
+struct KernelInput{
+    const float* restX;
+    const float* restY;
+    const float* restZ;
+    const float* velocityX;
+    const float* velocityY;
+    const float* velocityZ;
+    const float* phase;
+    InstanceAnimation animation;
+    float time;
+    float waveAmplitude;
+    float orbitRadius;
+    float driftLength;
+    GLfloat* destination;
+};
+
+typedef void (*AnimateKernel)(const KernelInput& input, std::size_t begin, std::size_t end);
+
+float FastSin(float x){
+    // Wrap to [-pi, pi], then a parabola with one correction step
+    x -= kTwoPi * std::nearbyint(x * kInvTwoPi);
+    float y = x * (kSinB + kSinC * std::fabs(x));
+    return kSinP * (y * std::fabs(y) - y) + y;
+}
+
+// Wraps a displacement into [-length / 2, length / 2]
+float Wrap(float displacement, float length){
+    return displacement - length * std::nearbyint(displacement / length);
+}
+
+void AnimateScalar(const KernelInput& in, std::size_t begin, std::size_t end){
+    GLfloat* out = in.destination;
+    for (std::size_t i = begin; i < end; ++i) {
+        float dx = 0.0f;
+        float dy = 0.0f;
+        float dz = 0.0f;
+        switch (in.animation) {
+            case InstanceAnimation::None:
+                break;
+            case InstanceAnimation::Wave:
+                dy = in.waveAmplitude * FastSin(in.time * kWaveSpeed + in.phase[i]);
+                break;
+            case InstanceAnimation::Orbit: {
+                float angle = in.time * kOrbitSpeed + in.phase[i];
+                dx = in.orbitRadius * FastSin(angle + kHalfPi);
+                dz = in.orbitRadius * FastSin(angle);
+                break;
+            }
+            case InstanceAnimation::Drift:
+                dx = Wrap(in.velocityX[i] * in.time, in.driftLength);
+                dy = Wrap(in.velocityY[i] * in.time, in.driftLength);
+                dz = Wrap(in.velocityZ[i] * in.time, in.driftLength);
+                break;
+        }
+        out[i * 3 + 0] = in.restX[i] + dx;
+        out[i * 3 + 1] = in.restY[i] + dy;
+        out[i * 3 + 2] = in.restZ[i] + dz;
+    }
+}
+
+#ifdef INSTANCESTORE_X86
+
+__m128 FastSinSse2(__m128 x){
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(kInvTwoPi))));
+    x = _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(kTwoPi)));
+    __m128 y = _mm_mul_ps(x, _mm_add_ps(_mm_set1_ps(kSinB), _mm_mul_ps(_mm_set1_ps(kSinC), _mm_andnot_ps(signMask, x))));
+    __m128 correction = _mm_sub_ps(_mm_mul_ps(y, _mm_andnot_ps(signMask, y)), y);
+    return _mm_add_ps(_mm_mul_ps(_mm_set1_ps(kSinP), correction), y);
+}
+
+__m128 WrapSse2(__m128 displacement, __m128 length, __m128 inverseLength){
+    __m128 cells = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(displacement, inverseLength)));
+    return _mm_sub_ps(displacement, _mm_mul_ps(cells, length));
+}
+
+void AnimateSse2(const KernelInput& in, std::size_t begin, std::size_t end){
+    const __m128 time = _mm_set1_ps(in.time);
+    const __m128 waveAmplitude = _mm_set1_ps(in.waveAmplitude);
+    const __m128 orbitRadius = _mm_set1_ps(in.orbitRadius);
+    const __m128 driftLength = _mm_set1_ps(in.driftLength);
+    const __m128 inverseDriftLength = _mm_set1_ps(1.0f / in.driftLength);
+    alignas(16) float x[4], y[4], z[4];
+    std::size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 dx = _mm_setzero_ps();
+        __m128 dy = _mm_setzero_ps();
+        __m128 dz = _mm_setzero_ps();
+        switch (in.animation) {
+            case InstanceAnimation::None:
+                break;
+            case InstanceAnimation::Wave: {
+                __m128 angle = _mm_add_ps(_mm_mul_ps(time, _mm_set1_ps(kWaveSpeed)), _mm_loadu_ps(in.phase + i));
+                dy = _mm_mul_ps(waveAmplitude, FastSinSse2(angle));
+                break;
+            }
+            case InstanceAnimation::Orbit: {
+                __m128 angle = _mm_add_ps(_mm_mul_ps(time, _mm_set1_ps(kOrbitSpeed)), _mm_loadu_ps(in.phase + i));
+                dx = _mm_mul_ps(orbitRadius, FastSinSse2(_mm_add_ps(angle, _mm_set1_ps(kHalfPi))));
+                dz = _mm_mul_ps(orbitRadius, FastSinSse2(angle));
+                break;
+            }
+            case InstanceAnimation::Drift:
+                dx = WrapSse2(_mm_mul_ps(_mm_loadu_ps(in.velocityX + i), time), driftLength, inverseDriftLength);
+                dy = WrapSse2(_mm_mul_ps(_mm_loadu_ps(in.velocityY + i), time), driftLength, inverseDriftLength);
+                dz = WrapSse2(_mm_mul_ps(_mm_loadu_ps(in.velocityZ + i), time), driftLength, inverseDriftLength);
+                break;
+        }
+        _mm_store_ps(x, _mm_add_ps(_mm_loadu_ps(in.restX + i), dx));
+        _mm_store_ps(y, _mm_add_ps(_mm_loadu_ps(in.restY + i), dy));
+        _mm_store_ps(z, _mm_add_ps(_mm_loadu_ps(in.restZ + i), dz));
+        // The buffer wants x, y, z interleaved
+        GLfloat* out = in.destination + i * 3;
+        for (int k = 0; k < 4; ++k) {
+            out[k * 3 + 0] = x[k];
+            out[k * 3 + 1] = y[k];
+            out[k * 3 + 2] = z[k];
+        }
+    }
+    AnimateScalar(in, i, end);
+}
+
+__attribute__((target("avx2,fma")))
+__m256 FastSinAvx2(__m256 x){
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 turns = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(kInvTwoPi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    x = _mm256_fnmadd_ps(turns, _mm256_set1_ps(kTwoPi), x);
+    __m256 y = _mm256_mul_ps(x, _mm256_fmadd_ps(_mm256_set1_ps(kSinC), _mm256_andnot_ps(signMask, x), _mm256_set1_ps(kSinB)));
+    __m256 correction = _mm256_fmsub_ps(y, _mm256_andnot_ps(signMask, y), y);
+    return _mm256_fmadd_ps(_mm256_set1_ps(kSinP), correction, y);
+}
+
+__attribute__((target("avx2,fma")))
+__m256 WrapAvx2(__m256 displacement, __m256 length, __m256 inverseLength){
+    __m256 cells = _mm256_round_ps(_mm256_mul_ps(displacement, inverseLength), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    return _mm256_fnmadd_ps(cells, length, displacement);
+}
+
+__attribute__((target("avx2,fma")))
+void AnimateAvx2(const KernelInput& in, std::size_t begin, std::size_t end){
+    const __m256 time = _mm256_set1_ps(in.time);
+    const __m256 waveAmplitude = _mm256_set1_ps(in.waveAmplitude);
+    const __m256 orbitRadius = _mm256_set1_ps(in.orbitRadius);
+    const __m256 driftLength = _mm256_set1_ps(in.driftLength);
+    const __m256 inverseDriftLength = _mm256_set1_ps(1.0f / in.driftLength);
+    alignas(32) float x[8], y[8], z[8];
+    std::size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 dx = _mm256_setzero_ps();
+        __m256 dy = _mm256_setzero_ps();
+        __m256 dz = _mm256_setzero_ps();
+        switch (in.animation) {
+            case InstanceAnimation::None:
+                break;
+            case InstanceAnimation::Wave: {
+                __m256 angle = _mm256_fmadd_ps(time, _mm256_set1_ps(kWaveSpeed), _mm256_loadu_ps(in.phase + i));
+                dy = _mm256_mul_ps(waveAmplitude, FastSinAvx2(angle));
+                break;
+            }
+            case InstanceAnimation::Orbit: {
+                __m256 angle = _mm256_fmadd_ps(time, _mm256_set1_ps(kOrbitSpeed), _mm256_loadu_ps(in.phase + i));
+                dx = _mm256_mul_ps(orbitRadius, FastSinAvx2(_mm256_add_ps(angle, _mm256_set1_ps(kHalfPi))));
+                dz = _mm256_mul_ps(orbitRadius, FastSinAvx2(angle));
+                break;
+            }
+            case InstanceAnimation::Drift:
+                dx = WrapAvx2(_mm256_mul_ps(_mm256_loadu_ps(in.velocityX + i), time), driftLength, inverseDriftLength);
+                dy = WrapAvx2(_mm256_mul_ps(_mm256_loadu_ps(in.velocityY + i), time), driftLength, inverseDriftLength);
+                dz = WrapAvx2(_mm256_mul_ps(_mm256_loadu_ps(in.velocityZ + i), time), driftLength, inverseDriftLength);
+                break;
+        }
+        _mm256_store_ps(x, _mm256_add_ps(_mm256_loadu_ps(in.restX + i), dx));
+        _mm256_store_ps(y, _mm256_add_ps(_mm256_loadu_ps(in.restY + i), dy));
+        _mm256_store_ps(z, _mm256_add_ps(_mm256_loadu_ps(in.restZ + i), dz));
+        GLfloat* out = in.destination + i * 3;
+        for (int k = 0; k < 8; ++k) {
+            out[k * 3 + 0] = x[k];
+            out[k * 3 + 1] = y[k];
+            out[k * 3 + 2] = z[k];
+        }
+    }
+    AnimateScalar(in, i, end);
+}
+
+#endif
+
+// Picks the widest kernel the CPU running us supports
+AnimateKernel SelectKernel(const char** name){
+#ifdef INSTANCESTORE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        *name = "avx2";
+        return AnimateAvx2;
+    }
+    *name = "sse2";
+    return AnimateSse2;
+#else
+    *name = "scalar";
+    return AnimateScalar;
+#endif
+}
+
+const char* gKernelName = nullptr;
+const AnimateKernel gKernel = SelectKernel(&gKernelName);
+
+}
+
+InstanceStore::InstanceStore()
+    : m_spacing(1.0f){
+}
+
+void InstanceStore::Initialize(const InstanceBuffer& instances, float spacing){
+    std::size_t count = (std::size_t)instances.numberOfInstances;
+    m_spacing = spacing;
+    m_stats = InstanceStoreStats();
+    m_restX.resize(count);
+    m_restY.resize(count);
+    m_restZ.resize(count);
+    m_velocityX.resize(count);
+    m_velocityY.resize(count);
+    m_velocityZ.resize(count);
+    m_phase.resize(count);
+
+    const GLfloat* offsets = instances.offsets.data();
+    ParallelFor(count, [this, offsets, spacing](std::size_t begin, std::size_t end){
+        const float speed = kDriftSpeed * spacing;
+        for (std::size_t i = begin; i < end; ++i) {
+            m_restX[i] = offsets[i * 3 + 0];
+            m_restY[i] = offsets[i * 3 + 1];
+            m_restZ[i] = offsets[i * 3 + 2];
+            m_velocityX[i] = (GetInstanceRandom((long long)i, 1) * 2.0f - 1.0f) * speed;
+            m_velocityY[i] = (GetInstanceRandom((long long)i, 2) * 2.0f - 1.0f) * speed;
+            m_velocityZ[i] = (GetInstanceRandom((long long)i, 3) * 2.0f - 1.0f) * speed;
+            // Mostly follows the position so the wave travels across
+            // the lattice, with a little noise on top
+            m_phase[i] = (m_restX[i] + m_restZ[i]) * (0.6f / spacing) + GetInstanceRandom((long long)i, 4);
+        }
+    });
+}
+
+bool InstanceStore::IsInitialized() const{
+    return !m_restX.empty();
+}
+
+long long InstanceStore::GetNumberOfInstances() const{
+    return (long long)m_restX.size();
+}
+
+float InstanceStore::GetMaxDisplacement(float spacing){
+    // Drift wraps at half a cell, which is the furthest any of them go
+    return std::max(std::max(kWaveAmplitude, kOrbitRadius), 0.5f) * spacing;
+}
+
+void InstanceStore::Update(InstanceAnimation animation, float time, GLfloat* destination){
+    auto startTime = std::chrono::steady_clock::now();
+
+    KernelInput input;
+    input.restX = m_restX.data();
+    input.restY = m_restY.data();
+    input.restZ = m_restZ.data();
+    input.velocityX = m_velocityX.data();
+    input.velocityY = m_velocityY.data();
+    input.velocityZ = m_velocityZ.data();
+    input.phase = m_phase.data();
+    input.animation = animation;
+    input.time = time;
+    input.waveAmplitude = kWaveAmplitude * m_spacing;
+    input.orbitRadius = kOrbitRadius * m_spacing;
+    input.driftLength = m_spacing;
+    input.destination = destination;
+    ParallelFor(m_restX.size(), [&input](std::size_t begin, std::size_t end){
+        gKernel(input, begin, end);
+    }, 16384);
+
+    auto endTime = std::chrono::steady_clock::now();
+    m_stats.lastUpdateMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    m_stats.maxUpdateMs = std::max(m_stats.maxUpdateMs, m_stats.lastUpdateMs);
+    m_stats.averageUpdateMs += (m_stats.lastUpdateMs - m_stats.averageUpdateMs) / (double)(m_stats.updates + 1);
+    m_stats.updates++;
+}
+
+const char* InstanceStore::GetKernelName() const{
+    return gKernelName;
+}
+
+InstanceStoreStats InstanceStore::GetStats() const{
+    return m_stats;
+}
@@ -0,0 +1,78 @@
+/** @file InstanceTransform.cpp
+ */
+
+#include "InstanceTransform.hpp"
+#include "InstanceGenerator.hpp"
+#include "Parallel.hpp"
+
+#include <cmath>
+#include <cstring>
+#include "glm/gtc/packing.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+bool ParseInstanceTransformFormat(const std::string& name, InstanceTransformFormat& format){
+    for (int i = 0; i <= (int)InstanceTransformFormat::Matrix; ++i) {
+        if (name == GetInstanceTransformFormatName((InstanceTransformFormat)i)) {
+            format = (InstanceTransformFormat)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetInstanceTransformFormatName(InstanceTransformFormat format){
+    switch (format) {
+        case InstanceTransformFormat::None: return "none";
+        case InstanceTransformFormat::Packed: return "packed";
+        case InstanceTransformFormat::Matrix: return "matrix";
+    }
+    return "unknown";
+}
+
+glm::quat GetInstanceRotation(long long index){
+    // Uniformly distributed rotation (Shoemake) from three random numbers
+    float u1 = GetInstanceRandom(index, 11);
+    float u2 = GetInstanceRandom(index, 12) * 6.28318531f;
+    float u3 = GetInstanceRandom(index, 13) * 6.28318531f;
+    float a = std::sqrt(1.0f - u1);
+    float b = std::sqrt(u1);
+    return glm::quat(b * std::cos(u3), a * std::sin(u2), a * std::cos(u2), b * std::sin(u3));
+}
+
+float GetInstanceScale(long long index){
+    return gInstanceMinScale + GetInstanceRandom(index, 14) * (gInstanceMaxScale - gInstanceMinScale);
+}
+
+InstanceTransforms BuildInstanceTransforms(InstanceTransformFormat format, long long numberOfInstances, const GLfloat* offsets){
+    InstanceTransforms result;
+    result.format = format;
+    if (format == InstanceTransformFormat::Packed) {
+        result.stride = sizeof(PackedInstanceTransform);
+    } else if (format == InstanceTransformFormat::Matrix) {
+        result.stride = sizeof(glm::mat4);
+    } else {
+        return result;
+    }
+    result.data.resize((std::size_t)numberOfInstances * result.stride);
+
+    unsigned char* data = result.data.data();
+    ParallelFor((std::size_t)numberOfInstances, [format, offsets, data](std::size_t begin, std::size_t end){
+        for (std::size_t i = begin; i < end; ++i) {
+            glm::quat rotation = GetInstanceRotation((long long)i);
+            float scale = GetInstanceScale((long long)i);
+            if (format == InstanceTransformFormat::Packed) {
+                PackedInstanceTransform packed;
+                // Components in x, y, z, w order to match aRotation
+                glm::uint64 bits = glm::packSnorm4x16(glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w));
+                std::memcpy(packed.rotation, &bits, sizeof(packed.rotation));
+                packed.scale = scale;
+                std::memcpy(data + i * sizeof(PackedInstanceTransform), &packed, sizeof(packed));
+            } else {
+                glm::mat4 model = glm::mat4_cast(rotation) * scale;
+                model[3] = glm::vec4(offsets[i * 3 + 0], offsets[i * 3 + 1], offsets[i * 3 + 2], 1.0f);
+                std::memcpy(data + i * sizeof(glm::mat4), glm::value_ptr(model), sizeof(glm::mat4));
+            }
+        }
+    });
+    return result;
+}
@@ -0,0 +1,128 @@
+/** @file MappedFile.cpp
+ */
+
+#include "MappedFile.hpp"
+
+#if defined(_WIN32)
+    #include <windows.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : m_data(nullptr), m_size(0), m_file(nullptr), m_mapping(nullptr){
+}
+
+MappedFile::~MappedFile(){
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path){
+    Close();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    m_file = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        Close();
+        return false;
+    }
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr) {
+        Close();
+        return false;
+    }
+    m_data = (const unsigned char*)MapViewOfFile((HANDLE)m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_data == nullptr) {
+        Close();
+        return false;
+    }
+    m_size = (std::size_t)size.QuadPart;
+    return true;
+#else
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size == 0) {
+        close(file);
+        return false;
+    }
+    void* data = mmap(nullptr, (std::size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    // The mapping keeps the file alive on its own
+    close(file);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    madvise(data, (std::size_t)status.st_size, MADV_SEQUENTIAL);
+    m_data = (const unsigned char*)data;
+    m_size = (std::size_t)status.st_size;
+    return true;
+#endif
+}
+
+void MappedFile::Close(){
+#if defined(_WIN32)
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle((HANDLE)m_mapping);
+    }
+    if (m_file != nullptr) {
+        CloseHandle((HANDLE)m_file);
+    }
+#else
+    if (m_data != nullptr) {
+        munmap((void*)m_data, m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_file = nullptr;
+    m_mapping = nullptr;
+}
+
+bool MappedFile::IsOpen() const{
+    return m_data != nullptr;
+}
+
+const unsigned char* MappedFile::GetData() const{
+    return m_data;
+}
+
+std::size_t MappedFile::GetSize() const{
+    return m_size;
+}
+
+bool GetFileStamp(const std::string& path, std::uint64_t& size, std::int64_t& modifiedNs){
+#if defined(_WIN32)
+    struct _stat64 status;
+    if (_stat64(path.c_str(), &status) != 0) {
+        return false;
+    }
+    size = (std::uint64_t)status.st_size;
+    modifiedNs = (std::int64_t)status.st_mtime * 1000000000;
+#else
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) {
+        return false;
+    }
+    size = (std::uint64_t)status.st_size;
+#if defined(__APPLE__)
+    modifiedNs = (std::int64_t)status.st_mtimespec.tv_sec * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+    modifiedNs = (std::int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+#endif
+    return true;
+}
@@ -0,0 +1,162 @@
+/** @file MeshOptimizer.cpp
+ */
+
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+// Cache the ordering models, larger than the reported one so that
+// the order also suits GPUs with bigger caches
+static const int kOptimizerCacheSize = 32;
+
+int SimulateVertexCache(const std::vector<GLuint>& indices, int cacheSize){
+    std::deque<GLuint> cache;
+    int invocations = 0;
+    for (GLuint index : indices) {
+        if (std::find(cache.begin(), cache.end(), index) != cache.end()) {
+            continue;
+        }
+        invocations++;
+        cache.push_back(index);
+        if ((int)cache.size() > cacheSize) {
+            cache.pop_front();
+        }
+    }
+    return invocations;
+}
+
+// Forsyth's score of a vertex at cachePosition (-1 if not cached)
+// that still belongs to remainingTriangles unemitted triangles
+static float VertexScore(int cachePosition, int remainingTriangles){
+    if (remainingTriangles == 0) {
+        return -1.0f;
+    }
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        // The vertices of the last triangle score the same on purpose,
+        // the next triangle may share any of its edges
+        score = cachePosition < 3 ? 0.75f
+                                  : std::pow(1.0f - (float)(cachePosition - 3) / (kOptimizerCacheSize - 3), 1.5f);
+    }
+    // Finishing off vertices with few triangles left avoids leaving
+    // lone triangles behind that need their vertices shaded again
+    return score + 2.0f * std::pow((float)remainingTriangles, -0.5f);
+}
+
+void OptimizeVertexCache(std::vector<GLuint>& indices, GLsizei vertexCount){
+    std::size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+    // Triangles of every vertex, emitted ones are swapped out of the
+    // front remaining[v] entries of its range
+    std::vector<int> remaining(vertexCount, 0);
+    for (GLuint index : indices) {
+        remaining[index]++;
+    }
+    std::vector<int> first(vertexCount + 1, 0);
+    for (GLsizei v = 0; v < vertexCount; ++v) {
+        first[v + 1] = first[v] + remaining[v];
+    }
+    std::vector<int> adjacency(indices.size());
+    std::vector<int> fill(first.begin(), first.end() - 1);
+    for (std::size_t t = 0; t < triangleCount; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            adjacency[fill[indices[t * 3 + k]]++] = (int)t;
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (GLsizei v = 0; v < vertexCount; ++v) {
+        vertexScore[v] = VertexScore(-1, remaining[v]);
+    }
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (std::size_t t = 0; t < triangleCount; ++t) {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<GLuint> ordered;
+    ordered.reserve(indices.size());
+    std::vector<GLuint> cache;
+    std::vector<GLuint> nextCache;
+    int best = (int)(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+    for (std::size_t n = 0; n < triangleCount; ++n) {
+        if (best < 0) {
+            // Nothing in the cache touches a remaining triangle, start
+            // over at the best one anywhere
+            float bestScore = -1.0f;
+            for (std::size_t t = 0; t < triangleCount; ++t) {
+                if (!emitted[t] && triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = (int)t;
+                }
+            }
+        }
+        emitted[best] = true;
+        nextCache.clear();
+        for (int k = 0; k < 3; ++k) {
+            GLuint v = indices[best * 3 + k];
+            ordered.push_back(v);
+            int* begin = &adjacency[first[v]];
+            int* end = begin + remaining[v];
+            int* found = std::find(begin, end, best);
+            if (found != end) {
+                std::swap(*found, *(end - 1));
+                remaining[v]--;
+            }
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end()) {
+                nextCache.push_back(v);
+            }
+        }
+        for (GLuint v : cache) {
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end()) {
+                nextCache.push_back(v);
+            }
+        }
+        // Rescore everything that moved or fell out of the cache, along
+        // with the triangles that use it
+        for (std::size_t i = 0; i < nextCache.size(); ++i) {
+            GLuint v = nextCache[i];
+            cachePosition[v] = i < (std::size_t)kOptimizerCacheSize ? (int)i : -1;
+            vertexScore[v] = VertexScore(cachePosition[v], remaining[v]);
+        }
+        best = -1;
+        float bestScore = -1.0f;
+        for (GLuint v : nextCache) {
+            for (int i = first[v]; i < first[v] + remaining[v]; ++i) {
+                int t = adjacency[i];
+                triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (nextCache.size() > (std::size_t)kOptimizerCacheSize) {
+            nextCache.resize(kOptimizerCacheSize);
+        }
+        cache.swap(nextCache);
+    }
+    indices.swap(ordered);
+}
+
+void OptimizeVertexFetch(std::vector<GLfloat>& vertices, std::vector<GLuint>& indices, int components){
+    std::size_t vertexCount = vertices.size() / components;
+    std::vector<GLint> remap(vertexCount, -1);
+    std::vector<GLfloat> reordered;
+    reordered.reserve(vertices.size());
+    GLint next = 0;
+    for (GLuint& index : indices) {
+        if (remap[index] < 0) {
+            remap[index] = next++;
+            reordered.insert(reordered.end(), vertices.begin() + index * components,
+                             vertices.begin() + (index + 1) * components);
+        }
+        index = (GLuint)remap[index];
+    }
+    vertices.swap(reordered);
+}
@@ -0,0 +1,317 @@
+/** @file MeshRegistry.cpp
+ */
+
+#include "MeshRegistry.hpp"
+#include "GLStateCache.hpp"
+#include "InstanceGenerator.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshValidation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "glm/glm.hpp"
+#include "glm/gtc/packing.hpp"
+
+bool ParseMeshVertexFormat(const std::string& name, MeshVertexFormat& format){
+    if (name == "float") {
+        format = MeshVertexFormat::Float32;
+    } else if (name == "snorm16") {
+        format = MeshVertexFormat::Snorm16;
+    } else if (name == "snorm8") {
+        format = MeshVertexFormat::Snorm8;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* GetMeshVertexFormatName(MeshVertexFormat format){
+    switch (format) {
+        case MeshVertexFormat::Float32: return "float";
+        case MeshVertexFormat::Snorm16: return "snorm16";
+        case MeshVertexFormat::Snorm8: return "snorm8";
+    }
+    return "unknown";
+}
+
+MeshData BuildSphereMesh(int rings, int segments, float radius, float roughness, unsigned int seed){
+    MeshData mesh;
+    const float pi = 3.14159265358979f;
+    // One extra column duplicates the seam with u = 1
+    for (int ring = 0; ring <= rings; ++ring) {
+        bool pole = ring == 0 || ring == rings;
+        // Exact at the poles, so their vertices end up in one point
+        float sinTheta = pole ? 0.0f : std::sin(pi * ring / rings);
+        float cosTheta = ring == 0 ? 1.0f : (ring == rings ? -1.0f : std::cos(pi * ring / rings));
+        for (int segment = 0; segment <= segments; ++segment) {
+            // Vertices sharing a position, the seam and the poles, must
+            // share it bit for bit and share their displacement, or the
+            // surface tears open
+            float phi = 2.0f * pi * (segment % segments) / segments;
+            long long key = (long long)ring * segments + (pole ? 0 : segment % segments);
+            float r = radius * (1.0f - roughness * GetInstanceRandom(key, seed));
+            mesh.vertices.push_back(r * sinTheta * std::cos(phi));
+            mesh.vertices.push_back(r * cosTheta);
+            mesh.vertices.push_back(r * sinTheta * std::sin(phi));
+            mesh.vertices.push_back((float)segment / segments);
+            mesh.vertices.push_back(1.0f - (float)ring / rings);
+        }
+    }
+    for (int ring = 0; ring < rings; ++ring) {
+        for (int segment = 0; segment < segments; ++segment) {
+            GLuint topLeft = ring * (segments + 1) + segment;
+            GLuint bottomLeft = topLeft + segments + 1;
+            // Skip the triangles that collapse into a pole
+            if (ring != rings - 1) {
+                mesh.indices.insert(mesh.indices.end(), {topLeft, bottomLeft + 1, bottomLeft});
+            }
+            if (ring != 0) {
+                mesh.indices.insert(mesh.indices.end(), {topLeft, topLeft + 1, bottomLeft + 1});
+            }
+        }
+    }
+    return mesh;
+}
+
+MeshRegistry::MeshRegistry()
+    : m_vertexBuffer(0), m_indexBuffer(0), m_vertexFormat(MeshVertexFormat::Float32),
+      m_indexType(GL_UNSIGNED_INT), m_positionScale(1.0f), m_maxPositionError(0.0f), m_maxCommands(0){
+}
+
+MeshRegistry::~MeshRegistry(){
+    // GL objects are released in Destroy() while the context is alive
+}
+
+int MeshRegistry::AddMesh(const std::string& name, const MeshData& data){
+    // With back-face culling on, a triangle wound the wrong way leaves
+    // a hole, so such meshes are refused rather than drawn
+    WindingReport winding = ValidateWinding(data.vertices, data.indices, gMeshVertexComponents);
+    if (!winding.IsConsistent()) {
+        std::cout << "Mesh " << name << " has mixed winding: " << winding.mixedEdges
+                  << " edges are walked twice in the same direction" << std::endl;
+        return -1;
+    }
+    if (!winding.IsOutward()) {
+        std::cout << "Mesh " << name << " is wound inside out (volume " << winding.signedVolume << ")" << std::endl;
+        return -1;
+    }
+
+    MeshData optimized = data;
+    Mesh mesh;
+    mesh.name = name;
+    mesh.invocationsBefore = SimulateVertexCache(optimized.indices);
+    OptimizeVertexCache(optimized.indices, (GLsizei)(optimized.vertices.size() / gMeshVertexComponents));
+    OptimizeVertexFetch(optimized.vertices, optimized.indices, gMeshVertexComponents);
+    mesh.invocations = SimulateVertexCache(optimized.indices);
+    mesh.firstIndex = (GLuint)m_indices.size();
+    mesh.indexCount = (GLsizei)optimized.indices.size();
+    mesh.baseVertex = (GLint)(m_vertices.size() / gMeshVertexComponents);
+    mesh.vertexCount = (GLsizei)(optimized.vertices.size() / gMeshVertexComponents);
+    m_vertices.insert(m_vertices.end(), optimized.vertices.begin(), optimized.vertices.end());
+    m_indices.insert(m_indices.end(), optimized.indices.begin(), optimized.indices.end());
+    m_meshes.push_back(mesh);
+    m_shapes.push_back(optimized);
+    return (int)m_meshes.size() - 1;
+}
+
+void MeshRegistry::Upload(MeshVertexFormat format){
+    m_vertexFormat = format;
+    std::size_t vertexCount = m_vertices.size() / gMeshVertexComponents;
+    std::vector<unsigned char> vertices;
+    m_positionScale = 1.0f;
+    m_maxPositionError = 0.0f;
+    if (format == MeshVertexFormat::Float32) {
+        vertices.resize(m_vertices.size() * sizeof(GLfloat));
+        std::memcpy(vertices.data(), m_vertices.data(), vertices.size());
+    } else {
+        // One scale for all meshes, a multi-draw cannot switch it per mesh
+        float extent = 0.0f;
+        for (std::size_t v = 0; v < vertexCount; ++v) {
+            for (int axis = 0; axis < 3; ++axis) {
+                extent = std::max(extent, std::fabs(m_vertices[v * gMeshVertexComponents + axis]));
+            }
+        }
+        m_positionScale = extent > 0.0f ? extent : 1.0f;
+        vertices.resize(vertexCount * GetVertexStride());
+        unsigned char* out = vertices.data();
+        for (std::size_t v = 0; v < vertexCount; ++v) {
+            const GLfloat* in = &m_vertices[v * gMeshVertexComponents];
+            glm::vec3 position = glm::vec3(in[0], in[1], in[2]);
+            glm::vec4 normalized = glm::vec4(position / m_positionScale, 0.0f);
+            glm::vec3 decoded;
+            if (format == MeshVertexFormat::Snorm16) {
+                std::uint64_t packed = glm::packSnorm4x16(normalized);
+                decoded = glm::vec3(glm::unpackSnorm4x16(packed));
+                std::memcpy(out, &packed, sizeof(packed));
+                out += sizeof(packed);
+            } else {
+                std::uint32_t packed = glm::packSnorm4x8(normalized);
+                decoded = glm::vec3(glm::unpackSnorm4x8(packed));
+                std::memcpy(out, &packed, sizeof(packed));
+                out += sizeof(packed);
+            }
+            m_maxPositionError = std::max(m_maxPositionError, glm::length(decoded * m_positionScale - position));
+            std::uint32_t uv = glm::packUnorm2x16(glm::vec2(in[3], in[4]));
+            std::memcpy(out, &uv, sizeof(uv));
+            out += sizeof(uv);
+        }
+    }
+    glGenBuffers(1, &m_vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Indices are relative to each mesh's base vertex, so only the
+    // largest mesh decides. 8 bit indices are left out on purpose,
+    // several GPUs convert them on the CPU.
+    GLsizei largest = 0;
+    for (const Mesh& mesh : m_meshes) {
+        largest = std::max(largest, mesh.vertexCount);
+    }
+    m_indexType = largest <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    std::vector<unsigned char> indices(m_indices.size() * GetIndexSize());
+    if (m_indexType == GL_UNSIGNED_SHORT) {
+        for (std::size_t i = 0; i < m_indices.size(); ++i) {
+            std::uint16_t index = (std::uint16_t)m_indices[i];
+            std::memcpy(&indices[i * sizeof(index)], &index, sizeof(index));
+        }
+    } else {
+        std::memcpy(indices.data(), m_indices.data(), indices.size());
+    }
+    // The element binding belongs to whatever VAO is bound, fill the
+    // index buffer through a neutral target instead
+    glGenBuffers(1, &m_indexBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_indexBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, indices.size(), indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    std::vector<GLfloat>().swap(m_vertices);
+    std::vector<GLuint>().swap(m_indices);
+}
+
+void MeshRegistry::AttachToVertexArray() const{
+    GLsizei stride = GetVertexStride();
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    if (m_vertexFormat == MeshVertexFormat::Float32) {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * 3));
+    } else if (m_vertexFormat == MeshVertexFormat::Snorm16) {
+        // The fourth component only pads the position to 8 bytes
+        glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, stride, (void*)0);
+        glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)(sizeof(GLshort) * 4));
+    } else {
+        glVertexAttribPointer(0, 4, GL_BYTE, GL_TRUE, stride, (void*)0);
+        glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)(sizeof(GLbyte) * 4));
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+}
+
+void MeshRegistry::Destroy(){
+    glDeleteBuffers(1, &m_vertexBuffer);
+    glDeleteBuffers(1, &m_indexBuffer);
+    m_vertexBuffer = 0;
+    m_indexBuffer = 0;
+    if (m_commandRing.IsInitialized()) {
+        m_commandRing.Destroy();
+    }
+    m_maxCommands = 0;
+}
+
+int MeshRegistry::GetMeshCount() const{
+    return (int)m_meshes.size();
+}
+
+const Mesh& MeshRegistry::GetMesh(int id) const{
+    return m_meshes[id];
+}
+
+int MeshRegistry::CountFrontFacing(int id, const glm::vec3& eye) const{
+    const MeshData& shape = m_shapes[id];
+    return CountFrontFacingTriangles(shape.vertices, shape.indices, gMeshVertexComponents, eye);
+}
+
+GLuint MeshRegistry::GetVertexBuffer() const{
+    return m_vertexBuffer;
+}
+
+GLuint MeshRegistry::GetIndexBuffer() const{
+    return m_indexBuffer;
+}
+
+GLenum MeshRegistry::GetIndexType() const{
+    return m_indexType;
+}
+
+GLsizei MeshRegistry::GetIndexSize() const{
+    return m_indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+GLsizei MeshRegistry::GetVertexStride() const{
+    switch (m_vertexFormat) {
+        case MeshVertexFormat::Float32: return sizeof(GLfloat) * gMeshVertexComponents;
+        case MeshVertexFormat::Snorm16: return sizeof(GLshort) * 4 + sizeof(GLushort) * 2;
+        case MeshVertexFormat::Snorm8: return sizeof(GLbyte) * 4 + sizeof(GLushort) * 2;
+    }
+    return 0;
+}
+
+float MeshRegistry::GetPositionScale() const{
+    return m_positionScale;
+}
+
+float MeshRegistry::GetMaxPositionError() const{
+    return m_maxPositionError;
+}
+
+bool MeshRegistry::IsMultiDrawSupported(){
+    return GLAD_GL_VERSION_4_3 && glMultiDrawElementsIndirect != nullptr;
+}
+
+void MeshRegistry::InitializeMultiDraw(int maxCommands, int frameCount){
+    if (!IsMultiDrawSupported() || maxCommands <= 0) {
+        return;
+    }
+    if (m_commandRing.Initialize(GL_DRAW_INDIRECT_BUFFER, maxCommands * sizeof(DrawElementsIndirectCommand), frameCount)) {
+        m_maxCommands = maxCommands;
+    }
+}
+
+bool MeshRegistry::IsMultiDrawInitialized() const{
+    return m_commandRing.IsInitialized();
+}
+
+int MeshRegistry::MultiDraw(const std::vector<DrawElementsIndirectCommand>& commands){
+    if (commands.empty()) {
+        return 0;
+    }
+    if (IsMultiDrawInitialized() && (int)commands.size() <= m_maxCommands) {
+        void* data = m_commandRing.BeginWrite();
+        if (data != nullptr) {
+            std::memcpy(data, commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand));
+        }
+        m_commandRing.EndWrite();
+        if (data != nullptr) {
+            GLStateCache::Instance().BindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandRing.GetBuffer());
+            glMultiDrawElementsIndirect(GL_TRIANGLES, m_indexType, (void*)m_commandRing.GetWriteOffset(),
+                                        (GLsizei)commands.size(), 0);
+            return 1;
+        }
+    }
+    for (const DrawElementsIndirectCommand& command : commands) {
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, m_indexType,
+                                                      (void*)((std::size_t)command.firstIndex * GetIndexSize()),
+                                                      command.instanceCount, command.baseVertex, command.baseInstance);
+    }
+    return (int)commands.size();
+}
+
+void MeshRegistry::FinishFrame(){
+    if (m_commandRing.IsInitialized()) {
+        m_commandRing.FinishFrame();
+    }
+}
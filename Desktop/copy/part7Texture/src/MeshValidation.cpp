@@ -0,0 +1,72 @@
+/** @file MeshValidation.cpp
+ */
+
+#include "MeshValidation.hpp"
+
+#include <map>
+#include <utility>
+#include "glm/glm.hpp"
+
+static glm::vec3 GetPosition(const std::vector<GLfloat>& vertices, GLuint index, int components){
+    return glm::vec3(vertices[index * components], vertices[index * components + 1], vertices[index * components + 2]);
+}
+
+WindingReport ValidateWinding(const std::vector<GLfloat>& vertices,
+                              const std::vector<GLuint>& indices,
+                              int components){
+    WindingReport report;
+    report.triangles = (int)(indices.size() / 3);
+
+    // Weld vertices with equal positions to one id
+    std::map<std::pair<float, std::pair<float, float>>, int> positionIds;
+    std::vector<int> weld(vertices.size() / components);
+    for (std::size_t v = 0; v < weld.size(); ++v) {
+        glm::vec3 p = GetPosition(vertices, (GLuint)v, components);
+        auto key = std::make_pair(p.x, std::make_pair(p.y, p.z));
+        auto found = positionIds.find(key);
+        if (found == positionIds.end()) {
+            found = positionIds.emplace(key, (int)positionIds.size()).first;
+        }
+        weld[v] = found->second;
+    }
+
+    // Directed edges; in a consistently wound closed mesh every edge
+    // is walked once in each direction
+    std::map<std::pair<int, int>, int> edges;
+    for (std::size_t t = 0; t + 2 < indices.size(); t += 3) {
+        glm::vec3 p0 = GetPosition(vertices, indices[t], components);
+        glm::vec3 p1 = GetPosition(vertices, indices[t + 1], components);
+        glm::vec3 p2 = GetPosition(vertices, indices[t + 2], components);
+        report.signedVolume += glm::dot(p0, glm::cross(p1, p2)) / 6.0f;
+        for (int k = 0; k < 3; ++k) {
+            int from = weld[indices[t + k]];
+            int to = weld[indices[t + (k + 1) % 3]];
+            edges[std::make_pair(from, to)]++;
+        }
+    }
+    for (const auto& edge : edges) {
+        if (edge.second > 1) {
+            report.mixedEdges += edge.second - 1;
+        }
+        if (edges.find(std::make_pair(edge.first.second, edge.first.first)) == edges.end()) {
+            report.openEdges++;
+        }
+    }
+    return report;
+}
+
+int CountFrontFacingTriangles(const std::vector<GLfloat>& vertices,
+                              const std::vector<GLuint>& indices,
+                              int components,
+                              const glm::vec3& eye){
+    int front = 0;
+    for (std::size_t t = 0; t + 2 < indices.size(); t += 3) {
+        glm::vec3 p0 = GetPosition(vertices, indices[t], components);
+        glm::vec3 p1 = GetPosition(vertices, indices[t + 1], components);
+        glm::vec3 p2 = GetPosition(vertices, indices[t + 2], components);
+        if (glm::dot(glm::cross(p1 - p0, p2 - p0), eye - p0) > 0.0f) {
+            front++;
+        }
+    }
+    return front;
+}
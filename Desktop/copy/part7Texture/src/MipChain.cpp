@@ -0,0 +1,448 @@
+/** @file MipChain.cpp
+ */
+
+#include "MipChain.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #define MIPCHAIN_SSE2 1
+    #include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+    #define MIPCHAIN_AVX2 1
+    #include <immintrin.h>
+#endif
+
+// Taps of the Kaiser filter per axis, and the shape of its window
+static const int kKaiserTaps = 8;
+static const double kKaiserBeta = 4.0;
+// Destination texels per thread before the rows are split at all
+static const std::size_t kTexelsPerSlice = 16384;
+
+bool ParseMipFilter(const std::string& name, MipFilter& filter){
+    for (int i = 0; i <= (int)MipFilter::Kaiser; ++i) {
+        if (name == GetMipFilterName((MipFilter)i)) {
+            filter = (MipFilter)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetMipFilterName(MipFilter filter){
+    switch (filter) {
+        case MipFilter::Box: return "box";
+        case MipFilter::Kaiser: return "kaiser";
+    }
+    return "unknown";
+}
+
+int GetMipLevelCount(int width, int height){
+    int levels = 1;
+    while (width > 1 || height > 1) {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        ++levels;
+    }
+    return levels;
+}
+
+void DownsampleImageScalar(const Image& source, Image& destination){
+    int width = std::max(1, source.GetWidth() / 2);
+    int height = std::max(1, source.GetHeight() / 2);
+    int channels = source.GetChannels();
+    destination.Allocate(width, height, channels);
+    const unsigned char* in = source.GetPixels();
+    unsigned char* out = destination.GetPixels();
+    std::size_t sourceRow = (std::size_t)source.GetWidth() * channels;
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* row0 = in + (std::size_t)(2 * y) * sourceRow;
+        const unsigned char* row1 = in + (std::size_t)std::min(2 * y + 1, source.GetHeight() - 1) * sourceRow;
+        for (int x = 0; x < width; ++x) {
+            int x0 = 2 * x * channels;
+            int x1 = std::min(2 * x + 1, source.GetWidth() - 1) * channels;
+            for (int c = 0; c < channels; ++c) {
+                *out++ = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+            }
+        }
+    }
+}
+
+// Adds two rows sample by sample, the vertical half of the box
+static void SumRows(const unsigned char* row0, const unsigned char* row1, std::uint16_t* sums, std::size_t count){
+    std::size_t i = 0;
+#if MIPCHAIN_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(row0 + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(row1 + i));
+        _mm_storeu_si128((__m128i*)(sums + i), _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+        _mm_storeu_si128((__m128i*)(sums + i + 8), _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+    }
+#endif
+    for (; i < count; ++i) {
+        sums[i] = (std::uint16_t)(row0[i] + row1[i]);
+    }
+}
+
+#ifdef MIPCHAIN_AVX2
+// SumRows() 32 samples at a time
+__attribute__((target("avx2")))
+static void SumRowsAvx2(const unsigned char* row0, const unsigned char* row1, std::uint16_t* sums, std::size_t count){
+    std::size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i a0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row0 + i)));
+        __m256i a1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row0 + i + 16)));
+        __m256i b0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row1 + i)));
+        __m256i b1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row1 + i + 16)));
+        _mm256_storeu_si256((__m256i*)(sums + i), _mm256_add_epi16(a0, b0));
+        _mm256_storeu_si256((__m256i*)(sums + i + 16), _mm256_add_epi16(a1, b1));
+    }
+    SumRows(row0 + i, row1 + i, sums + i, count - i);
+}
+#endif
+
+// Adds horizontal pairs of pixels of a row of SumRows() and writes
+// their rounded quarter, width pixels. sums holds 2 * width pixels and
+// at least 8 readable samples past them.
+static void AverageColumns(const std::uint16_t* sums, unsigned char* out, int width, int channels){
+    int x = 0;
+#if MIPCHAIN_SSE2
+    const __m128i two = _mm_set1_epi16(2);
+    if (channels == 1) {
+        // 16 texels from 32 sums, pairs added by multiplying with 1s
+        const __m128i ones = _mm_set1_epi16(1);
+        for (; x + 16 <= width; x += 16) {
+            const std::uint16_t* s = sums + 2 * x;
+            __m128i low = _mm_packs_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)s), ones),
+                                          _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(s + 8)), ones));
+            __m128i high = _mm_packs_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(s + 16)), ones),
+                                           _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(s + 24)), ones));
+            low = _mm_srli_epi16(_mm_add_epi16(low, two), 2);
+            high = _mm_srli_epi16(_mm_add_epi16(high, two), 2);
+            _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(low, high));
+        }
+    } else if (channels == 3) {
+        // 4 pixels from 24 sums: every sum plus the one 3 further,
+        // then samples 0-2, 6-8, 12-14 and 18-20 moved together
+        const __m128i keep012 = _mm_setr_epi16(-1, -1, -1, 0, 0, 0, 0, 0);
+        const __m128i keep34 = _mm_setr_epi16(0, 0, 0, -1, -1, 0, 0, 0);
+        const __m128i keep5 = _mm_setr_epi16(0, 0, 0, 0, 0, -1, 0, 0);
+        const __m128i keep67 = _mm_setr_epi16(0, 0, 0, 0, 0, 0, -1, -1);
+        const __m128i keep0 = _mm_setr_epi16(-1, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i keep123 = _mm_setr_epi16(0, -1, -1, -1, 0, 0, 0, 0);
+        for (; x + 4 <= width; x += 4) {
+            const std::uint16_t* s = sums + 6 * x;
+            __m128i p0 = _mm_add_epi16(_mm_loadu_si128((const __m128i*)s), _mm_loadu_si128((const __m128i*)(s + 3)));
+            __m128i p1 = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(s + 8)), _mm_loadu_si128((const __m128i*)(s + 11)));
+            __m128i p2 = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(s + 16)), _mm_loadu_si128((const __m128i*)(s + 19)));
+            p0 = _mm_srli_epi16(_mm_add_epi16(p0, two), 2);
+            p1 = _mm_srli_epi16(_mm_add_epi16(p1, two), 2);
+            p2 = _mm_srli_epi16(_mm_add_epi16(p2, two), 2);
+            __m128i first = _mm_or_si128(_mm_or_si128(_mm_and_si128(p0, keep012),
+                                                      _mm_and_si128(_mm_srli_si128(p0, 6), keep34)),
+                                         _mm_or_si128(_mm_and_si128(_mm_slli_si128(p1, 10), keep5),
+                                                      _mm_and_si128(_mm_slli_si128(p1, 4), keep67)));
+            __m128i second = _mm_or_si128(_mm_and_si128(_mm_srli_si128(p1, 12), keep0),
+                                          _mm_and_si128(_mm_srli_si128(p2, 2), keep123));
+            __m128i bytes = _mm_packus_epi16(first, second);
+            unsigned char* destination = out + 3 * x;
+            _mm_storel_epi64((__m128i*)destination, bytes);
+            std::uint32_t last = (std::uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+            destination[8] = (unsigned char)last;
+            destination[9] = (unsigned char)(last >> 8);
+            destination[10] = (unsigned char)(last >> 16);
+            destination[11] = (unsigned char)(last >> 24);
+        }
+    }
+#endif
+    for (; x < width; ++x) {
+        const std::uint16_t* s = sums + 2 * x * channels;
+        for (int c = 0; c < channels; ++c) {
+            out[x * channels + c] = (unsigned char)((s[c] + s[channels + c] + 2) >> 2);
+        }
+    }
+}
+
+// Zeroth order modified Bessel function of the first kind, by its series
+static double BesselI0(double x){
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Weights of the source texels 3 before to 4 after the first texel
+// of a destination texel, summing to 1
+static const float* GetKaiserWeights(){
+    struct Weights{
+        float values[kKaiserTaps];
+        Weights(){
+            const double pi = 3.14159265358979;
+            double radius = kKaiserTaps / 2;
+            double total = 0.0;
+            double raw[kKaiserTaps];
+            for (int i = 0; i < kKaiserTaps; ++i) {
+                // Distance from the middle of the 2 texels, in source texels
+                double distance = i - (kKaiserTaps / 2 - 1) - 0.5;
+                // Cut off at half the source frequency for the 2:1 step
+                double t = pi * distance / 2.0;
+                double sinc = std::sin(t) / t;
+                double ratio = distance / radius;
+                raw[i] = sinc * BesselI0(kKaiserBeta * std::sqrt(1.0 - ratio * ratio)) / BesselI0(kKaiserBeta);
+                total += raw[i];
+            }
+            for (int i = 0; i < kKaiserTaps; ++i) {
+                values[i] = (float)(raw[i] / total);
+            }
+        }
+    };
+    static const Weights weights;
+    return weights.values;
+}
+
+// Weighs kKaiserTaps source rows into one row of floats
+static void FilterRows(const unsigned char* const* rows, const float* weights, float* filtered, std::size_t count){
+    std::size_t i = 0;
+#if MIPCHAIN_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        __m128 sum2 = _mm_setzero_ps();
+        __m128 sum3 = _mm_setzero_ps();
+        for (int k = 0; k < kKaiserTaps; ++k) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(rows[k] + i));
+            __m128i low = _mm_unpacklo_epi8(bytes, zero);
+            __m128i high = _mm_unpackhi_epi8(bytes, zero);
+            __m128 weight = _mm_set1_ps(weights[k]);
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), weight));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), weight));
+            sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), weight));
+            sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), weight));
+        }
+        _mm_storeu_ps(filtered + i, sum0);
+        _mm_storeu_ps(filtered + i + 4, sum1);
+        _mm_storeu_ps(filtered + i + 8, sum2);
+        _mm_storeu_ps(filtered + i + 12, sum3);
+    }
+#endif
+    for (; i < count; ++i) {
+        float sum = 0.0f;
+        for (int k = 0; k < kKaiserTaps; ++k) {
+            sum += rows[k][i] * weights[k];
+        }
+        filtered[i] = sum;
+    }
+}
+
+#ifdef MIPCHAIN_AVX2
+// FilterRows() 32 samples at a time. Multiplies and adds separately
+// rather than fused, so the sums are the same floats as with SSE2.
+__attribute__((target("avx2")))
+static void FilterRowsAvx2(const unsigned char* const* rows, const float* weights, float* filtered, std::size_t count){
+    std::size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256 sums[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+        for (int k = 0; k < kKaiserTaps; ++k) {
+            __m256 weight = _mm256_set1_ps(weights[k]);
+            for (int j = 0; j < 4; ++j) {
+                __m256i samples = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(rows[k] + i + 8 * j)));
+                sums[j] = _mm256_add_ps(sums[j], _mm256_mul_ps(_mm256_cvtepi32_ps(samples), weight));
+            }
+        }
+        for (int j = 0; j < 4; ++j) {
+            _mm256_storeu_ps(filtered + i + 8 * j, sums[j]);
+        }
+    }
+    const unsigned char* rest[kKaiserTaps];
+    for (int k = 0; k < kKaiserTaps; ++k) {
+        rest[k] = rows[k] + i;
+    }
+    FilterRows(rest, weights, filtered + i, count - i);
+}
+#endif
+
+typedef void (*SumRowsKernel)(const unsigned char*, const unsigned char*, std::uint16_t*, std::size_t);
+typedef void (*FilterRowsKernel)(const unsigned char* const*, const float*, float*, std::size_t);
+
+// The row passes of both filters, for the widest instructions the CPU
+// running us supports. The column passes shuffle within 128 bits and
+// stay SSE2.
+struct RowKernels{
+    SumRowsKernel sumRows = SumRows;
+    FilterRowsKernel filterRows = FilterRows;
+#if MIPCHAIN_SSE2
+    const char* name = "sse2";
+#else
+    const char* name = "scalar";
+#endif
+    RowKernels(){
+#ifdef MIPCHAIN_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            sumRows = SumRowsAvx2;
+            filterRows = FilterRowsAvx2;
+            name = "avx2";
+        }
+#endif
+    }
+};
+static const RowKernels gRowKernels;
+
+// Rounds a filtered sample to 8 bits. The negative lobes can
+// overshoot next to hard edges.
+static inline unsigned char ToByte(float value){
+    return (unsigned char)std::min(std::max(value + 0.5f, 0.0f), 255.0f);
+}
+
+// One destination texel of FilterColumns(), with the taps past an
+// edge moved onto it
+static void FilterTexelClamped(const float* filtered, const float* weights, unsigned char* out,
+                               int texel, int sourceWidth, int channels){
+    int first = 2 * texel - (kKaiserTaps / 2 - 1);
+    float sums[3] = {0.0f, 0.0f, 0.0f};
+    for (int k = 0; k < kKaiserTaps; ++k) {
+        const float* source = filtered + (std::size_t)std::min(std::max(first + k, 0), sourceWidth - 1) * channels;
+        for (int c = 0; c < channels; ++c) {
+            sums[c] += source[c] * weights[k];
+        }
+    }
+    for (int c = 0; c < channels; ++c) {
+        out[texel * channels + c] = ToByte(sums[c]);
+    }
+}
+
+// Weighs kKaiserTaps texels of a row of FilterRows() into each of
+// width destination texels
+static void FilterColumns(const float* filtered, const float* weights, unsigned char* out,
+                          int width, int sourceWidth, int channels){
+    const int before = kKaiserTaps / 2 - 1;
+    // Texels whose taps are all inside the row need no clamping
+    int interiorBegin = std::min(width, (before + 1) / 2);
+    int interiorEnd = std::max(interiorBegin, std::min(width, (sourceWidth - kKaiserTaps + before) / 2 + 1));
+    int x = interiorBegin;
+#if MIPCHAIN_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 maximum = _mm_set1_ps(255.0f);
+    if (channels == 1) {
+        // 4 texels, the even samples of two loads per tap
+        for (; x + 4 <= interiorEnd; x += 4) {
+            const float* first = filtered + 2 * x - before;
+            __m128 sum = half;
+            for (int k = 0; k < kKaiserTaps; ++k) {
+                __m128 even = _mm_shuffle_ps(_mm_loadu_ps(first + k), _mm_loadu_ps(first + k + 4), _MM_SHUFFLE(2, 0, 2, 0));
+                sum = _mm_add_ps(sum, _mm_mul_ps(even, _mm_set1_ps(weights[k])));
+            }
+            __m128i values = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(sum, zero), maximum));
+            values = _mm_packus_epi16(_mm_packs_epi32(values, values), values);
+            std::uint32_t bytes = (std::uint32_t)_mm_cvtsi128_si32(values);
+            out[x] = (unsigned char)bytes;
+            out[x + 1] = (unsigned char)(bytes >> 8);
+            out[x + 2] = (unsigned char)(bytes >> 16);
+            out[x + 3] = (unsigned char)(bytes >> 24);
+        }
+    } else if (channels == 3) {
+        // One pixel per step, the fourth lane is the next red and unused
+        for (; x < interiorEnd; ++x) {
+            const float* first = filtered + (std::size_t)(2 * x - before) * 3;
+            __m128 sum = half;
+            for (int k = 0; k < kKaiserTaps; ++k) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(first + 3 * k), _mm_set1_ps(weights[k])));
+            }
+            __m128i values = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(sum, zero), maximum));
+            values = _mm_packus_epi16(_mm_packs_epi32(values, values), values);
+            std::uint32_t bytes = (std::uint32_t)_mm_cvtsi128_si32(values);
+            out[3 * x] = (unsigned char)bytes;
+            out[3 * x + 1] = (unsigned char)(bytes >> 8);
+            out[3 * x + 2] = (unsigned char)(bytes >> 16);
+        }
+    }
+#endif
+    for (int texel = 0; texel < interiorBegin; ++texel) {
+        FilterTexelClamped(filtered, weights, out, texel, sourceWidth, channels);
+    }
+    for (; x < width; ++x) {
+        FilterTexelClamped(filtered, weights, out, x, sourceWidth, channels);
+    }
+}
+
+static void DownsampleBox(const Image& source, Image& destination){
+    int width = destination.GetWidth();
+    int channels = source.GetChannels();
+    if (source.GetWidth() == 1) {
+        // A single column, which the pairs below cannot handle
+        DownsampleImageScalar(source, destination);
+        return;
+    }
+    const unsigned char* in = source.GetPixels();
+    unsigned char* out = destination.GetPixels();
+    std::size_t sourceRow = (std::size_t)source.GetWidth() * channels;
+    std::size_t destinationRow = (std::size_t)width * channels;
+    std::size_t samples = 2 * destinationRow;
+    ParallelFor((std::size_t)destination.GetHeight(), [&](std::size_t begin, std::size_t end){
+        std::vector<std::uint16_t> sums(samples + 8, 0);
+        for (std::size_t y = begin; y < end; ++y) {
+            const unsigned char* row0 = in + 2 * y * sourceRow;
+            const unsigned char* row1 = in + std::min(2 * y + 1, (std::size_t)source.GetHeight() - 1) * sourceRow;
+            gRowKernels.sumRows(row0, row1, sums.data(), samples);
+            AverageColumns(sums.data(), out + y * destinationRow, width, channels);
+        }
+    }, std::max<std::size_t>(1, kTexelsPerSlice / width));
+}
+
+static void DownsampleKaiser(const Image& source, Image& destination){
+    const float* weights = GetKaiserWeights();
+    int width = destination.GetWidth();
+    int channels = source.GetChannels();
+    int sourceWidth = source.GetWidth();
+    int sourceHeight = source.GetHeight();
+    const unsigned char* in = source.GetPixels();
+    unsigned char* out = destination.GetPixels();
+    std::size_t sourceRow = (std::size_t)sourceWidth * channels;
+    std::size_t destinationRow = (std::size_t)width * channels;
+    ParallelFor((std::size_t)destination.GetHeight(), [&](std::size_t begin, std::size_t end){
+        // Room for the unused fourth lane of the last RGB texel
+        std::vector<float> filtered(sourceRow + 4, 0.0f);
+        for (std::size_t y = begin; y < end; ++y) {
+            const unsigned char* rows[kKaiserTaps];
+            for (int k = 0; k < kKaiserTaps; ++k) {
+                int row = std::min(std::max((int)(2 * y) + k - (kKaiserTaps / 2 - 1), 0), sourceHeight - 1);
+                rows[k] = in + (std::size_t)row * sourceRow;
+            }
+            gRowKernels.filterRows(rows, weights, filtered.data(), sourceRow);
+            FilterColumns(filtered.data(), weights, out + y * destinationRow, width, sourceWidth, channels);
+        }
+    }, std::max<std::size_t>(1, kTexelsPerSlice / 4 / width));
+}
+
+void DownsampleImage(const Image& source, Image& destination, MipFilter filter){
+    destination.Allocate(std::max(1, source.GetWidth() / 2), std::max(1, source.GetHeight() / 2), source.GetChannels());
+    if (filter == MipFilter::Kaiser) {
+        DownsampleKaiser(source, destination);
+    } else {
+        DownsampleBox(source, destination);
+    }
+}
+
+void BuildMipChain(const Image& base, std::vector<Image>& levels, MipFilter filter){
+    levels.clear();
+    levels.resize(GetMipLevelCount(base.GetWidth(), base.GetHeight()) - 1);
+    const Image* above = &base;
+    for (Image& level : levels) {
+        DownsampleImage(*above, level, filter);
+        above = &level;
+    }
+}
+
+const char* GetMipKernelName(){
+    return gRowKernels.name;
+}
@@ -0,0 +1,242 @@
+/** @file OcclusionCuller.cpp
+ */
+
+#include "OcclusionCuller.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Points closer to the eye than this along the view direction are not
+// projected, occluders touching them are dropped
+static const float kMinimumDepth = 0.01f;
+// IsOccluded() climbs the pyramid until the box covers at most this
+// many texels along each axis
+static const int kTestTexels = 4;
+// Occluders smaller than this on screen along either axis are skipped
+static const float kMinimumOccluderPixels = 2.0f;
+
+OcclusionCuller::OcclusionCuller()
+    : m_viewProjection(1.0f), m_eye(0.0f), m_occluders(0), m_rasterizeMs(0.0){
+}
+
+void OcclusionCuller::Initialize(int width, int height){
+    m_levels.clear();
+    m_levelSizes.clear();
+    glm::ivec2 size(std::max(width, 1), std::max(height, 1));
+    while (true) {
+        m_levelSizes.push_back(size);
+        m_levels.push_back(std::vector<float>((std::size_t)size.x * size.y, FLT_MAX));
+        if (size.x == 1 && size.y == 1) {
+            break;
+        }
+        size = glm::max((size + 1) / 2, glm::ivec2(1));
+    }
+}
+
+bool OcclusionCuller::IsInitialized() const{
+    return !m_levels.empty();
+}
+
+void OcclusionCuller::BeginFrame(const glm::mat4& viewProjection, const glm::vec3& eye){
+    m_frameStart = std::chrono::steady_clock::now();
+    m_viewProjection = viewProjection;
+    m_eye = eye;
+    m_occluders = 0;
+    std::fill(m_levels[0].begin(), m_levels[0].end(), FLT_MAX);
+}
+
+bool OcclusionCuller::Project(const glm::vec3& point, glm::vec3& screen) const{
+    glm::vec4 clip = m_viewProjection * glm::vec4(point, 1.0f);
+    // For a perspective projection w is the depth along the view direction
+    if (clip.w < kMinimumDepth) {
+        return false;
+    }
+    screen.x = (clip.x / clip.w * 0.5f + 0.5f) * m_levelSizes[0].x;
+    screen.y = (clip.y / clip.w * 0.5f + 0.5f) * m_levelSizes[0].y;
+    screen.z = clip.w;
+    return true;
+}
+
+void OcclusionCuller::RasterizeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c){
+    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (area == 0.0f) {
+        return;
+    }
+    // Edge functions are positive inside for either winding this way
+    float sign = area > 0.0f ? 1.0f : -1.0f;
+    const glm::ivec2& size = m_levelSizes[0];
+    int x0 = std::max(0, (int)std::floor(std::min({a.x, b.x, c.x})));
+    int x1 = std::min(size.x - 1, (int)std::ceil(std::max({a.x, b.x, c.x})));
+    int y0 = std::max(0, (int)std::floor(std::min({a.y, b.y, c.y})));
+    int y1 = std::min(size.y - 1, (int)std::ceil(std::max({a.y, b.y, c.y})));
+    float depth = std::max({a.z, b.z, c.z});
+    // Edge function e(x, y) = dx * x + dy * y + constant, stepped along
+    // the rows instead of evaluated per pixel
+    glm::vec3 dx(-(b.y - a.y), -(c.y - b.y), -(a.y - c.y));
+    glm::vec3 dy(b.x - a.x, c.x - b.x, a.x - c.x);
+    glm::vec3 origin(a.x, b.x, c.x);
+    glm::vec3 originY(a.y, b.y, c.y);
+    dx *= sign;
+    dy *= sign;
+    float* buffer = m_levels[0].data();
+    for (int y = y0; y <= y1; ++y) {
+        glm::vec3 px0(x0 + 0.5f);
+        glm::vec3 edge = dx * (px0 - origin) + dy * (glm::vec3(y + 0.5f) - originY);
+        float* row = buffer + (std::size_t)y * size.x;
+        for (int x = x0; x <= x1; ++x) {
+            if (edge.x >= 0.0f && edge.y >= 0.0f && edge.z >= 0.0f) {
+                row[x] = std::min(row[x], depth);
+            }
+            edge += dx;
+        }
+    }
+}
+
+void OcclusionCuller::AddOccluder(const glm::vec3& boxMin, const glm::vec3& boxMax){
+    // Corner i has bit 0 for x, bit 1 for y and bit 2 for z at max
+    glm::vec3 corners[8];
+    glm::vec3 screenMin(FLT_MAX);
+    glm::vec3 screenMax(-FLT_MAX);
+    for (int i = 0; i < 8; ++i) {
+        glm::vec3 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+        if (!Project(corner, corners[i])) {
+            return;
+        }
+        screenMin = glm::min(screenMin, corners[i]);
+        screenMax = glm::max(screenMax, corners[i]);
+    }
+    // Leaving an occluder out is always safe. Those that are hidden
+    // behind earlier ones add nothing, and neither do those too small
+    // to cover a pixel center reliably.
+    if (screenMax.x - screenMin.x < kMinimumOccluderPixels || screenMax.y - screenMin.y < kMinimumOccluderPixels) {
+        return;
+    }
+    const glm::ivec2& size = m_levelSizes[0];
+    int x0 = std::max(0, (int)std::floor(screenMin.x));
+    int x1 = std::min(size.x - 1, (int)std::ceil(screenMax.x) - 1);
+    int y0 = std::max(0, (int)std::floor(screenMin.y));
+    int y1 = std::min(size.y - 1, (int)std::ceil(screenMax.y) - 1);
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    bool hidden = true;
+    for (int y = y0; y <= y1 && hidden; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            if (m_levels[0][(std::size_t)y * size.x + x] >= screenMin.z) {
+                hidden = false;
+                break;
+            }
+        }
+    }
+    if (hidden) {
+        return;
+    }
+    m_occluders++;
+    // Every face as its four corners, only the up to three faces the
+    // eye is outside of can be seen
+    static const int faces[6][4] = {
+        {0, 2, 6, 4}, {1, 3, 7, 5},
+        {0, 1, 5, 4}, {2, 3, 7, 6},
+        {0, 1, 3, 2}, {4, 5, 7, 6}
+    };
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int side = 0; side < 2; ++side) {
+            bool visible = side == 0 ? m_eye[axis] < boxMin[axis] : m_eye[axis] > boxMax[axis];
+            if (!visible) {
+                continue;
+            }
+            const int* face = faces[axis * 2 + side];
+            RasterizeTriangle(corners[face[0]], corners[face[1]], corners[face[2]]);
+            RasterizeTriangle(corners[face[0]], corners[face[2]], corners[face[3]]);
+        }
+    }
+}
+
+void OcclusionCuller::BuildPyramid(){
+    for (std::size_t level = 1; level < m_levels.size(); ++level) {
+        const std::vector<float>& below = m_levels[level - 1];
+        const glm::ivec2& belowSize = m_levelSizes[level - 1];
+        const glm::ivec2& size = m_levelSizes[level];
+        std::vector<float>& current = m_levels[level];
+        for (int y = 0; y < size.y; ++y) {
+            int y0 = std::min(2 * y, belowSize.y - 1);
+            int y1 = std::min(2 * y + 1, belowSize.y - 1);
+            for (int x = 0; x < size.x; ++x) {
+                int x0 = std::min(2 * x, belowSize.x - 1);
+                int x1 = std::min(2 * x + 1, belowSize.x - 1);
+                current[(std::size_t)y * size.x + x] = std::max(
+                    std::max(below[(std::size_t)y0 * belowSize.x + x0], below[(std::size_t)y0 * belowSize.x + x1]),
+                    std::max(below[(std::size_t)y1 * belowSize.x + x0], below[(std::size_t)y1 * belowSize.x + x1]));
+            }
+        }
+    }
+    auto endTime = std::chrono::steady_clock::now();
+    m_rasterizeMs = std::chrono::duration<double, std::milli>(endTime - m_frameStart).count();
+}
+
+bool OcclusionCuller::IsOccluded(const glm::vec3& boxMin, const glm::vec3& boxMax) const{
+    glm::vec3 screenMin(FLT_MAX);
+    glm::vec3 screenMax(-FLT_MAX);
+    for (int i = 0; i < 8; ++i) {
+        glm::vec3 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+        glm::vec3 screen;
+        if (!Project(corner, screen)) {
+            // Reaches around the eye, nothing can be in front of all of it
+            return false;
+        }
+        screenMin = glm::min(screenMin, screen);
+        screenMax = glm::max(screenMax, screen);
+    }
+    const glm::ivec2& size = m_levelSizes[0];
+    int x0 = std::max(0, (int)std::floor(screenMin.x));
+    int x1 = std::min(size.x - 1, (int)std::ceil(screenMax.x) - 1);
+    int y0 = std::max(0, (int)std::floor(screenMin.y));
+    int y1 = std::min(size.y - 1, (int)std::ceil(screenMax.y) - 1);
+    if (x0 > x1 || y0 > y1) {
+        return false;
+    }
+    std::size_t level = 0;
+    while (level + 1 < m_levels.size() && (x1 - x0 >= kTestTexels || y1 - y0 >= kTestTexels)) {
+        level++;
+        x0 /= 2;
+        x1 /= 2;
+        y0 /= 2;
+        y1 /= 2;
+    }
+    const std::vector<float>& depths = m_levels[level];
+    int width = m_levelSizes[level].x;
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            if (depths[(std::size_t)y * width + x] >= screenMin.z) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+OcclusionStats OcclusionCuller::CullChunks(const std::vector<InstanceChunk>& chunks,
+                                           const Frustum& frustum,
+                                           std::vector<InstanceChunk>& visible){
+    auto startTime = std::chrono::steady_clock::now();
+    OcclusionStats stats;
+    stats.occluders = m_occluders;
+    stats.rasterizeMs = m_rasterizeMs;
+    visible.clear();
+    for (const InstanceChunk& chunk : chunks) {
+        if (frustum.IntersectsBox(chunk.boundsMin, chunk.boundsMax)) {
+            stats.chunksTested++;
+            stats.instancesTested += chunk.instanceCount;
+            if (IsOccluded(chunk.boundsMin, chunk.boundsMax)) {
+                stats.chunksOccluded++;
+                stats.instancesOccluded += chunk.instanceCount;
+                continue;
+            }
+        }
+        visible.push_back(chunk);
+    }
+    auto endTime = std::chrono::steady_clock::now();
+    stats.testMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    return stats;
+}
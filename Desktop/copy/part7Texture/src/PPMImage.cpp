@@ -0,0 +1,189 @@
+/** @file PPMImage.cpp
+ */
+
+#include "PPMImage.hpp"
+#include "MappedFile.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+Image::Image()
+    : m_width(0), m_height(0), m_channels(0){
+}
+
+void Image::Allocate(int width, int height, int channels){
+    m_width = width;
+    m_height = height;
+    m_channels = channels;
+    // No value-initialization, the loader writes every byte anyway
+    m_pixels.reset(new unsigned char[GetSize()]);
+}
+
+void Image::Release(){
+    m_width = 0;
+    m_height = 0;
+    m_channels = 0;
+    m_pixels.reset();
+}
+
+bool Image::IsEmpty() const{
+    return m_pixels == nullptr;
+}
+
+int Image::GetWidth() const{
+    return m_width;
+}
+
+int Image::GetHeight() const{
+    return m_height;
+}
+
+int Image::GetChannels() const{
+    return m_channels;
+}
+
+std::size_t Image::GetSize() const{
+    return (std::size_t)m_width * m_height * m_channels;
+}
+
+unsigned char* Image::GetPixels(){
+    return m_pixels.get();
+}
+
+const unsigned char* Image::GetPixels() const{
+    return m_pixels.get();
+}
+
+static inline bool IsSpace(unsigned char c){
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+// Skips whitespace and comments, which run from # to the end of the line
+static inline void SkipSeparators(const unsigned char*& at, const unsigned char* end){
+    while (at < end) {
+        if (IsSpace(*at)) {
+            ++at;
+        } else if (*at == '#') {
+            while (at < end && *at != '\n') {
+                ++at;
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+// Reads the next decimal number. False if there is none.
+static inline bool ReadNumber(const unsigned char*& at, const unsigned char* end, unsigned int& value){
+    SkipSeparators(at, end);
+    if (at == end || (unsigned)(*at - '0') > 9) {
+        return false;
+    }
+    unsigned int number = 0;
+    // Values beyond 65535 are invalid anyway, stop them before they wrap
+    while (at < end && (unsigned)(*at - '0') <= 9 && number <= 0xFFFFFF) {
+        number = number * 10 + (*at - '0');
+        ++at;
+    }
+    value = number;
+    return true;
+}
+
+bool LoadPPMImage(const std::string& path, bool flip, Image& image){
+    image.Release();
+    MappedFile file;
+    if (!file.Open(path)) {
+        std::cout << "Unable to open ppm file: " << path << std::endl;
+        return false;
+    }
+    const unsigned char* at = file.GetData();
+    const unsigned char* end = at + file.GetSize();
+
+    if (end - at < 2 || at[0] != 'P' || (at[1] != '3' && at[1] != '5' && at[1] != '6')) {
+        std::cout << path << " is not a P3, P5 or P6 image" << std::endl;
+        return false;
+    }
+    char format = (char)at[1];
+    at += 2;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int maximum = 0;
+    if (!ReadNumber(at, end, width) || !ReadNumber(at, end, height) || !ReadNumber(at, end, maximum)
+        || width == 0 || height == 0 || width > 65535 || height > 65535 || maximum == 0 || maximum > 65535) {
+        std::cout << path << ": bad header, expected width, height and a maximum value up to 65535" << std::endl;
+        return false;
+    }
+    int channels = format == '5' ? 1 : 3;
+    std::size_t pixelCount = (std::size_t)width * height;
+    std::size_t sampleCount = pixelCount * channels;
+
+    // Samples to 8 bits, only needed if they are not already
+    std::vector<unsigned char> toByte;
+    if (maximum != 255) {
+        toByte.resize(maximum + 1);
+        for (unsigned int value = 0; value <= maximum; ++value) {
+            toByte[value] = (unsigned char)((value * 255u + maximum / 2) / maximum);
+        }
+    }
+
+    if (format != '3') {
+        // Exactly one whitespace character separates header and samples
+        if (at == end || !IsSpace(*at)) {
+            std::cout << path << ": bad header, no whitespace before the samples" << std::endl;
+            return false;
+        }
+        ++at;
+        std::size_t sampleBytes = maximum > 255 ? 2 : 1;
+        if ((std::size_t)(end - at) < sampleCount * sampleBytes) {
+            std::cout << path << ": truncated, expected " << sampleCount * sampleBytes << " bytes of samples" << std::endl;
+            return false;
+        }
+    }
+
+    image.Allocate((int)width, (int)height, channels);
+    unsigned char* pixels = image.GetPixels();
+    if (format == '3') {
+        for (std::size_t p = 0; p < pixelCount; ++p) {
+            unsigned char* destination = pixels + (flip ? pixelCount - 1 - p : p) * channels;
+            for (int c = 0; c < channels; ++c) {
+                unsigned int value = 0;
+                if (!ReadNumber(at, end, value) || value > maximum) {
+                    std::cout << path << ": missing or bad sample at pixel " << p << std::endl;
+                    image.Release();
+                    return false;
+                }
+                destination[c] = toByte.empty() ? (unsigned char)value : toByte[value];
+            }
+        }
+    } else if (maximum > 255) {
+        // 16 bit samples, most significant byte first
+        for (std::size_t p = 0; p < pixelCount; ++p) {
+            unsigned char* destination = pixels + (flip ? pixelCount - 1 - p : p) * channels;
+            for (int c = 0; c < channels; ++c, at += 2) {
+                unsigned int value = ((unsigned int)at[0] << 8) | at[1];
+                destination[c] = toByte[value > maximum ? maximum : value];
+            }
+        }
+    } else if (!flip && toByte.empty()) {
+        memcpy(pixels, at, sampleCount);
+    } else if (toByte.empty() && channels == 3) {
+        // Flipped RGB, the common case, with the pixel size known
+        unsigned char* destination = pixels + sampleCount;
+        for (std::size_t p = 0; p < pixelCount; ++p, at += 3) {
+            destination -= 3;
+            destination[0] = at[0];
+            destination[1] = at[1];
+            destination[2] = at[2];
+        }
+    } else {
+        for (std::size_t p = 0; p < pixelCount; ++p, at += channels) {
+            unsigned char* destination = pixels + (flip ? pixelCount - 1 - p : p) * channels;
+            for (int c = 0; c < channels; ++c) {
+                unsigned int value = at[c];
+                destination[c] = toByte.empty() ? (unsigned char)value : toByte[value > maximum ? maximum : value];
+            }
+        }
+    }
+    return true;
+}
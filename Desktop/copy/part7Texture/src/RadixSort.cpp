@@ -0,0 +1,69 @@
+/** @file RadixSort.cpp
+ */
+
+#include "RadixSort.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+
+static const int kRadixBits = 8;
+static const std::size_t kRadix = 1 << kRadixBits;
+// Keys per block at least, 4 per digit so counting a block costs
+// more than the prefix sum over its digits
+static const std::size_t kMinimumBlock = 4 * kRadix;
+
+void RadixSortByKey(std::vector<std::uint32_t>& keys, std::vector<std::uint32_t>& values, int keyBits){
+    std::size_t blockCount = std::min<std::size_t>(GetWorkerCount(), keys.size() / kMinimumBlock);
+    RadixSortByKeyInBlocks(keys, values, keyBits, blockCount);
+}
+
+void RadixSortByKeyInBlocks(std::vector<std::uint32_t>& keys, std::vector<std::uint32_t>& values, int keyBits,
+                            std::size_t blockCount){
+    std::size_t count = keys.size();
+    if (count < 2) {
+        return;
+    }
+    std::vector<std::uint32_t> keysOut(count);
+    std::vector<std::uint32_t> valuesOut(count);
+    blockCount = std::max<std::size_t>(1, std::min(blockCount, count));
+    std::size_t blockSize = (count + blockCount - 1) / blockCount;
+    // Where block b writes its next key with digit d: offsets[b * kRadix + d]
+    std::vector<std::size_t> offsets(blockCount * kRadix);
+
+    for (int shift = 0; shift < keyBits; shift += kRadixBits) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        ParallelFor(blockCount, [&](std::size_t firstBlock, std::size_t lastBlock) {
+            for (std::size_t b = firstBlock; b < lastBlock; ++b) {
+                std::size_t* counts = &offsets[b * kRadix];
+                std::size_t end = std::min(count, (b + 1) * blockSize);
+                for (std::size_t i = b * blockSize; i < end; ++i) {
+                    counts[(keys[i] >> shift) & (kRadix - 1)]++;
+                }
+            }
+        }, 1);
+
+        // Digit-major, so lower blocks come first within every digit
+        std::size_t sum = 0;
+        for (std::size_t digit = 0; digit < kRadix; ++digit) {
+            for (std::size_t b = 0; b < blockCount; ++b) {
+                std::size_t digitCount = offsets[b * kRadix + digit];
+                offsets[b * kRadix + digit] = sum;
+                sum += digitCount;
+            }
+        }
+
+        ParallelFor(blockCount, [&](std::size_t firstBlock, std::size_t lastBlock) {
+            for (std::size_t b = firstBlock; b < lastBlock; ++b) {
+                std::size_t* next = &offsets[b * kRadix];
+                std::size_t end = std::min(count, (b + 1) * blockSize);
+                for (std::size_t i = b * blockSize; i < end; ++i) {
+                    std::size_t position = next[(keys[i] >> shift) & (kRadix - 1)]++;
+                    keysOut[position] = keys[i];
+                    valuesOut[position] = values[i];
+                }
+            }
+        }, 1);
+        keys.swap(keysOut);
+        values.swap(valuesOut);
+    }
+}
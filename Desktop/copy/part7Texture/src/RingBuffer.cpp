@@ -0,0 +1,156 @@
+/** @file RingBuffer.cpp
+ */
+
+#include "RingBuffer.hpp"
+#include "GLStateCache.hpp"
+#include <algorithm>
+#include <chrono>
+
+// Smallest slot alignment, more than vertex attributes need and what
+// most implementations ask of uniform buffer and SSBO offsets
+static const GLsizeiptr kSlotAlignment = 256;
+// GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, glad here predates it
+static const GLenum kShaderStorageBufferOffsetAlignment = 0x90DF;
+// How long a single wait blocks before it is retried
+static const GLuint64 kWaitTimeoutNs = 1000000;
+
+RingBuffer::RingBuffer()
+    : m_target(GL_ARRAY_BUFFER), m_buffer(0), m_frameSize(0), m_slotStride(0),
+      m_frameCount(0), m_current(0), m_persistentData(nullptr), m_mapped(false){
+}
+
+RingBuffer::~RingBuffer(){
+    // GL objects are released in Destroy() while the context is alive
+}
+
+// Alignment the implementation requires of offsets bound to target
+// with glBindBufferRange, at least kSlotAlignment
+static GLsizeiptr GetSlotAlignment(GLenum target){
+    GLint alignment = 0;
+    if (target == GL_UNIFORM_BUFFER) {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    } else if (target == GL_SHADER_STORAGE_BUFFER && GLAD_GL_VERSION_4_3) {
+        glGetIntegerv(kShaderStorageBufferOffsetAlignment, &alignment);
+    }
+    return std::max<GLsizeiptr>(kSlotAlignment, alignment);
+}
+
+bool RingBuffer::Initialize(GLenum target, GLsizeiptr frameSize, int frameCount){
+    if (frameSize <= 0 || frameCount <= 0) {
+        return false;
+    }
+    m_target = target;
+    m_frameSize = frameSize;
+    GLsizeiptr alignment = GetSlotAlignment(target);
+    m_slotStride = (frameSize + alignment - 1) / alignment * alignment;
+    m_frameCount = frameCount;
+    m_current = 0;
+    m_fences.assign(frameCount, nullptr);
+    m_stats = RingBufferStats();
+
+    GLsizeiptr size = m_slotStride * frameCount;
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(m_target, m_buffer);
+    if (GLAD_GL_VERSION_4_4 && glBufferStorage != nullptr) {
+        // Immutable storage can stay mapped while the GPU reads it
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(m_target, size, nullptr, flags);
+        m_persistentData = (unsigned char*)glMapBufferRange(m_target, 0, size, flags);
+        m_stats.persistent = m_persistentData != nullptr;
+        if (!m_stats.persistent) {
+            // Immutable storage cannot be respecified, start over
+            glBindBuffer(m_target, 0);
+            glDeleteBuffers(1, &m_buffer);
+            glGenBuffers(1, &m_buffer);
+            glBindBuffer(m_target, m_buffer);
+        }
+    }
+    if (!m_stats.persistent) {
+        glBufferData(m_target, size, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(m_target, 0);
+    return true;
+}
+
+void RingBuffer::Destroy(){
+    for (GLsync& fence : m_fences) {
+        if (fence != nullptr) {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, kWaitTimeoutNs);
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (m_buffer != 0 && (m_persistentData != nullptr || m_mapped)) {
+        glBindBuffer(m_target, m_buffer);
+        glUnmapBuffer(m_target);
+        glBindBuffer(m_target, 0);
+    }
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+    m_persistentData = nullptr;
+    m_mapped = false;
+}
+
+bool RingBuffer::IsInitialized() const{
+    return m_buffer != 0;
+}
+
+void* RingBuffer::BeginWrite(){
+    GLsync& fence = m_fences[m_current];
+    if (fence != nullptr) {
+        // Poll first, only a slot still in flight counts as a stall
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            auto start = std::chrono::steady_clock::now();
+            do {
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, kWaitTimeoutNs);
+            } while (status == GL_TIMEOUT_EXPIRED);
+            m_stats.stalls++;
+            m_stats.stallTimeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    GLintptr offset = GetWriteOffset();
+    if (m_persistentData != nullptr) {
+        return m_persistentData + offset;
+    }
+    // The fence above already guarantees the GPU is done with the slot
+    GLStateCache::Instance().BindBuffer(m_target, m_buffer);
+    void* data = glMapBufferRange(m_target, offset, m_frameSize,
+                                  GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    m_mapped = data != nullptr;
+    return data;
+}
+
+void RingBuffer::EndWrite(){
+    // Coherent persistent maps need neither an unmap nor a flush
+    if (m_mapped) {
+        GLStateCache::Instance().BindBuffer(m_target, m_buffer);
+        glUnmapBuffer(m_target);
+        m_mapped = false;
+    }
+}
+
+void RingBuffer::FinishFrame(){
+    m_fences[m_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_current = (m_current + 1) % m_frameCount;
+    m_stats.frames++;
+}
+
+GLuint RingBuffer::GetBuffer() const{
+    return m_buffer;
+}
+
+GLintptr RingBuffer::GetWriteOffset() const{
+    return (GLintptr)m_current * m_slotStride;
+}
+
+GLsizeiptr RingBuffer::GetFrameSize() const{
+    return m_frameSize;
+}
+
+RingBufferStats RingBuffer::GetStats() const{
+    return m_stats;
+}
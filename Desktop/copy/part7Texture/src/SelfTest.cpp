@@ -0,0 +1,129 @@
+/** @file SelfTest.cpp
+ */
+
+#include "SelfTest.hpp"
+#include "InstanceChunks.hpp"
+#include "InstanceGenerator.hpp"
+#include "RadixSort.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include "glm/glm.hpp"
+
+// Sorts random keys in 1 to 16 blocks and compares with a stable
+// std::sort. Few distinct keys, so most of them repeat and a block
+// that lost its order would show.
+static bool CheckRadixSort(){
+    const std::size_t counts[] = {0, 1, 2, 3, 255, 1000, 5000, 70000};
+    const int keyBits[] = {8, 12, 32};
+    const std::size_t blockCounts[] = {1, 2, 3, 7, 16};
+    std::mt19937 random(1);
+    int cases = 0;
+    int failures = 0;
+    for (std::size_t count : counts) {
+        for (int bits : keyBits) {
+            std::uniform_int_distribution<std::uint32_t> key(0, std::min<std::uint32_t>(999, (std::uint32_t)((1ull << bits) - 1)));
+            std::vector<std::uint32_t> keys(count);
+            for (std::uint32_t& k : keys) {
+                k = key(random);
+                if (bits == 32) {
+                    // Digits in every pass
+                    k *= 4294967u;
+                }
+            }
+            std::vector<std::uint32_t> expected(count);
+            for (std::size_t i = 0; i < count; ++i) {
+                expected[i] = (std::uint32_t)i;
+            }
+            std::stable_sort(expected.begin(), expected.end(), [&](std::uint32_t a, std::uint32_t b) {
+                return keys[a] < keys[b];
+            });
+            for (std::size_t blocks : blockCounts) {
+                std::vector<std::uint32_t> sortedKeys = keys;
+                std::vector<std::uint32_t> values(count);
+                for (std::size_t i = 0; i < count; ++i) {
+                    values[i] = (std::uint32_t)i;
+                }
+                RadixSortByKeyInBlocks(sortedKeys, values, bits, blocks);
+                ++cases;
+                if (values != expected) {
+                    ++failures;
+                    std::cout << "Self test: radix sort of " << count << " " << bits << " bit keys in " << blocks
+                              << " blocks is not the stable order" << std::endl;
+                }
+            }
+        }
+    }
+    std::cout << "Self test: radix sort, " << cases << " cases, " << failures << " failed" << std::endl;
+    return failures == 0;
+}
+
+// Walks the lattice brick by brick with plain loops and compares every
+// point with GetBrickInstancePosition(), which vert.glsl's
+// DecodeOffset() mirrors, and with the chunk BuildGridChunks() puts it
+// in. Lattices of 7 and 10 points per axis leave partial bricks.
+static bool CheckBrickOrder(){
+    const int starts[] = {-3, 0, -15};
+    const int ends[] = {4, 10, 15};
+    const int brickSizes[] = {1, 3, 4, 7, 16};
+    int cases = 0;
+    int failures = 0;
+    for (int dimensions = 1; dimensions <= 3; ++dimensions) {
+        for (int range = 0; range < 3; ++range) {
+            for (int brickCells : brickSizes) {
+                InstanceGrid grid;
+                grid.start = starts[range];
+                grid.end = ends[range];
+                grid.spacing = 2.5f;
+                grid.dimensions = dimensions;
+                const int cells = grid.GetCellsPerAxis();
+                std::vector<InstanceChunk> chunks = BuildGridChunks(grid, brickCells, 0.0f);
+                // Unused axes hold a single point at 0
+                int used[3] = {cells, dimensions > 1 ? cells : 1, dimensions > 2 ? cells : 1};
+                long long index = 0;
+                std::size_t chunk = 0;
+                bool passed = true;
+                for (int bx = 0; bx < used[0]; bx += brickCells) {
+                    for (int by = 0; by < used[1]; by += brickCells) {
+                        for (int bz = 0; bz < used[2]; bz += brickCells) {
+                            passed = passed && chunk < chunks.size() && chunks[chunk].firstInstance == index;
+                            for (int x = bx; x < std::min(bx + brickCells, used[0]); ++x) {
+                                for (int y = by; y < std::min(by + brickCells, used[1]); ++y) {
+                                    for (int z = bz; z < std::min(bz + brickCells, used[2]); ++z) {
+                                        glm::vec3 expected((float)(grid.start + x) * grid.spacing,
+                                                           dimensions > 1 ? (float)(grid.start + y) * grid.spacing : 0.0f,
+                                                           dimensions > 2 ? (float)(grid.start + z) * grid.spacing : 0.0f);
+                                        glm::vec3 decoded = GetBrickInstancePosition(grid, brickCells, index++);
+                                        passed = passed && decoded == expected && chunk < chunks.size() &&
+                                                 glm::all(glm::greaterThanEqual(decoded, chunks[chunk].boundsMin)) &&
+                                                 glm::all(glm::lessThanEqual(decoded, chunks[chunk].boundsMax));
+                                    }
+                                }
+                            }
+                            passed = passed && chunk < chunks.size() &&
+                                     index == (long long)chunks[chunk].firstInstance + chunks[chunk].instanceCount;
+                            ++chunk;
+                        }
+                    }
+                }
+                passed = passed && chunk == chunks.size() && index == grid.GetNumberOfInstances();
+                ++cases;
+                if (!passed) {
+                    ++failures;
+                    std::cout << "Self test: brick order of a " << dimensions << "D lattice of " << cells
+                              << " points per axis in bricks of " << brickCells << " does not match" << std::endl;
+                }
+            }
+        }
+    }
+    std::cout << "Self test: brick order, " << cases << " cases, " << failures << " failed" << std::endl;
+    return failures == 0;
+}
+
+bool RunSelfTests(){
+    bool passed = CheckRadixSort();
+    passed = CheckBrickOrder() && passed;
+    std::cout << "Self test: " << (passed ? "passed" : "FAILED") << std::endl;
+    return passed;
+}
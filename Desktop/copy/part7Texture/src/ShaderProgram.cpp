@@ -0,0 +1,180 @@
+/** @file ShaderProgram.cpp
+ */
+
+#include "ShaderProgram.hpp"
+#include "GLStateCache.hpp"
+
+#include <cstring>
+#include "glm/gtc/type_ptr.hpp"
+
+// Reflected names can have a [0] suffix for arrays, strip it so
+// they are found by their plain name
+static std::string StripArraySuffix(const std::string& name){
+    std::size_t bracket = name.find('[');
+    return bracket == std::string::npos ? name : name.substr(0, bracket);
+}
+
+ShaderProgram::ShaderProgram()
+    : m_program(0){
+}
+
+ShaderProgram::~ShaderProgram(){
+    // The program is deleted in Destroy() while the context is alive
+}
+
+void ShaderProgram::Attach(GLuint program){
+    m_program = program;
+    m_uniforms.clear();
+    m_uniformIndices.clear();
+    m_attributes.clear();
+    m_frameStats = UniformUploadStats();
+    m_lastFrameStats = UniformUploadStats();
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &linked);
+    if (linked == GL_FALSE) {
+        return;
+    }
+
+    GLint count = 0;
+    GLint maxLength = 0;
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<char> name(maxLength + 1);
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(m_program, i, (GLsizei)name.size(), &length, &size, &type, name.data());
+        GLint location = glGetUniformLocation(m_program, name.data());
+        // Members of uniform blocks have no location of their own
+        if (location >= 0) {
+            m_uniformIndices[StripArraySuffix(std::string(name.data(), length))] = (int)m_uniforms.size();
+            m_uniforms.push_back(Uniform{location, {}});
+        }
+    }
+
+    glGetProgramiv(m_program, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(m_program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+    name.assign(maxLength + 1, '\0');
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveAttrib(m_program, i, (GLsizei)name.size(), &length, &size, &type, name.data());
+        m_attributes[std::string(name.data(), length)] = glGetAttribLocation(m_program, name.data());
+    }
+}
+
+void ShaderProgram::Destroy(){
+    glDeleteProgram(m_program);
+    m_program = 0;
+    m_uniforms.clear();
+    m_uniformIndices.clear();
+    m_attributes.clear();
+}
+
+GLuint ShaderProgram::GetID() const{
+    return m_program;
+}
+
+void ShaderProgram::Use() const{
+    GLStateCache::Instance().UseProgram(m_program);
+}
+
+int ShaderProgram::GetUniformCount() const{
+    return (int)m_uniforms.size();
+}
+
+int ShaderProgram::GetAttributeCount() const{
+    return (int)m_attributes.size();
+}
+
+GLint ShaderProgram::GetUniformLocation(const std::string& name) const{
+    UniformHandle handle = FindUniform(name);
+    return handle.index < 0 ? -1 : m_uniforms[handle.index].location;
+}
+
+GLint ShaderProgram::GetAttributeLocation(const std::string& name) const{
+    auto found = m_attributes.find(name);
+    return found == m_attributes.end() ? -1 : found->second;
+}
+
+UniformHandle ShaderProgram::FindUniform(const std::string& name) const{
+    UniformHandle handle;
+    auto found = m_uniformIndices.find(name);
+    if (found != m_uniformIndices.end()) {
+        handle.index = found->second;
+    }
+    return handle;
+}
+
+ShaderProgram::Uniform* ShaderProgram::Record(UniformHandle handle, const void* value, std::size_t size){
+    if (handle.index < 0 || handle.index >= (int)m_uniforms.size()) {
+        m_frameStats.inactive++;
+        return nullptr;
+    }
+    Uniform& uniform = m_uniforms[handle.index];
+    if (uniform.value.size() == size && std::memcmp(uniform.value.data(), value, size) == 0) {
+        m_frameStats.skipped++;
+        return nullptr;
+    }
+    uniform.value.assign((const unsigned char*)value, (const unsigned char*)value + size);
+    m_frameStats.uploads++;
+    return &uniform;
+}
+
+void ShaderProgram::SetUniform(UniformHandle handle, GLint value){
+    if (Uniform* uniform = Record(handle, &value, sizeof(value))) {
+        glUniform1i(uniform->location, value);
+    }
+}
+
+void ShaderProgram::SetUniform(UniformHandle handle, bool value){
+    SetUniform(handle, (GLint)value);
+}
+
+void ShaderProgram::SetUniform(UniformHandle handle, GLfloat value){
+    if (Uniform* uniform = Record(handle, &value, sizeof(value))) {
+        glUniform1f(uniform->location, value);
+    }
+}
+
+void ShaderProgram::SetUniform(UniformHandle handle, const glm::vec2& value){
+    if (Uniform* uniform = Record(handle, glm::value_ptr(value), sizeof(value))) {
+        glUniform2fv(uniform->location, 1, glm::value_ptr(value));
+    }
+}
+
+void ShaderProgram::SetUniform(UniformHandle handle, const glm::vec3& value){
+    if (Uniform* uniform = Record(handle, glm::value_ptr(value), sizeof(value))) {
+        glUniform3fv(uniform->location, 1, glm::value_ptr(value));
+    }
+}
+
+void ShaderProgram::SetUniform(UniformHandle handle, const glm::vec4& value){
+    if (Uniform* uniform = Record(handle, glm::value_ptr(value), sizeof(value))) {
+        glUniform4fv(uniform->location, 1, glm::value_ptr(value));
+    }
+}
+
+void ShaderProgram::SetUniform(UniformHandle handle, const glm::mat4& value){
+    if (Uniform* uniform = Record(handle, glm::value_ptr(value), sizeof(value))) {
+        glUniformMatrix4fv(uniform->location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+}
+
+void ShaderProgram::SetUniform(UniformHandle handle, const glm::vec4* values, GLsizei count){
+    if (Uniform* uniform = Record(handle, values, sizeof(glm::vec4) * count)) {
+        glUniform4fv(uniform->location, count, glm::value_ptr(values[0]));
+    }
+}
+
+void ShaderProgram::BeginFrame(){
+    m_lastFrameStats = m_frameStats;
+    m_frameStats = UniformUploadStats();
+}
+
+UniformUploadStats ShaderProgram::GetLastFrameStats() const{
+    return m_lastFrameStats;
+}
@@ -0,0 +1,272 @@
+/** @file TextureCache.cpp
+ */
+
+#include "TextureCache.hpp"
+#include "MipChain.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#if defined(_WIN32)
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+static const char kMagic[8] = {'T', 'E', 'X', 'C', 'A', 'C', 'H', 'E'};
+static const std::uint32_t kVersion = 2;
+// Reads back differently on a machine of the other byte order
+static const std::uint32_t kByteOrderMark = 0x01020304;
+static const std::uint64_t kLevelAlignment = 64;
+
+struct CacheHeader{
+    char magic[8];
+    std::uint32_t byteOrder;
+    std::uint32_t version;
+    std::uint64_t sourceSize;
+    std::int64_t sourceModifiedNs;
+    std::uint32_t flip;
+    // MipFilter the levels were made with
+    std::uint32_t mipFilter;
+    std::uint32_t channels;
+    std::uint32_t levelCount;
+    // Bytes of the source path right after the header
+    std::uint32_t pathLength;
+};
+
+struct CacheLevel{
+    std::uint32_t width;
+    std::uint32_t height;
+    // From the start of the file
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+int CachedTexture::GetChannels() const{
+    return m_channels;
+}
+
+int CachedTexture::GetLevelCount() const{
+    return (int)m_levels.size();
+}
+
+const TextureLevel& CachedTexture::GetLevel(int level) const{
+    return m_levels[level];
+}
+
+bool CachedTexture::IsFromCache() const{
+    return m_fromCache;
+}
+
+void CachedTexture::Clear(){
+    m_channels = 0;
+    m_fromCache = false;
+    m_levels.clear();
+    m_file.Close();
+    m_images.clear();
+}
+
+TextureCache::TextureCache()
+    : m_directory("texture_cache"), m_enabled(true), m_mipFilter(MipFilter::Box){
+}
+
+void TextureCache::SetDirectory(const std::string& directory){
+    m_directory = directory;
+}
+
+void TextureCache::SetEnabled(bool enabled){
+    m_enabled = enabled;
+}
+
+bool TextureCache::IsEnabled() const{
+    return m_enabled;
+}
+
+void TextureCache::SetMipFilter(MipFilter filter){
+    m_mipFilter = filter;
+}
+
+TextureCacheStats TextureCache::GetStats() const{
+    return m_stats;
+}
+
+std::string TextureCache::GetCachePath(const std::string& source, bool flip) const{
+    // 64 bit FNV-1a of the path tells apart sources of the same name
+    std::uint64_t hash = 14695981039346656037ull;
+    for (char c : source) {
+        hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+    }
+    std::size_t slash = source.find_last_of("/\\");
+    std::string name = slash == std::string::npos ? source : source.substr(slash + 1);
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), "-%016llx%s%s.texcache", (unsigned long long)hash, flip ? "-flip" : "",
+             m_mipFilter == MipFilter::Box ? "" : "-kaiser");
+    return m_directory + "/" + name + suffix;
+}
+
+bool TextureCache::Load(const std::string& source, bool flip, CachedTexture& texture){
+    auto start = std::chrono::steady_clock::now();
+    texture.Clear();
+    std::uint64_t sourceSize = 0;
+    std::int64_t sourceModifiedNs = 0;
+    bool stamped = GetFileStamp(source, sourceSize, sourceModifiedNs);
+    std::string cachePath = GetCachePath(source, flip);
+    if (m_enabled && stamped && MapCacheFile(cachePath, source, flip, sourceSize, sourceModifiedNs, texture)) {
+        m_stats.hits++;
+        m_stats.lastLoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        m_stats.totalLoadMs += m_stats.lastLoadMs;
+        return true;
+    }
+
+    Image base;
+    if (!LoadPPMImage(source, flip, base)) {
+        return false;
+    }
+    texture.m_channels = base.GetChannels();
+    std::vector<Image> levels;
+    BuildMipChain(base, levels, m_mipFilter);
+    texture.m_images.push_back(std::move(base));
+    for (Image& level : levels) {
+        texture.m_images.push_back(std::move(level));
+    }
+    for (const Image& image : texture.m_images) {
+        TextureLevel level;
+        level.width = image.GetWidth();
+        level.height = image.GetHeight();
+        level.pixels = image.GetPixels();
+        level.size = image.GetSize();
+        texture.m_levels.push_back(level);
+    }
+    if (m_enabled) {
+        m_stats.misses++;
+        if (!stamped || !WriteCacheFile(cachePath, source, flip, sourceSize, sourceModifiedNs, texture)) {
+            m_stats.writeFailures++;
+        }
+    }
+    m_stats.lastLoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    m_stats.totalLoadMs += m_stats.lastLoadMs;
+    return true;
+}
+
+bool TextureCache::MapCacheFile(const std::string& path, const std::string& source, bool flip,
+                                std::uint64_t sourceSize, std::int64_t sourceModifiedNs,
+                                CachedTexture& texture) const{
+    if (!texture.m_file.Open(path)) {
+        return false;
+    }
+    const unsigned char* data = texture.m_file.GetData();
+    std::uint64_t fileSize = texture.m_file.GetSize();
+    CacheHeader header;
+    bool valid = fileSize >= sizeof(header);
+    if (valid) {
+        memcpy(&header, data, sizeof(header));
+        valid = memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 && header.byteOrder == kByteOrderMark
+                && header.version == kVersion && header.sourceSize == sourceSize
+                && header.sourceModifiedNs == sourceModifiedNs && header.flip == (flip ? 1u : 0u)
+                && header.mipFilter == (std::uint32_t)m_mipFilter
+                && (header.channels == 1 || header.channels == 3)
+                && header.levelCount >= 1 && header.levelCount <= 32
+                && header.pathLength == source.size()
+                && sizeof(header) + header.pathLength + header.levelCount * sizeof(CacheLevel) <= fileSize
+                && memcmp(data + sizeof(header), source.data(), source.size()) == 0;
+    }
+    const unsigned char* table = data + sizeof(header) + (valid ? header.pathLength : 0);
+    for (std::uint32_t i = 0; valid && i < header.levelCount; ++i) {
+        CacheLevel entry;
+        memcpy(&entry, table + i * sizeof(CacheLevel), sizeof(entry));
+        // Every level has to be the half of the one above it
+        const TextureLevel* above = i == 0 ? nullptr : &texture.m_levels.back();
+        valid = entry.width >= 1 && entry.height >= 1 && entry.width <= 65535 && entry.height <= 65535
+                && (above == nullptr || (entry.width == (std::uint32_t)std::max(1, above->width / 2)
+                                         && entry.height == (std::uint32_t)std::max(1, above->height / 2)))
+                && entry.size == (std::uint64_t)entry.width * entry.height * header.channels
+                && entry.offset % kLevelAlignment == 0
+                && entry.offset <= fileSize && entry.size <= fileSize - entry.offset;
+        if (valid) {
+            TextureLevel level;
+            level.width = (int)entry.width;
+            level.height = (int)entry.height;
+            level.pixels = data + entry.offset;
+            level.size = (std::size_t)entry.size;
+            texture.m_levels.push_back(level);
+        }
+    }
+    valid = valid && (int)header.levelCount == GetMipLevelCount(texture.m_levels[0].width, texture.m_levels[0].height);
+    if (!valid) {
+        texture.Clear();
+        return false;
+    }
+    texture.m_channels = (int)header.channels;
+    texture.m_fromCache = true;
+    return true;
+}
+
+bool TextureCache::WriteCacheFile(const std::string& path, const std::string& source, bool flip,
+                                  std::uint64_t sourceSize, std::int64_t sourceModifiedNs,
+                                  const CachedTexture& texture) const{
+#if defined(_WIN32)
+    _mkdir(m_directory.c_str());
+#else
+    mkdir(m_directory.c_str(), 0755);
+#endif
+    CacheHeader header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.byteOrder = kByteOrderMark;
+    header.version = kVersion;
+    header.sourceSize = sourceSize;
+    header.sourceModifiedNs = sourceModifiedNs;
+    header.flip = flip ? 1 : 0;
+    header.mipFilter = (std::uint32_t)m_mipFilter;
+    header.channels = (std::uint32_t)texture.GetChannels();
+    header.levelCount = (std::uint32_t)texture.GetLevelCount();
+    header.pathLength = (std::uint32_t)source.size();
+
+    std::vector<CacheLevel> entries(header.levelCount);
+    std::uint64_t offset = sizeof(header) + header.pathLength + header.levelCount * sizeof(CacheLevel);
+    for (std::uint32_t i = 0; i < header.levelCount; ++i) {
+        const TextureLevel& level = texture.GetLevel((int)i);
+        offset = (offset + kLevelAlignment - 1) / kLevelAlignment * kLevelAlignment;
+        entries[i].width = (std::uint32_t)level.width;
+        entries[i].height = (std::uint32_t)level.height;
+        entries[i].offset = offset;
+        entries[i].size = level.size;
+        offset += level.size;
+    }
+
+    // Written next to the final name and renamed once complete, so a
+    // crash or a second instance never leaves half a file to be mapped
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write((const char*)&header, sizeof(header));
+        file.write(source.data(), source.size());
+        file.write((const char*)entries.data(), entries.size() * sizeof(CacheLevel));
+        std::uint64_t written = sizeof(header) + header.pathLength + header.levelCount * sizeof(CacheLevel);
+        const char padding[kLevelAlignment] = {0};
+        for (std::uint32_t i = 0; i < header.levelCount; ++i) {
+            file.write(padding, (std::streamsize)(entries[i].offset - written));
+            file.write((const char*)texture.GetLevel((int)i).pixels, (std::streamsize)entries[i].size);
+            written = entries[i].offset + entries[i].size;
+        }
+        if (!file.good()) {
+            file.close();
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+#if defined(_WIN32)
+    // rename does not replace an existing file on Windows
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,88 @@
+/** @file TextureSampling.cpp
+ */
+
+#include "TextureSampling.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// Same values for the EXT, ARB and GL 4.6 names, glad here predates them
+static const GLenum kTextureMaxAnisotropy = 0x84FE;
+static const GLenum kMaxTextureMaxAnisotropy = 0x84FF;
+
+bool ParseMipGeneration(const std::string& name, MipGeneration& generation){
+    for (int i = 0; i <= (int)MipGeneration::Gpu; ++i) {
+        if (name == GetMipGenerationName((MipGeneration)i)) {
+            generation = (MipGeneration)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetMipGenerationName(MipGeneration generation){
+    switch (generation) {
+        case MipGeneration::None: return "none";
+        case MipGeneration::Cpu: return "cpu";
+        case MipGeneration::Gpu: return "gpu";
+    }
+    return "unknown";
+}
+
+bool ParseTextureFilter(const std::string& name, TextureFilter& filter){
+    for (int i = 0; i <= (int)TextureFilter::Trilinear; ++i) {
+        if (name == GetTextureFilterName((TextureFilter)i)) {
+            filter = (TextureFilter)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetTextureFilterName(TextureFilter filter){
+    switch (filter) {
+        case TextureFilter::Linear: return "linear";
+        case TextureFilter::Bilinear: return "bilinear";
+        case TextureFilter::Trilinear: return "trilinear";
+    }
+    return "unknown";
+}
+
+float GetMaxTextureAnisotropy(){
+    GLint major = 0;
+    GLint minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool supported = major > 4 || (major == 4 && minor >= 6);
+    GLint extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (GLint i = 0; i < extensions && !supported; ++i) {
+        const char* name = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        supported = name != nullptr && (strcmp(name, "GL_EXT_texture_filter_anisotropic") == 0
+                                        || strcmp(name, "GL_ARB_texture_filter_anisotropic") == 0);
+    }
+    if (!supported) {
+        return 1.0f;
+    }
+    GLfloat maximum = 1.0f;
+    glGetFloatv(kMaxTextureMaxAnisotropy, &maximum);
+    return std::max(1.0f, maximum);
+}
+
+float ApplyTextureSampling(const TextureSampling& sampling){
+    GLint minFilter = GL_LINEAR_MIPMAP_LINEAR;
+    if (sampling.filter == TextureFilter::Linear) {
+        minFilter = GL_LINEAR;
+    } else if (sampling.filter == TextureFilter::Bilinear) {
+        minFilter = GL_LINEAR_MIPMAP_NEAREST;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Looked up once, the context does not change
+    static const float maximum = GetMaxTextureAnisotropy();
+    float anisotropy = std::min(std::max(sampling.anisotropy, 1.0f), maximum);
+    if (maximum > 1.0f) {
+        glTexParameterf(GL_TEXTURE_2D, kTextureMaxAnisotropy, anisotropy);
+    }
+    return anisotropy;
+}
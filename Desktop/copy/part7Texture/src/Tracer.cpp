@@ -0,0 +1,272 @@
+/** @file Tracer.cpp
+ */
+
+#include "Tracer.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+thread_local Tracer::ThreadSlot Tracer::t_slot;
+
+Tracer::ThreadSlot::~ThreadSlot(){
+    if (buffer != nullptr) {
+        Tracer& tracer = Tracer::Instance();
+        std::lock_guard<std::mutex> lock(tracer.m_buffersMutex);
+        tracer.m_freeBuffers.push_back(buffer);
+    }
+}
+
+Tracer& Tracer::Instance(){
+    static Tracer* instance = new Tracer();
+    return *instance;
+}
+
+Tracer::Tracer()
+    : m_recording(false), m_frame(-1), m_written(false), m_firstFrame(0), m_lastFrame(-1),
+      m_epoch(std::chrono::steady_clock::now()), m_gpuInitialized(false), m_gpuOffsetNs(0),
+      m_gpuBuffer(nullptr){
+}
+
+void Tracer::Enable(const std::string& path, int firstFrame, int lastFrame){
+    m_path = path;
+    m_firstFrame = firstFrame;
+    m_lastFrame = lastFrame;
+    m_written = false;
+    m_epoch = std::chrono::steady_clock::now();
+    m_recording.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::InitializeGpu(){
+    if (m_path.empty() || m_gpuInitialized) {
+        return;
+    }
+    // GL_TIMESTAMP is read once the commands before it reached the
+    // GPU, so the pipeline is drained first and the CPU clock taken on
+    // both sides of the read
+    glFinish();
+    std::int64_t before = Now();
+    GLint64 gpuNs = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNs);
+    std::int64_t after = Now();
+    m_gpuOffsetNs = (before + after) / 2 - gpuNs;
+    {
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        m_gpuBuffer = CreateBuffer("GPU");
+    }
+    m_gpuInitialized = true;
+}
+
+void Tracer::SetThreadName(const std::string& name){
+    if (m_path.empty()) {
+        return;
+    }
+    ThreadBuffer* buffer = GetThreadBuffer();
+    std::lock_guard<std::mutex> lock(m_buffersMutex);
+    buffer->name = name;
+}
+
+void Tracer::BeginFrame(){
+    if (m_path.empty() || m_written) {
+        return;
+    }
+    int frame = m_frame.load(std::memory_order_relaxed) + 1;
+    m_frame.store(frame, std::memory_order_relaxed);
+    if (frame > m_lastFrame) {
+        Finish();
+        return;
+    }
+    m_recording.store(frame >= m_firstFrame, std::memory_order_relaxed);
+    ResolveGpuScopes(false);
+}
+
+void Tracer::Finish(){
+    if (m_path.empty() || m_written) {
+        return;
+    }
+    m_recording.store(false, std::memory_order_relaxed);
+    ResolveGpuScopes(true);
+    Write();
+    m_written = true;
+    if (!m_freeQueries.empty()) {
+        glDeleteQueries((GLsizei)m_freeQueries.size(), m_freeQueries.data());
+        m_freeQueries.clear();
+    }
+}
+
+std::int64_t Tracer::Now() const{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+}
+
+void Tracer::Record(const char* name, std::int64_t startNs, std::int64_t endNs){
+    Event event;
+    event.name = name;
+    event.startNs = startNs;
+    event.durationNs = endNs - startNs;
+    event.frame = m_frame.load(std::memory_order_relaxed);
+    Append(GetThreadBuffer(), event);
+}
+
+GLuint Tracer::BeginGpuScope(const char* name){
+    if (!m_gpuInitialized) {
+        return 0;
+    }
+    GpuScope scope;
+    scope.name = name;
+    scope.frame = m_frame.load(std::memory_order_relaxed);
+    scope.ended = false;
+    GLuint queries[2];
+    for (GLuint& query : queries) {
+        if (m_freeQueries.empty()) {
+            glGenQueries(1, &query);
+        } else {
+            query = m_freeQueries.back();
+            m_freeQueries.pop_back();
+        }
+    }
+    scope.beginQuery = queries[0];
+    scope.endQuery = queries[1];
+    glQueryCounter(scope.beginQuery, GL_TIMESTAMP);
+    m_gpuScopes.push_back(scope);
+    return scope.beginQuery;
+}
+
+void Tracer::EndGpuScope(GLuint beginQuery){
+    // Scopes end innermost first, the match is near the back
+    for (auto scope = m_gpuScopes.rbegin(); scope != m_gpuScopes.rend(); ++scope) {
+        if (scope->beginQuery == beginQuery && !scope->ended) {
+            glQueryCounter(scope->endQuery, GL_TIMESTAMP);
+            scope->ended = true;
+            return;
+        }
+    }
+}
+
+Tracer::ThreadBuffer* Tracer::GetThreadBuffer(){
+    if (t_slot.buffer != nullptr) {
+        return t_slot.buffer;
+    }
+    std::lock_guard<std::mutex> lock(m_buffersMutex);
+    if (m_freeBuffers.empty()) {
+        t_slot.buffer = CreateBuffer("worker " + std::to_string(m_buffers.size()));
+    } else {
+        t_slot.buffer = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+    }
+    return t_slot.buffer;
+}
+
+// Called with m_buffersMutex held
+Tracer::ThreadBuffer* Tracer::CreateBuffer(const std::string& name){
+    ThreadBuffer* buffer = new ThreadBuffer();
+    // Thread ids start at 1, some viewers hide tid 0
+    buffer->id = (int)m_buffers.size() + 1;
+    buffer->name = name;
+    buffer->head = new Block();
+    buffer->tail = buffer->head;
+    m_buffers.push_back(buffer);
+    return buffer;
+}
+
+void Tracer::Append(ThreadBuffer* buffer, const Event& event){
+    Block* block = buffer->tail;
+    int count = block->count.load(std::memory_order_relaxed);
+    if (count == kBlockEvents) {
+        Block* next = new Block();
+        block->next.store(next, std::memory_order_release);
+        buffer->tail = next;
+        block = next;
+        count = 0;
+    }
+    block->events[count] = event;
+    block->count.store(count + 1, std::memory_order_release);
+}
+
+void Tracer::ResolveGpuScopes(bool wait){
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < m_gpuScopes.size(); ++i) {
+        GpuScope& scope = m_gpuScopes[i];
+        bool done = scope.ended;
+        if (done && !wait) {
+            GLint available = 0;
+            glGetQueryObjectiv(scope.endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            done = available != 0;
+        }
+        if (!done) {
+            m_gpuScopes[kept++] = scope;
+            continue;
+        }
+        GLuint64 beginNs = 0;
+        GLuint64 endNs = 0;
+        glGetQueryObjectui64v(scope.beginQuery, GL_QUERY_RESULT, &beginNs);
+        glGetQueryObjectui64v(scope.endQuery, GL_QUERY_RESULT, &endNs);
+        Event event;
+        event.name = scope.name;
+        event.startNs = (std::int64_t)beginNs + m_gpuOffsetNs;
+        event.durationNs = (std::int64_t)(endNs - beginNs);
+        event.frame = scope.frame;
+        Append(m_gpuBuffer, event);
+        m_freeQueries.push_back(scope.beginQuery);
+        m_freeQueries.push_back(scope.endQuery);
+    }
+    m_gpuScopes.resize(kept);
+}
+
+static void WriteJsonString(std::ofstream& file, const std::string& text){
+    file << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            file << '\\';
+        }
+        file << c;
+    }
+    file << '"';
+}
+
+bool Tracer::Write() const{
+    std::ofstream file(m_path.c_str());
+    if (!file.is_open()) {
+        std::cout << "Could not write " << m_path << std::endl;
+        return false;
+    }
+    std::vector<ThreadBuffer*> buffers;
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        buffers = m_buffers;
+        for (ThreadBuffer* buffer : buffers) {
+            names.push_back(buffer->name);
+        }
+    }
+
+    // Timestamps are in microseconds
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"part7Texture\"}}";
+    long long events = 0;
+    for (std::size_t i = 0; i < buffers.size(); ++i) {
+        file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffers[i]->id << ",\"args\":{\"name\":";
+        WriteJsonString(file, names[i]);
+        file << "}}";
+        file << ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffers[i]->id
+             << ",\"args\":{\"sort_index\":" << buffers[i]->id << "}}";
+        for (Block* block = buffers[i]->head; block != nullptr; block = block->next.load(std::memory_order_acquire)) {
+            int count = block->count.load(std::memory_order_acquire);
+            for (int e = 0; e < count; ++e) {
+                const Event& event = block->events[e];
+                file << ",\n{\"name\":";
+                WriteJsonString(file, event.name);
+                file << ",\"cat\":\"" << (buffers[i] == m_gpuBuffer ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                     << buffers[i]->id << ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0;
+                if (event.frame >= 0) {
+                    file << ",\"args\":{\"frame\":" << event.frame << "}";
+                }
+                file << "}";
+                ++events;
+            }
+        }
+    }
+    file << "\n]}\n";
+    std::cout << "Trace: " << events << " events on " << buffers.size() << " rows written to " << m_path << std::endl;
+    return true;
+}
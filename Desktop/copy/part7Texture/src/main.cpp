@@ -13,9 +13,39 @@
 #include "glm/vec3.hpp"
 #include "glm/mat4x4.hpp"
 #include "glm/glm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
 #include "Camera.hpp"
 #include "Transform.hpp"
+#include "InstanceGenerator.hpp"
+#include "InstanceFormat.hpp"
+#include "InstanceChunks.hpp"
+#include "Frustum.hpp"
+#include "GpuCuller.hpp"
+#include "ChunkStreamer.hpp"
+#include "RingBuffer.hpp"
+#include "InstanceStore.hpp"
+#include "InstanceTransform.hpp"
+#include "ShaderProgram.hpp"
+#include "FrameConstants.hpp"
+#include "GLStateCache.hpp"
+#include "MeshRegistry.hpp"
+#include "OcclusionCuller.hpp"
+#include "HeadlessContext.hpp"
+#include "FrameProfiler.hpp"
+#include "Tracer.hpp"
+#include "CameraPath.hpp"
+#include "PPMImage.hpp"
+#include "TextureCache.hpp"
+#include "MipChain.hpp"
+#include "TextureSampling.hpp"
+#include "Parallel.hpp"
+#include "SelfTest.hpp"
 #if defined(LINUX) || defined(MINGW)
     #include <SDL2/SDL.h>
 #else // This works for Mac
@@ -30,32 +60,207 @@ int gScreenWidth = 1024;
 SDL_Window* gGraphicsApplicationWindow = nullptr;
 SDL_GLContext gOpenGLContext = nullptr;
 Transform gTransform;
-std::vector<GLfloat> gOffsets;
+// Lattice the instanced cubes are laid out on
+InstanceGrid gInstanceGrid;
 int gNumberOfInstances;
-int gNumberOfOffsets;
+// How the instance offsets are encoded in gInstanceVBO
+InstanceFormat gInstanceFormat = InstanceFormat::Float32;
+// Attribute layout of gInstanceVBO, needed to re-point it per draw
+InstanceAttribute gInstanceAttribute;
+// Half the size of the cube mesh, grows instance bounds to mesh bounds
+const float gInstancePadding = 0.4f;
+// Frustum culling of the instance chunks
+bool gCullingEnabled = true;
+float gChunkExtent = 80.0f;
+// Lattice points per axis of a procedural chunk, from gChunkExtent
+int gGridBrickCells = 16;
+std::vector<InstanceChunk> gInstanceChunks;
+std::vector<InstanceRun> gVisibleRuns;
+// Level of detail: visible chunks further away than gLodDistance draw
+// every instance as one point instead of a 36 index cube
+bool gLodEnabled = true;
+float gLodDistance = 150.0f;
+std::vector<InstanceRun> gFarRuns;
+CullStats gCullStats;
+Frustum gFrustum;
+// Compute shader culling with an indirect draw (GL 4.3+). Falls back
+// to the CPU chunk culling above when it cannot be used.
+bool gGpuCullingRequested = false;
+bool gGpuCullingEnabled = false;
+GpuCuller gGpuCuller;
+// Endless world: chunks are generated around the camera on worker
+// threads and uploaded into a fixed pool in gInstanceVBO
+bool gStreamingEnabled = false;
+int gStreamingRadius = 3;
+const int gStreamingChunkCells = 16;
+const int gStreamingUploadsPerFrame = 16;
+ChunkStreamer gChunkStreamer;
+// Dynamic instances: the encoded offsets are rewritten every frame
+// into the next slot of a ring buffer instead of a static VBO
+bool gDynamicInstances = false;
+int gInstanceRingFrames = 3;
+RingBuffer gInstanceRing;
+std::vector<unsigned char> gInstanceData;
+// Byte offset of this frame's instance data inside gInstanceVBO
+GLintptr gInstanceBufferOffset = 0;
+// Animated instances are computed from gInstanceStore every frame
+// and written through the dynamic instance ring
+InstanceAnimation gInstanceAnimation = InstanceAnimation::None;
+InstanceStore gInstanceStore;
+// Per-instance rotation and scale (attributes 3 to 8). The buffers
+// only exist for the formats in use or being benchmarked.
+InstanceTransformFormat gInstanceTransformFormat = InstanceTransformFormat::None;
+GLuint gInstanceTransformVBO = 0;
+GLuint gInstanceMatrixVBO = 0;
+bool gTransformBenchmark = false;
+// Mesh types the instances are spread over, chunk by chunk. Mesh 0 is
+// the cube, the others are rocks and planet proxies.
+int gMeshTypes = 1;
+MeshRegistry gMeshRegistry;
+MeshVertexFormat gMeshVertexFormat = MeshVertexFormat::Snorm16;
+// Submit all near runs with one glMultiDrawElementsIndirect
+bool gMultiDrawEnabled = true;
+std::vector<DrawElementsIndirectCommand> gDrawCommands;
+MeshDrawStats gMeshDrawStats;
+// All meshes are closed and wound counter-clockwise from outside, so
+// the triangles facing away from the camera can be skipped
+bool gBackFaceCullingEnabled = true;
+// Primitives the draws of a frame submit, before any face culling
+GLuint gPrimitiveQuery = 0;
+// Draw the near chunks front to back so early depth testing rejects
+// hidden fragments before the fragment shader runs
+bool gFrontToBackEnabled = false;
+DepthOrderStats gDepthOrderStats;
+// Samples that passed the depth test in a frame. The fragment shader
+// neither discards nor writes depth, so early depth testing applies
+// and this is also the number of fragment shader invocations.
+GLuint gFragmentQuery = 0;
+// Hierarchical-Z occlusion culling of the chunks against the nearest
+// cubes, rasterized on the CPU. Needs the rest positions of the
+// instances, so it is set up at start or not at all.
+bool gOcclusionCullingRequested = false;
+bool gOcclusionCullingEnabled = false;
+OcclusionCuller gOcclusionCuller;
+OcclusionStats gOcclusionStats;
+// Occluder instances rasterized per frame, nearest chunks first
+int gOccluderBudget = 16384;
+const int gOcclusionBufferWidth = 256;
+// Float offsets in chunk order, empty for the procedural format
+std::vector<GLfloat> gOccluderOffsets;
+std::vector<InstanceChunk> gUnoccludedChunks;
+// Same matrix the vertex shader uses, for the occlusion buffer
+glm::mat4 gModelViewProjection;
+glm::mat4 gModel;
+// Headless mode: an EGL context without a window renders a fixed
+// number of frames into an offscreen framebuffer of gScreenWidth x
+// gScreenHeight, reports the frame times and exits
+bool gHeadless = false;
+int gHeadlessFrames = 100;
+// Last frame is saved here if set
+std::string gHeadlessOutput;
+HeadlessContext gHeadlessContext;
+// Benchmark mode: the camera follows gCameraPath instead of the mouse
+// and the frame times are written to gBenchmarkOutput as JSON. The
+// path is read from gBenchmarkPathFile, or is one lap around the
+// lattice if that is empty.
+bool gBenchmark = false;
+std::string gBenchmarkPathFile;
+// Measured frames, 0 is once along a loaded path or 100 frames of the lap
+int gBenchmarkFrames = 0;
+// Drawn first from the first pose and left out of the results
+int gBenchmarkWarmupFrames = 10;
+std::string gBenchmarkOutput = "benchmark.json";
+// Report of an earlier run to compare with. The benchmark fails if
+// the average or p99 frame time is more than gBenchmarkTolerance
+// percent above it.
+std::string gBenchmarkBaseline;
+double gBenchmarkTolerance = 10.0;
+CameraPath gCameraPath;
+// Benchmark frame being drawn, -1 otherwise. Animations follow it
+// instead of the clock so every run sees the same instances.
+int gBenchmarkFrame = -1;
+// The interactive camera is appended to gRecordedPath every frame and
+// saved to gRecordPathFile on exit, if that is set
+std::string gRecordPathFile;
+CameraPath gRecordedPath;
+// Per-stage timing, written here on exit and on 't'. Profiling starts
+// with --profile or the first 't'.
+bool gProfilingRequested = false;
+std::string gProfileOutput = "profile.csv";
+// Chrome trace of startup and frames gTraceFirstFrame to
+// gTraceLastFrame, written to gTraceOutput if that is set
+std::string gTraceOutput;
+int gTraceFirstFrame = 0;
+int gTraceLastFrame = 9;
+// Same meshes as gVertexArrayObject, but attribute 2 reads the
+// instances that survived the compute pass
+GLuint gCulledVertexArrayObject = 0;
+// Filled by the line by line LoadPPM(), which is only kept as the
+// reference for --benchmark-ppm. Textures use LoadPPMImage().
 int gPPMWidth;
 int gPPMHeight;
 std::string gMagicNumber;
-unsigned char* gPixelData;
+unsigned char* gPixelData = nullptr;
+// Files --benchmark-ppm loads with both loaders
+std::vector<std::string> gPPMBenchmarkFiles;
+// --self-test runs the checks of SelfTest.hpp instead of the renderer
+bool gSelfTest = false;
+// Textures are decoded once, with their mip levels, and mapped from
+// the cache directory on later runs
+TextureCache gTextureCache;
+// Mip levels from the CPU (cached with the texture), from
+// glGenerateMipmap or none, and how the texture is filtered
+MipGeneration gMipGeneration = MipGeneration::Cpu;
+MipFilter gMipFilter = MipFilter::Box;
+TextureSampling gTextureSampling;
+// Source image of gTextureID, for --benchmark-textures
+std::string gTextureFile;
+bool gTextureBenchmark = false;
 // MainLoop flag
 bool gQuit = false;
 
 // VAO, encapsulates all items needed to render object
 GLuint gVertexArrayObject = 0;
-// VBO, store info relating to vertices (positions, normals, textures)
-GLuint gVertexBufferObject = 0;
 GLuint gInstanceVBO = 0;
+// Per-chunk scale/bias for the snorm16 instance format, read
+// in the vertex shader through a buffer texture
+GLuint gChunkScaleBiasBuffer = 0;
+GLuint gChunkScaleBiasTexture = 0;
 GLuint gColorBuffer = 0;
-GLuint gIndexBufferObject = 0;
 GLuint gTextureID;
-std::vector<GLint> gIndices;
 
 //////////////////// GLOBALS /////////////////////////
 
 // Shader
 // stores the unique id for the graphics pipeline
 // program object used for OpenGL draw calls
-GLuint gGraphicsPipelineShaderProgram = 0;
+ShaderProgram gGraphicsPipelineShaderProgram;
+// Uniforms of gGraphicsPipelineShaderProgram, found once after linking
+struct PipelineUniforms{
+    UniformHandle perVertexMvp;
+    UniformHandle meshPositionScale;
+    UniformHandle texture;
+    UniformHandle instanceFormat;
+    UniformHandle instanceTransform;
+    UniformHandle gridSpacing;
+    UniformHandle chunkSize;
+    UniformHandle gridStart;
+    UniformHandle gridCells;
+    UniformHandle gridDimensions;
+    UniformHandle gridBrickCells;
+    UniformHandle chunkScaleBias;
+    UniformHandle baseInstance;
+    UniformHandle pointProxy;
+};
+PipelineUniforms gPipelineUniforms;
+// Compute program of the GPU culling path
+GLuint gCullShaderProgram = 0;
+// Matrices and camera data of the current frame, shared by all programs
+FrameConstantsBuffer gFrameConstants;
+// Have vert.glsl multiply the matrices per vertex again, for comparison
+bool gPerVertexMvp = false;
+// Running average of the time between two frames
+double gAverageFrameTimeMs = 0.0;
 
 std::string LoadShader(const std::string& fname) {
     std::string result;
@@ -76,36 +281,9 @@ std::string LoadShader(const std::string& fname) {
 }
 
 
-void createTranslations() {
-
-    const int start = -15;
-    const int end = 15;
-    gNumberOfOffsets = 0;
-    gNumberOfInstances = 0;
-    for (int x = start; x <end; x++) {
-        for (int y = start; y < end; y++) {
-			for (int z = start; z < end; z++) {
-				gOffsets.push_back((float)x * 5.0f);
-				gOffsets.push_back((float)y * 5.0f);
-				gOffsets.push_back((float)z * 5.0f);
-				gNumberOfOffsets += 3;
-				gNumberOfInstances++;
-            }
-        }
-    }
-
-    std::cout << "Number of instances: " << gNumberOfInstances << std::endl;
-}
-
 GLuint CompileShader(GLuint type, const std::string& source) {
 
-    GLuint shaderObject;
-    
-    if (type == GL_VERTEX_SHADER) {
-        shaderObject = glCreateShader(GL_VERTEX_SHADER);
-    } else if (type == GL_FRAGMENT_SHADER) {
-        shaderObject = glCreateShader(GL_FRAGMENT_SHADER);
-    }
+    GLuint shaderObject = glCreateShader(type);
 
     const char* src = source.c_str();
     glShaderSource(shaderObject, 1, &src, nullptr);
@@ -127,6 +305,10 @@ GLuint CompileShader(GLuint type, const std::string& source) {
             
             std::cout << "ERROR: GL_FRAGMENT_SHADER compilation failed." << std::endl << errorMessages << std::endl;
 
+        } else if (type == GL_COMPUTE_SHADER) {
+
+            std::cout << "ERROR: GL_COMPUTE_SHADER compilation failed." << std::endl << errorMessages << std::endl;
+
         }
 
         delete[] errorMessages;
@@ -167,26 +349,66 @@ GLuint CreateShaderProgram(const std::string& vertexShaderSource, const std::str
     return programObject;
 }
 
+GLuint CreateComputeShaderProgram(const std::string& computeShaderSource) {
+
+    GLuint computeShader = CompileShader(GL_COMPUTE_SHADER, computeShaderSource);
+    if (computeShader == 0) {
+        return 0;
+    }
+    GLuint programObject = glCreateProgram();
+    glAttachShader(programObject, computeShader);
+    glLinkProgram(programObject);
+    glDetachShader(programObject, computeShader);
+    glDeleteShader(computeShader);
+
+    return programObject;
+}
+
 void SetUniform2f(std::string name, const glm::vec2 &value) {
 
-    GLint location = glGetUniformLocation(gGraphicsPipelineShaderProgram, name.c_str());
-    glUniform2fv(location, 1, &value[0]);
+    gGraphicsPipelineShaderProgram.SetUniform(gGraphicsPipelineShaderProgram.FindUniform(name), value);
 
 }
 
 void SetUniform3f(std::string name, const glm::vec3 &value) {
 //void SetUniform3f(std::string name, float v0, float v1, float v2) {
-    GLint location = glGetUniformLocation(gGraphicsPipelineShaderProgram, name.c_str());
     //glUniform3f(location, v0, v1, v2);
-    glUniform3fv(location, 1, &value[0]);
+    gGraphicsPipelineShaderProgram.SetUniform(gGraphicsPipelineShaderProgram.FindUniform(name), value);
 }
 
 void CreateGraphicsPipeline() {
+    TraceScope scope("CreateGraphicsPipeline", true);
 
     std::string vertexShaderSource = LoadShader("./shaders/vert.glsl");
     std::string fragmentShaderSource = LoadShader("./shaders/frag.glsl");
-    gGraphicsPipelineShaderProgram = CreateShaderProgram(vertexShaderSource, fragmentShaderSource);
+    gGraphicsPipelineShaderProgram.Attach(CreateShaderProgram(vertexShaderSource, fragmentShaderSource));
+    gPipelineUniforms.perVertexMvp = gGraphicsPipelineShaderProgram.FindUniform("u_PerVertexMvp");
+    gPipelineUniforms.meshPositionScale = gGraphicsPipelineShaderProgram.FindUniform("u_MeshPositionScale");
+    gPipelineUniforms.texture = gGraphicsPipelineShaderProgram.FindUniform("u_Texture");
+    gPipelineUniforms.instanceFormat = gGraphicsPipelineShaderProgram.FindUniform("u_InstanceFormat");
+    gPipelineUniforms.instanceTransform = gGraphicsPipelineShaderProgram.FindUniform("u_InstanceTransform");
+    gPipelineUniforms.gridSpacing = gGraphicsPipelineShaderProgram.FindUniform("u_GridSpacing");
+    gPipelineUniforms.chunkSize = gGraphicsPipelineShaderProgram.FindUniform("u_ChunkSize");
+    gPipelineUniforms.gridStart = gGraphicsPipelineShaderProgram.FindUniform("u_GridStart");
+    gPipelineUniforms.gridCells = gGraphicsPipelineShaderProgram.FindUniform("u_GridCells");
+    gPipelineUniforms.gridDimensions = gGraphicsPipelineShaderProgram.FindUniform("u_GridDimensions");
+    gPipelineUniforms.gridBrickCells = gGraphicsPipelineShaderProgram.FindUniform("u_GridBrickCells");
+    gPipelineUniforms.chunkScaleBias = gGraphicsPipelineShaderProgram.FindUniform("u_ChunkScaleBias");
+    gPipelineUniforms.baseInstance = gGraphicsPipelineShaderProgram.FindUniform("u_BaseInstance");
+    gPipelineUniforms.pointProxy = gGraphicsPipelineShaderProgram.FindUniform("u_PointProxy");
+    std::cout << "Graphics pipeline: " << gGraphicsPipelineShaderProgram.GetUniformCount() << " active uniforms, "
+              << gGraphicsPipelineShaderProgram.GetAttributeCount() << " active attributes" << std::endl;
+
+    if (gGpuCullingRequested && GpuCuller::IsSupported()) {
+        gCullShaderProgram = CreateComputeShaderProgram(LoadShader("./shaders/cull.glsl"));
+    }
 
+    // Every program reads the frame constants from the same binding
+    gFrameConstants.Initialize();
+    FrameConstantsBuffer::BindProgram(gGraphicsPipelineShaderProgram.GetID());
+    if (gCullShaderProgram != 0) {
+        FrameConstantsBuffer::BindProgram(gCullShaderProgram);
+    }
 }
 
 // Function to get OpenGL Version Information
@@ -229,6 +451,8 @@ void LoadPPM(bool flip, const std::string filepath){
                 gPPMHeight = atoi(token);
                 std::cout << "PPM width, height = " << gPPMWidth << ", " << gPPMHeight << "\n";	
                 if(gPPMWidth > 0 && gPPMHeight > 0){
+                    // Free the previous image instead of leaking it
+                    delete[] gPixelData;
                     gPixelData = new unsigned char[gPPMWidth * gPPMHeight * 3];
                     if(gPixelData == NULL) {
                         std::cout << "Unable to allocate memory for ppm" << std::endl;
@@ -274,10 +498,11 @@ void LoadPPM(bool flip, const std::string filepath){
  * Function adapted from class
  */
 void LoadTexture(const std::string filepath){
+    TraceScope scope("LoadTexture", true);
 	// Load our actual image data
 	// This method loads .ppm files of pixel data
-	LoadPPM(true, filepath);
-    glEnable(GL_TEXTURE_2D); 
+    CachedTexture texture;
+    bool loaded = gTextureCache.Load(filepath, true, texture);
 	// Generate a buffer for our texture
     glGenTextures(1, &gTextureID);
     // Similar to our vertex buffers, we now 'select'
@@ -287,28 +512,388 @@ void LoadTexture(const std::string filepath){
 	// Now we are going to setup some information about
 	// our textures.
 	// There are four parameters that must be set.
-	// GL_TEXTURE_MIN_FILTER - How texture filters (linearly, etc.)
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); 
+	// GL_TEXTURE_MIN_FILTER and GL_TEXTURE_MAG_FILTER - How texture
+	// filters: linear, bilinear or trilinear, optionally anisotropic
+    float anisotropy = ApplyTextureSampling(gTextureSampling);
 	// Wrap mode describes what to do if we go outside the boundaries of
 	// texture.
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); 
 	// At this point, we are now ready to load and send some data to OpenGL.
-	glTexImage2D(GL_TEXTURE_2D,
-							0,
-						GL_RGB,
-						gPPMWidth,
-						gPPMHeight,
-							0,
-						GL_RGB,
-						GL_UNSIGNED_BYTE,
-						gPixelData); // Here is the raw pixel data
+    // Grey images are one channel, read back as grey in all three
+    GLenum format = GL_RGB;
+    if (texture.GetChannels() == 1) {
+        format = GL_RED;
+        const GLint grey[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, grey);
+    }
+    // Rows are tightly packed, an odd width times 3 is not a multiple of 4
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // On a cache hit the pixels are read straight from the mapped file.
+    // The CPU levels come with the texture, otherwise only the base
+    // level is uploaded.
+    int uploadedLevels = gMipGeneration == MipGeneration::Cpu ? texture.GetLevelCount() : std::min(1, texture.GetLevelCount());
+    for (int level = 0; level < uploadedLevels; ++level) {
+        glTexImage2D(GL_TEXTURE_2D,
+                     level,
+                     format == GL_RED ? GL_R8 : GL_RGB8,
+                     texture.GetLevel(level).width,
+                     texture.GetLevel(level).height,
+                     0,
+                     format,
+                     GL_UNSIGNED_BYTE,
+                     texture.GetLevel(level).pixels); // Here is the raw pixel data
+    }
+    int levels = uploadedLevels;
+    if (gMipGeneration == MipGeneration::Gpu && uploadedLevels > 0) {
+        levels = GetMipLevelCount(texture.GetLevel(0).width, texture.GetLevel(0).height);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, std::max(0, levels - 1));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    // One line for the load, the cache and the mips
+    std::cout << "Texture " << filepath << ": ";
+    if (loaded) {
+        TextureCacheStats stats = gTextureCache.GetStats();
+        std::cout << texture.GetLevel(0).width << "x" << texture.GetLevel(0).height << ", "
+                  << texture.GetChannels() << " channels, ";
+        if (gTextureCache.IsEnabled()) {
+            std::cout << (texture.IsFromCache() ? "cache hit" : "cache miss") << " (" << stats.hits << " hits, "
+                      << stats.misses << " misses";
+            if (stats.writeFailures > 0) {
+                std::cout << ", " << stats.writeFailures << " not written";
+            }
+            std::cout << "), ";
+        }
+        std::cout << "loaded in " << stats.lastLoadMs << " ms, ";
+    }
+    std::cout << levels << " levels, ";
+    if (gMipGeneration == MipGeneration::None) {
+        std::cout << "no mips";
+    } else {
+        std::cout << "mips from " << GetMipGenerationName(gMipGeneration);
+    }
+    if (gMipGeneration == MipGeneration::Cpu) {
+        std::cout << " (" << GetMipFilterName(gMipFilter) << ")";
+    }
+    std::cout << ", " << GetTextureFilterName(gTextureSampling.filter) << " filtering, "
+              << anisotropy << "x anisotropy" << std::endl;
+    gTextureFile = filepath;
 	// We are done with our texture data so we can unbind.
 	glBindTexture(GL_TEXTURE_2D, 0);
+    // The mapping or the decoded pixels go away with texture, GL has
+    // its own copy now
+}
+
+// Loads every file of gPPMBenchmarkFiles a few times with LoadPPM()
+// (ASCII P3 only) and LoadPPMImage() and reports the throughput of
+// both. The file is read from the page cache after the first run, so
+// this measures the parsing, not the disk.
+void BenchmarkPPMLoaders() {
+    const int runs = 5;
+    for (const std::string& path : gPPMBenchmarkFiles) {
+        std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            std::cout << "PPM benchmark: cannot open " << path << std::endl;
+            continue;
+        }
+        double megabytes = (double)file.tellg() / (1024.0 * 1024.0);
+        file.seekg(0);
+        char magic[2] = {0, 0};
+        file.read(magic, 2);
+        file.close();
+
+        Image image;
+        double bestMs = INFINITY;
+        for (int run = 0; run < runs; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            if (!LoadPPMImage(path, true, image)) {
+                break;
+            }
+            bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        if (image.IsEmpty()) {
+            continue;
+        }
+        std::cout << "PPM benchmark: " << path << ", " << megabytes << " MB, mapped loader "
+                  << bestMs << " ms (" << megabytes / (bestMs / 1000.0) << " MB/s)" << std::endl;
+        if (magic[0] != 'P' || magic[1] != '3') {
+            continue;
+        }
+
+        double lineBestMs = INFINITY;
+        for (int run = 0; run < runs; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            LoadPPM(true, path);
+            lineBestMs = std::min(lineBestMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        bool same = gPPMWidth == image.GetWidth() && gPPMHeight == image.GetHeight()
+                    && memcmp(gPixelData, image.GetPixels(), image.GetSize()) == 0;
+        std::cout << "PPM benchmark: " << path << ", line by line loader " << lineBestMs << " ms ("
+                  << megabytes / (lineBestMs / 1000.0) << " MB/s), " << lineBestMs / bestMs << "x slower, pixels "
+                  << (same ? "identical" : "DIFFER") << std::endl;
+        delete[] gPixelData;
+        gPixelData = nullptr;
+    }
+}
+
+// Points the transform attributes of the bound VAO at baseInstance
+void PointInstanceTransforms(GLint baseInstance) {
+    if (gInstanceTransformFormat == InstanceTransformFormat::Packed) {
+        std::size_t base = (std::size_t)baseInstance * sizeof(PackedInstanceTransform);
+        GLStateCache::Instance().BindBuffer(GL_ARRAY_BUFFER, gInstanceTransformVBO);
+        glVertexAttribPointer(3, 4, GL_SHORT, GL_TRUE, sizeof(PackedInstanceTransform),
+                              (void*)(base + offsetof(PackedInstanceTransform, rotation)));
+        glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(PackedInstanceTransform),
+                              (void*)(base + offsetof(PackedInstanceTransform, scale)));
+    } else if (gInstanceTransformFormat == InstanceTransformFormat::Matrix) {
+        // A mat4 attribute takes one location per column
+        std::size_t base = (std::size_t)baseInstance * sizeof(glm::mat4);
+        GLStateCache::Instance().BindBuffer(GL_ARRAY_BUFFER, gInstanceMatrixVBO);
+        for (GLuint column = 0; column < 4; ++column) {
+            glVertexAttribPointer(5 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                  (void*)(base + column * sizeof(glm::vec4)));
+        }
+    }
+}
+
+// Switches gVertexArrayObject to another transform format, enabling
+// the attributes it reads and disabling the others. Leaves the VAO bound.
+// Also runs during setup, where GL is called around the cache.
+void UseInstanceTransformFormat(InstanceTransformFormat format) {
+    gInstanceTransformFormat = format;
+    GLStateCache::Instance().Invalidate();
+    GLStateCache::Instance().BindVertexArray(gVertexArrayObject);
+    for (GLuint attribute = 3; attribute <= 8; ++attribute) {
+        bool used = attribute <= 4 ? format == InstanceTransformFormat::Packed
+                                   : format == InstanceTransformFormat::Matrix;
+        if (used) {
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribDivisor(attribute, 1);
+        } else {
+            glDisableVertexAttribArray(attribute);
+        }
+    }
+    // The matrices carry the translation, the offsets are not fetched
+    if (gInstanceVBO != 0) {
+        if (format == InstanceTransformFormat::Matrix) {
+            glDisableVertexAttribArray(2);
+        } else {
+            glEnableVertexAttribArray(2);
+        }
+    }
+    PointInstanceTransforms(0);
+}
+
+GLuint UploadInstanceTransforms(InstanceTransformFormat format, const GLfloat* offsets) {
+    InstanceTransforms transforms = BuildInstanceTransforms(format, gNumberOfInstances, offsets);
+    std::cout << "Instance transforms: " << GetInstanceTransformFormatName(format) << ", "
+              << transforms.stride << " bytes per instance, "
+              << transforms.data.size() / (1024.0 * 1024.0) << " MB" << std::endl;
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, transforms.data.size(), transforms.data.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return buffer;
+}
+
+// Sets up the transform buffers gInstanceTransformFormat and the
+// transform benchmark need. offsets are the final instance offsets
+// as floats, or null for the procedural format.
+void InstanceTransformSpecification(const GLfloat* offsets) {
+    if (gTransformBenchmark || gInstanceTransformFormat == InstanceTransformFormat::Packed) {
+        gInstanceTransformVBO = UploadInstanceTransforms(InstanceTransformFormat::Packed, offsets);
+    }
+    if ((gTransformBenchmark || gInstanceTransformFormat == InstanceTransformFormat::Matrix) && offsets != nullptr) {
+        gInstanceMatrixVBO = UploadInstanceTransforms(InstanceTransformFormat::Matrix, offsets);
+    }
+    UseInstanceTransformFormat(gInstanceTransformFormat);
+}
+
+// Sets up the per-instance offsets (attribute 2) of the bound VAO
+// in the encoding selected by gInstanceFormat.
+void InstanceSpecification() {
+    TraceScope scope("InstanceSpecification", true);
+    if (gStreamingEnabled) {
+        // The pool starts empty, Draw() streams chunks into it
+        gInstanceFormat = InstanceFormat::Float32;
+        if (gInstanceTransformFormat != InstanceTransformFormat::None || gTransformBenchmark) {
+            std::cout << "Streamed instances have no transforms, ignoring them" << std::endl;
+            gInstanceTransformFormat = InstanceTransformFormat::None;
+            gTransformBenchmark = false;
+        }
+        if (gOcclusionCullingRequested) {
+            std::cout << "Occlusion culling needs static instances, ignoring it" << std::endl;
+            gOcclusionCullingRequested = false;
+        }
+        gChunkStreamer.Initialize(gStreamingChunkCells, gInstanceGrid.spacing, gStreamingRadius, gInstancePadding);
+        gNumberOfInstances = (int)gChunkStreamer.GetPoolInstances();
+        std::cout << "Streaming pool: " << gNumberOfInstances << " instances, "
+                  << gNumberOfInstances * 3 * sizeof(GLfloat) / (1024.0 * 1024.0) << " MB" << std::endl;
+        glGenBuffers(1, &gInstanceVBO);
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, gInstanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)gNumberOfInstances * 3 * sizeof(GLfloat), nullptr, GL_DYNAMIC_DRAW);
+        gInstanceAttribute = InstanceAttribute();
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glVertexAttribDivisor(2, 1);
+        return;
+    }
+    bool animated = gInstanceAnimation != InstanceAnimation::None;
+    if (animated && gOcclusionCullingRequested) {
+        std::cout << "Occlusion culling needs static instances, ignoring it" << std::endl;
+        gOcclusionCullingRequested = false;
+    }
+    if (gOcclusionCullingRequested) {
+        gOcclusionCuller.Initialize(gOcclusionBufferWidth, gOcclusionBufferWidth * gScreenHeight / gScreenWidth);
+        gOcclusionCullingEnabled = true;
+    }
+    if (animated && gInstanceFormat != InstanceFormat::Float32) {
+        std::cout << "Animated instances are written as float offsets" << std::endl;
+        gInstanceFormat = InstanceFormat::Float32;
+    }
+    if (gInstanceTransformFormat == InstanceTransformFormat::Matrix &&
+        (animated || gInstanceFormat == InstanceFormat::Procedural)) {
+        std::cout << "mat4 transforms need static stored offsets, using packed transforms instead" << std::endl;
+        gInstanceTransformFormat = InstanceTransformFormat::Packed;
+    }
+    // A rotated, scaled cube reaches further out than the plain one
+    bool transformed = gInstanceTransformFormat != InstanceTransformFormat::None || gTransformBenchmark;
+    float padding = gInstancePadding * (transformed ? std::sqrt(3.0f) * gInstanceMaxScale : 1.0f);
+    if (gInstanceFormat == InstanceFormat::Procedural) {
+        // Nothing to generate or upload, vert.glsl derives every
+        // offset from gl_InstanceID and the grid uniforms.
+        gNumberOfInstances = (int)gInstanceGrid.GetNumberOfInstances();
+        std::cout << "Number of instances: " << gNumberOfInstances << std::endl;
+        // The instances come brick by brick, one brick per chunk
+        gGridBrickCells = std::max(1, std::min((int)std::lround(gChunkExtent / gInstanceGrid.spacing),
+                                               gInstanceGrid.GetCellsPerAxis()));
+        gInstanceChunks = BuildGridChunks(gInstanceGrid, gGridBrickCells, padding);
+        AssignChunkMeshes(gInstanceChunks, gMeshTypes);
+        std::cout << "Instance chunks: " << gInstanceChunks.size() << " bricks of " << gGridBrickCells
+                  << " lattice points per axis" << std::endl;
+        std::cout << "Instance format: procedural, 0 bytes per instance" << std::endl;
+        InstanceTransformSpecification(nullptr);
+        return;
+    }
+
+    // The offsets only need to live until they are uploaded
+    InstanceBuffer instances = GenerateInstances(gInstanceGrid);
+    gNumberOfInstances = (int)instances.numberOfInstances;
+    std::cout << "Number of instances: " << gNumberOfInstances
+              << " (generated in " << instances.generationTimeMs << " ms)" << std::endl;
+    // Chunks have to be known before encoding since they reorder the instances
+    // Animated instances leave their rest position, the chunk bounds
+    // grow by the furthest they can move
+    if (animated) {
+        padding += InstanceStore::GetMaxDisplacement(gInstanceGrid.spacing);
+    }
+    gInstanceChunks = SortInstancesIntoChunks(instances, gChunkExtent, padding);
+    AssignChunkMeshes(gInstanceChunks, gMeshTypes);
+    std::cout << "Instance chunks: " << gInstanceChunks.size() << std::endl;
+    if (gOcclusionCullingEnabled) {
+        gOccluderOffsets = instances.offsets;
+    }
+    if (animated) {
+        gInstanceStore.Initialize(instances, gInstanceGrid.spacing);
+        std::cout << "Animation: " << GetInstanceAnimationName(gInstanceAnimation)
+                  << ", " << gInstanceStore.GetKernelName() << " kernel" << std::endl;
+    }
+    EncodedInstances encoded = EncodeInstances(instances, gInstanceGrid, gInstanceFormat);
+    std::cout << "Instance format: " << GetInstanceFormatName(gInstanceFormat)
+              << ", " << encoded.attribute.stride << " bytes per instance, "
+              << encoded.data.size() / (1024.0 * 1024.0) << " MB instance buffer ("
+              << instances.offsets.size() * sizeof(GLfloat) / (1024.0 * 1024.0) << " MB as float)" << std::endl;
+    // Instance VBO
+    if (gDynamicInstances && gInstanceRing.Initialize(GL_ARRAY_BUFFER, encoded.data.size(), gInstanceRingFrames)) {
+        // UpdateInstances() copies the offsets into a new slot every frame
+        gInstanceVBO = gInstanceRing.GetBuffer();
+        if (!gInstanceStore.IsInitialized()) {
+            gInstanceData = std::move(encoded.data);
+        }
+        std::cout << "Dynamic instances: " << gInstanceRingFrames << " frame ring, "
+                  << (gInstanceRing.GetStats().persistent ? "persistent mapping" : "unsynchronized mapping") << std::endl;
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, gInstanceVBO);
+    } else {
+        glGenBuffers(1, &gInstanceVBO);
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, gInstanceVBO); // this attribute comes from a different vertex buffer
+        glBufferData(GL_ARRAY_BUFFER, encoded.data.size(), encoded.data.data(), GL_STATIC_DRAW);
+    }
+    gInstanceAttribute = encoded.attribute;
+    glVertexAttribPointer(2, gInstanceAttribute.components, gInstanceAttribute.type,
+                          gInstanceAttribute.normalized, gInstanceAttribute.stride, (void*)0);
+    if (!encoded.chunkScaleBias.empty()) {
+        glGenBuffers(1, &gChunkScaleBiasBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, gChunkScaleBiasBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, encoded.chunkScaleBias.size() * sizeof(glm::vec4), encoded.chunkScaleBias.data(), GL_STATIC_DRAW);
+        glGenTextures(1, &gChunkScaleBiasTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, gChunkScaleBiasTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, gChunkScaleBiasBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glVertexAttribDivisor(2, 1); // tell OpenGL this is an instanced vertex attribute.
+    InstanceTransformSpecification(instances.offsets.data());
+}
+
+// Adds gMeshTypes - 1 meshes after the cube, alternating rocks and
+// planet proxies of growing detail. All fit the cube's bounds.
+void RegisterMeshes() {
+    for (int i = 1; i < gMeshTypes; ++i) {
+        if (i % 2 == 1) {
+            int rings = 4 + i % 3;
+            if (gMeshRegistry.AddMesh("rock " + std::to_string(i),
+                                      BuildSphereMesh(rings, 2 * rings, gInstancePadding, 0.35f, (unsigned int)i)) < 0) {
+                exit(1);
+            }
+        } else {
+            int rings = 6 + 2 * (i % 5);
+            if (gMeshRegistry.AddMesh("planet " + std::to_string(i), BuildSphereMesh(rings, 2 * rings, gInstancePadding)) < 0) {
+                exit(1);
+            }
+        }
+    }
+    long long vertices = 0;
+    long long indices = 0;
+    for (int i = 0; i < gMeshRegistry.GetMeshCount(); ++i) {
+        const Mesh& mesh = gMeshRegistry.GetMesh(i);
+        vertices += mesh.vertexCount;
+        indices += mesh.indexCount;
+        std::cout << "Mesh " << mesh.name << ": " << mesh.vertexCount << " vertices, " << mesh.indexCount / 3
+                  << " triangles, " << mesh.invocationsBefore << " -> " << mesh.invocations
+                  << " vertex shader invocations per instance after cache ordering" << std::endl;
+    }
+    std::cout << "Meshes: " << gMeshRegistry.GetMeshCount() << " types, " << vertices << " vertices, "
+              << indices << " indices in shared buffers" << std::endl;
+}
+
+// Multiplies the per-instance savings of the vertex cache ordering by
+// how many instances use each mesh
+void ReportVertexCacheSavings() {
+    std::vector<long long> instances(gMeshRegistry.GetMeshCount(), 0);
+    if (gInstanceChunks.empty()) {
+        instances[0] = gNumberOfInstances;
+    }
+    for (const InstanceChunk& chunk : gInstanceChunks) {
+        instances[chunk.mesh] += chunk.instanceCount;
+    }
+    long long before = 0;
+    long long after = 0;
+    for (int i = 0; i < gMeshRegistry.GetMeshCount(); ++i) {
+        before += instances[i] * gMeshRegistry.GetMesh(i).invocationsBefore;
+        after += instances[i] * gMeshRegistry.GetMesh(i).invocations;
+    }
+    std::cout << "Vertex cache ordering: " << before - after << " fewer vertex shader invocations per frame ("
+              << before << " -> " << after << ") with every instance drawn as a mesh" << std::endl;
 }
 
 void VertexSpecification() {
+    TraceScope scope("VertexSpecification", true);
 
     const std::vector<GLfloat> vertexPosition {
         0.4, 0.4, -0.4, 0.49837, 0.997711, 
@@ -343,10 +928,17 @@ void VertexSpecification() {
         11, 2, 8
     };
 
-    for (GLuint i : indices) {
-        gIndices.push_back(i);
+    {
+        TraceScope meshScope("RegisterMeshes");
+        MeshData cube;
+        cube.vertices = vertexPosition;
+        cube.indices = indices;
+        if (gMeshRegistry.AddMesh("cube", cube) < 0) {
+            exit(1);
+        }
+        RegisterMeshes();
     }
-    
+
     // Color
     const std::vector<GLfloat> colorData {
         0.583f,  0.771f,  0.014f,
@@ -393,53 +985,92 @@ void VertexSpecification() {
     // Bind to select which VAO we want to work within
     glGenVertexArrays(1, &gVertexArrayObject);
     glBindVertexArray(gVertexArrayObject);
-    //POSITION 
-    // Generate VBO
-    glGenBuffers(1, &gVertexBufferObject);
-    glBindBuffer(GL_ARRAY_BUFFER, gVertexBufferObject);
-    glBufferData(GL_ARRAY_BUFFER, 
-                 vertexPosition.size() * sizeof(GL_FLOAT), 
-                 vertexPosition.data(),
-                 GL_STATIC_DRAW);
-
-    // For given VAO, we need to tell OpenGL how the info in buffer will be used
-    glEnableVertexAttribArray(0);
-    
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 5, (void*) 0);
-
-    // TEXTURE
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_TRUE,sizeof(GLfloat) * 5, (char*)(sizeof(float) * 3));
+    // POSITION, TEXTURE and INDEX all come from the mesh mega-buffers
+    {
+        TraceScope uploadScope("UploadMeshes", true);
+        gMeshRegistry.Upload(gMeshVertexFormat);
+        gMeshRegistry.AttachToVertexArray();
+    }
+    std::cout << "Mesh vertices: " << GetMeshVertexFormatName(gMeshVertexFormat) << ", "
+              << gMeshRegistry.GetVertexStride() << " bytes per vertex, max position error "
+              << gMeshRegistry.GetMaxPositionError() << ", "
+              << (gMeshRegistry.GetIndexType() == GL_UNSIGNED_SHORT ? "16" : "32") << " bit indices" << std::endl;
     LoadTexture("clouds.ppm");
 
-    // INDEX
-    glGenBuffers(1, &gIndexBufferObject);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIndexBufferObject);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GL_UNSIGNED_INT), indices.data(), GL_STATIC_DRAW); 
-
-    createTranslations(); 
-    // Instance VBO
-    glGenBuffers(1, &gInstanceVBO);
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, gInstanceVBO); // this attribute comes from a different vertex buffer
-    glBufferData(GL_ARRAY_BUFFER, gNumberOfOffsets * sizeof(GLfloat), &gOffsets[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glVertexAttribDivisor(2, 1); // tell OpenGL this is an instanced vertex attribute.
+    InstanceSpecification();
+    ReportVertexCacheSavings();
+    // Worst case every chunk is a near run of its own
+    int maxCommands = gStreamingEnabled ? gChunkStreamer.GetStats().poolSlots : (int)gInstanceChunks.size();
+    if (gMultiDrawEnabled) {
+        gMeshRegistry.InitializeMultiDraw(maxCommands);
+    }
+    std::cout << "Mesh draws: " << (gMeshRegistry.IsMultiDrawInitialized() ? "multi-draw indirect" : "one draw per run")
+              << std::endl;
+    glGenQueries(1, &gPrimitiveQuery);
+    glGenQueries(1, &gFragmentQuery);
     // Unbind our currently bound VAP
     glBindVertexArray(0);
     // Disable attributes opened in vertex attribute array
     glDisableVertexAttribArray(0);
 }
 
+// Sets up the compute culling path if it was asked for and the
+// context supports it. Needs the instance buffer and the programs.
+void GpuCullingSpecification() {
+    TraceScope scope("GpuCullingSpecification");
+    if (!gGpuCullingRequested) {
+        return;
+    }
+    if (!GpuCuller::IsSupported()) {
+        std::cout << "GPU culling needs OpenGL 4.3, using CPU culling instead" << std::endl;
+        return;
+    }
+    if (gStreamingEnabled) {
+        std::cout << "GPU culling does not work on the streaming pool, using CPU culling instead" << std::endl;
+        return;
+    }
+    if (gInstanceRing.IsInitialized()) {
+        std::cout << "GPU culling does not work on dynamic instances, using CPU culling instead" << std::endl;
+        return;
+    }
+    if (gInstanceTransformFormat != InstanceTransformFormat::None || gTransformBenchmark) {
+        std::cout << "GPU culling only compacts offsets, not transforms. Using CPU culling instead" << std::endl;
+        return;
+    }
+    if (gInstanceFormat != InstanceFormat::Float32) {
+        std::cout << "GPU culling reads float offsets, use --instance-format=float. Using CPU culling instead" << std::endl;
+        return;
+    }
+    if (gMeshTypes > 1) {
+        std::cout << "GPU culling draws a single mesh, using CPU culling instead" << std::endl;
+        return;
+    }
+    if (!gGpuCuller.Initialize(gCullShaderProgram, gInstanceVBO, gNumberOfInstances, gMeshRegistry.GetMesh(0).indexCount)) {
+        std::cout << "GPU culling could not be initialized, using CPU culling instead" << std::endl;
+        return;
+    }
+
+    glGenVertexArrays(1, &gCulledVertexArrayObject);
+    glBindVertexArray(gCulledVertexArrayObject);
+    gMeshRegistry.AttachToVertexArray();
+    glBindBuffer(GL_ARRAY_BUFFER, gGpuCuller.GetVisibleBuffer());
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glVertexAttribDivisor(2, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    gGpuCullingEnabled = true;
+    std::cout << "GPU culling enabled" << std::endl;
+}
+
 void InitializeProgram() {
+    TraceScope scope("InitializeProgram");
     // Initialize SDL
 	if (SDL_Init(SDL_INIT_VIDEO)< 0){
 		std::cout << "SDL could not initialize!" << std::endl;
 		exit(1);
 	}
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 
 	// We want to request a double buffer for smooth updating.
@@ -457,7 +1088,18 @@ void InitializeProgram() {
         exit(1);
     }
     // Create OpenGL Graphics Context
-    gOpenGLContext = SDL_GL_CreateContext(gGraphicsApplicationWindow);
+    // Ask for the newest version we have a use for (4.3 enables GPU
+    // culling) and step down until the driver accepts one. 4.1 is
+    // the most macOS offers.
+    const int contextVersions[][2] = {{4, 5}, {4, 3}, {4, 1}};
+    for (const auto& version : contextVersions) {
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, version[0]);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, version[1]);
+        gOpenGLContext = SDL_GL_CreateContext(gGraphicsApplicationWindow);
+        if (gOpenGLContext != nullptr) {
+            break;
+        }
+    }
     if (gOpenGLContext == nullptr) {
 		std::cout << "OpenGL context not available." << std::endl;
         exit(1);
@@ -470,6 +1112,55 @@ void InitializeProgram() {
    GetOpenGLVersionInfo();
 }
 
+// Replaces InitializeProgram() when there is no display
+void InitializeHeadless() {
+    TraceScope scope("InitializeHeadless");
+    if (!gHeadlessContext.Create(gScreenWidth, gScreenHeight)) {
+        exit(1);
+    }
+    std::cout << "Headless: rendering " << gHeadlessFrames << " frames at "
+              << gScreenWidth << "x" << gScreenHeight << " offscreen" << std::endl;
+    GetOpenGLVersionInfo();
+}
+
+// Where the camera currently is
+glm::vec3 GetEyePosition() {
+    return glm::vec3(Camera::Instance().GetEyeXPosition(),
+                     Camera::Instance().GetEyeYPosition(),
+                     Camera::Instance().GetEyeZPosition());
+}
+
+// The eye in the model space of the instance offsets, which is where
+// the chunk bounds are
+glm::vec3 GetModelSpaceEyePosition() {
+    return glm::vec3(glm::inverse(gModel) * glm::vec4(GetEyePosition(), 1.0f));
+}
+
+// Triangles of the near meshes that face the camera and so survive
+// back-face culling. GL has no query for primitives after face
+// culling, so this counts them on the CPU as if every instance of a
+// chunk sat unrotated at the chunk's center.
+long long EstimateFrontFacingTriangles() {
+    glm::vec3 eye = GetModelSpaceEyePosition();
+    bool chunkPath = gCullingEnabled || gStreamingEnabled || gMeshTypes > 1 || gFrontToBackEnabled;
+    long long triangles = 0;
+    for (const InstanceChunk& chunk : gOcclusionCullingEnabled ? gUnoccludedChunks : gInstanceChunks) {
+        if (chunkPath) {
+            // Same choice as CullChunksLod, points are not culled
+            if (gCullingEnabled && !gFrustum.IntersectsBox(chunk.boundsMin, chunk.boundsMax)) {
+                continue;
+            }
+            glm::vec3 toChunk = glm::clamp(eye, chunk.boundsMin, chunk.boundsMax) - eye;
+            if (gLodEnabled && glm::dot(toChunk, toChunk) > gLodDistance * gLodDistance) {
+                continue;
+            }
+        }
+        glm::vec3 center = 0.5f * (chunk.boundsMin + chunk.boundsMax);
+        triangles += (long long)gMeshRegistry.CountFrontFacing(chunk.mesh, eye - center) * chunk.instanceCount;
+    }
+    return triangles;
+}
+
 void Input() { 
     SDL_Event e;
     SDL_StartTextInput();
@@ -513,6 +1204,159 @@ void Input() {
                     case SDLK_z:
                         Camera::Instance().MoveDown(cameraSpeed);
                         break;
+                    case SDLK_c:
+                        gCullingEnabled = !gCullingEnabled;
+                        std::cout << "Frustum culling " << (gCullingEnabled ? "on" : "off") << std::endl;
+                        break;
+                    case SDLK_g:
+                        // Only switches between paths that were set up
+                        if (gGpuCuller.IsInitialized()) {
+                            gGpuCullingEnabled = !gGpuCullingEnabled;
+                            std::cout << "GPU culling " << (gGpuCullingEnabled ? "on" : "off") << std::endl;
+                        }
+                        break;
+                    case SDLK_s:
+                        // Statistics of the last frame
+                        std::cout << "Frame time: " << gAverageFrameTimeMs << " ms average" << std::endl;
+                        if (gGpuCullingEnabled) {
+                            std::cout << "GPU culling: " << gGpuCuller.ReadVisibleCount() << "/" << gNumberOfInstances
+                                      << " instances visible" << std::endl;
+                            break;
+                        }
+                        if (gOcclusionCullingEnabled) {
+                            // Fractions of what was inside the frustum
+                            std::cout << "Occluded " << gOcclusionStats.chunksOccluded << "/" << gOcclusionStats.chunksTested
+                                      << " chunks, " << gOcclusionStats.instancesOccluded << "/" << gOcclusionStats.instancesTested
+                                      << " instances ("
+                                      << 100.0 * gOcclusionStats.instancesOccluded / std::max(gOcclusionStats.instancesTested, 1LL)
+                                      << "%) by " << gOcclusionStats.occluders << " occluders, rasterized in "
+                                      << gOcclusionStats.rasterizeMs << " ms, tested in " << gOcclusionStats.testMs << " ms"
+                                      << std::endl;
+                        }
+                        std::cout << "Culled " << gCullStats.chunksCulled << "/" << gCullStats.chunksTotal
+                                  << " chunks, " << gCullStats.instancesCulled << "/" << gCullStats.instancesTotal
+                                  << " instances, " << gCullStats.runs << " runs" << std::endl;
+                        {
+                            long long nearInstances = gCullStats.instancesTotal - gCullStats.instancesCulled - gCullStats.instancesFar;
+                            std::cout << "LOD: " << nearInstances << " meshes, " << gCullStats.instancesFar << " points, "
+                                      << gMeshDrawStats.vertices << " vertices" << std::endl;
+                            std::cout << "Mesh draws: " << gMeshDrawStats.commands << " commands in "
+                                      << gMeshDrawStats.drawCalls << " draw calls" << std::endl;
+                            // Waits for the last frame, fine on a key press
+                            GLuint64 submitted = 0;
+                            glGetQueryObjectui64v(gPrimitiveQuery, GL_QUERY_RESULT, &submitted);
+                            std::cout << "Primitives: " << submitted << " submitted";
+                            if (gBackFaceCullingEnabled) {
+                                std::cout << ", about " << EstimateFrontFacingTriangles()
+                                          << " triangles left after back-face culling";
+                            }
+                            std::cout << std::endl;
+                            GLuint64 fragments = 0;
+                            glGetQueryObjectui64v(gFragmentQuery, GL_QUERY_RESULT, &fragments);
+                            std::cout << "Fragments shaded: " << fragments << ", "
+                                      << (double)fragments / ((double)gScreenWidth * gScreenHeight) << " per pixel";
+                            if (gFrontToBackEnabled) {
+                                std::cout << ", " << gDepthOrderStats.chunks << " chunks ordered front to back in "
+                                          << gDepthOrderStats.sortMs << " ms";
+                            }
+                            std::cout << std::endl;
+                        }
+                        if (gStreamingEnabled) {
+                            ChunkStreamerStats streaming = gChunkStreamer.GetStats();
+                            std::cout << "Streaming: " << streaming.residentChunks << "/" << streaming.poolSlots
+                                      << " pool slots used, " << streaming.pendingChunks << " pending, "
+                                      << streaming.chunksGenerated << " generated, latency avg "
+                                      << streaming.averageLatencyMs << " ms, max " << streaming.maxLatencyMs
+                                      << " ms, last " << streaming.lastLatencyMs << " ms" << std::endl;
+                        }
+                        if (gInstanceRing.IsInitialized()) {
+                            // Stalls mean the ring has too few frames
+                            RingBufferStats ring = gInstanceRing.GetStats();
+                            std::cout << "Instance ring: " << ring.stalls << "/" << ring.frames << " frames stalled, "
+                                      << ring.stallTimeMs << " ms waiting" << std::endl;
+                        }
+                        {
+                            UniformUploadStats uniforms = gGraphicsPipelineShaderProgram.GetLastFrameStats();
+                            std::cout << "Uniforms: " << uniforms.uploads << " uploads, " << uniforms.skipped
+                                      << " unchanged skipped, " << uniforms.inactive << " inactive" << std::endl;
+                            GLStateStats state = GLStateCache::Instance().GetLastFrameStats();
+                            std::cout << "GL state: " << state.issued << " issued, " << state.filtered
+                                      << " filtered" << std::endl;
+                        }
+                        if (gInstanceStore.IsInitialized()) {
+                            InstanceStoreStats update = gInstanceStore.GetStats();
+                            std::cout << "Instance update (" << gInstanceStore.GetKernelName() << "): last "
+                                      << update.lastUpdateMs << " ms, avg " << update.averageUpdateMs << " ms, max "
+                                      << update.maxUpdateMs << " ms for " << gInstanceStore.GetNumberOfInstances()
+                                      << " instances" << std::endl;
+                        }
+                        break;
+                    case SDLK_m:
+                        // Cycles through the animations, none included
+                        if (gInstanceStore.IsInitialized()) {
+                            gInstanceAnimation = (InstanceAnimation)(((int)gInstanceAnimation + 1) % ((int)InstanceAnimation::Drift + 1));
+                            std::cout << "Animation: " << GetInstanceAnimationName(gInstanceAnimation) << std::endl;
+                        }
+                        break;
+                    case SDLK_p:
+                        gPerVertexMvp = !gPerVertexMvp;
+                        std::cout << "MVP " << (gPerVertexMvp ? "multiplied per vertex" : "precomputed per frame") << std::endl;
+                        break;
+                    case SDLK_i:
+                        // Compare the submission cost of both paths
+                        gMultiDrawEnabled = !gMultiDrawEnabled;
+                        std::cout << "Multi-draw " << (gMultiDrawEnabled ? "on" : "off") << std::endl;
+                        break;
+                    case SDLK_b:
+                        gBackFaceCullingEnabled = !gBackFaceCullingEnabled;
+                        std::cout << "Back-face culling " << (gBackFaceCullingEnabled ? "on" : "off") << std::endl;
+                        break;
+                    case SDLK_t:
+                        // Starts profiling, then dumps what it has so far
+                        if (!FrameProfiler::Instance().IsEnabled()) {
+                            FrameProfiler::Instance().Enable();
+                            std::cout << "Profiling on" << std::endl;
+                        } else {
+                            FrameProfiler::Instance().Print();
+                            if (FrameProfiler::Instance().WriteCSV(gProfileOutput)) {
+                                std::cout << "Profile written to " << gProfileOutput << std::endl;
+                            }
+                        }
+                        break;
+                    case SDLK_h:
+                        // Only if the occluder positions were kept
+                        if (gOcclusionCuller.IsInitialized()) {
+                            gOcclusionCullingEnabled = !gOcclusionCullingEnabled;
+                            std::cout << "Occlusion culling " << (gOcclusionCullingEnabled ? "on" : "off") << std::endl;
+                        }
+                        break;
+                    case SDLK_o:
+                        // Compare the fragments shaded in both orders
+                        gFrontToBackEnabled = !gFrontToBackEnabled;
+                        std::cout << "Front to back order " << (gFrontToBackEnabled ? "on" : "off") << std::endl;
+                        break;
+                    case SDLK_l:
+                        gLodEnabled = !gLodEnabled;
+                        std::cout << "Level of detail " << (gLodEnabled ? "on" : "off") << std::endl;
+                        break;
+                    case SDLK_f:
+                        {
+                            // Cycles linear, bilinear, trilinear and 16x anisotropic
+                            if (gTextureSampling.anisotropy > 1.0f) {
+                                gTextureSampling = TextureSampling();
+                                gTextureSampling.filter = TextureFilter::Linear;
+                            } else if (gTextureSampling.filter == TextureFilter::Trilinear) {
+                                gTextureSampling.anisotropy = 16.0f;
+                            } else {
+                                gTextureSampling.filter = (TextureFilter)((int)gTextureSampling.filter + 1);
+                            }
+                            GLStateCache::Instance().ActiveTexture(GL_TEXTURE0);
+                            GLStateCache::Instance().BindTexture(GL_TEXTURE_2D, gTextureID);
+                            float anisotropy = ApplyTextureSampling(gTextureSampling);
+                            std::cout << "Texture filtering " << GetTextureFilterName(gTextureSampling.filter) << ", "
+                                      << anisotropy << "x anisotropy" << std::endl;
+                        }
+                        break;
                 }
                 break;
         }
@@ -521,81 +1365,990 @@ void Input() {
 
 
 void PreDraw() {
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-    glDepthFunc(GL_LESS);
+    // Uniform uploads and state changes are counted per frame
+    gGraphicsPipelineShaderProgram.BeginFrame();
+    GLStateCache& state = GLStateCache::Instance();
+    state.BeginFrame();
+    state.Enable(GL_DEPTH_TEST);
+    if (gBackFaceCullingEnabled) {
+        state.Enable(GL_CULL_FACE);
+        state.CullFace(GL_BACK);
+        state.FrontFace(GL_CCW);
+    } else {
+        state.Disable(GL_CULL_FACE);
+    }
+    state.DepthFunc(GL_LESS);
     // Initialize clear color
     // This is the background of the screen.
-    glViewport(0, 0, gScreenWidth, gScreenHeight);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    state.Viewport(0, 0, gScreenWidth, gScreenHeight);
+    state.ClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-    glUseProgram(gGraphicsPipelineShaderProgram);
+    gGraphicsPipelineShaderProgram.Use();
 
     // MVP
     glm::mat4 projection = glm::perspective(glm::radians(45.0f), ((float)gScreenWidth) / ((float) gScreenHeight), 0.1f, 1024.0f);
+    // Far instances are drawn as points sized like the cube would be
+    state.Enable(GL_PROGRAM_POINT_SIZE);
+
+    FrameConstants constants;
+    constants.model = gTransform.GetInternalMatrix();
+    constants.view = Camera::Instance().GetWorldToViewmatrix();
+    constants.projection = projection;
+    constants.modelViewProjection = projection * constants.view * constants.model;
+    constants.cameraPosition = glm::vec4(GetEyePosition(), 1.0f);
+    constants.viewport = glm::vec4((float)gScreenWidth, (float)gScreenHeight,
+                                   2.0f * gInstancePadding * projection[1][1] * 0.5f * (float)gScreenHeight, 0.0f);
+    gFrameConstants.Update(constants);
+    // Same matrix the vertex shader uses, for culling in Draw()
+    gFrustum = Frustum(constants.modelViewProjection);
+    gModelViewProjection = constants.modelViewProjection;
+    gModel = constants.model;
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.perVertexMvp, gPerVertexMvp);
+    // Packed mesh positions are fractions of the largest extent
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.meshPositionScale, gMeshRegistry.GetPositionScale());
+
+
+    state.ActiveTexture(GL_TEXTURE0);
+    state.BindTexture(GL_TEXTURE_2D, gTextureID);
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.texture, 0);
+
+    // Tell the vertex shader how to decode the instance offsets
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.instanceFormat, (GLint)gInstanceFormat);
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.instanceTransform, (GLint)gInstanceTransformFormat);
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.gridSpacing, gInstanceGrid.spacing);
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.chunkSize, gInstanceFormatChunkSize);
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.gridStart, gInstanceGrid.start);
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.gridCells, gInstanceGrid.GetCellsPerAxis());
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.gridDimensions, gInstanceGrid.dimensions);
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.gridBrickCells, gGridBrickCells);
+    state.ActiveTexture(GL_TEXTURE1);
+    state.BindTexture(GL_TEXTURE_BUFFER, gChunkScaleBiasTexture);
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.chunkScaleBias, 1);
+    state.ActiveTexture(GL_TEXTURE0);
 
-    GLint modelMatrixUniformLocation =  glGetUniformLocation(gGraphicsPipelineShaderProgram,"model");
-    GLint viewMatrixUniformLocation = glGetUniformLocation(gGraphicsPipelineShaderProgram,"view");
-    GLint projectionMatrixUniformLocation = glGetUniformLocation(gGraphicsPipelineShaderProgram,"projection");
-    glUniformMatrix4fv(modelMatrixUniformLocation, 1, GL_FALSE, &gTransform.GetInternalMatrix()[0][0]);
-    glUniformMatrix4fv(viewMatrixUniformLocation, 1, GL_FALSE, &Camera::Instance().GetWorldToViewmatrix()[0][0]);
-    glUniformMatrix4fv(projectionMatrixUniformLocation, 1, GL_FALSE, &projection[0][0]);
+}
 
+// Draws instanceCount copies of a mesh starting at baseInstance, or
+// one point per instance for the far level of detail. gl_InstanceID
+// does not include the base instance, so the shader gets it as a
+// uniform for the formats that work from gl_InstanceID. Without GL 4.2
+// base-instance draws the instance attribute is re-pointed at the
+// first instance instead.
+void DrawInstances(GLint baseInstance, GLsizei instanceCount, bool asPoints = false, int meshId = 0) {
+    const Mesh& mesh = gMeshRegistry.GetMesh(meshId);
+    GLenum indexType = gMeshRegistry.GetIndexType();
+    void* firstIndex = (void*)((std::size_t)mesh.firstIndex * gMeshRegistry.GetIndexSize());
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.baseInstance, baseInstance);
+    gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.pointProxy, asPoints);
+    if (GLAD_GL_VERSION_4_2) {
+        if (asPoints) {
+            glDrawArraysInstancedBaseInstance(GL_POINTS, 0, 1, instanceCount, baseInstance);
+        } else {
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, mesh.indexCount, indexType, firstIndex,
+                                                          instanceCount, mesh.baseVertex, baseInstance);
+        }
+        return;
+    }
+    if (gInstanceVBO != 0) {
+        GLStateCache::Instance().BindBuffer(GL_ARRAY_BUFFER, gInstanceVBO);
+        glVertexAttribPointer(2, gInstanceAttribute.components, gInstanceAttribute.type,
+                              gInstanceAttribute.normalized, gInstanceAttribute.stride,
+                              (void*)(gInstanceBufferOffset + (std::size_t)baseInstance * gInstanceAttribute.stride));
+    }
+    PointInstanceTransforms(baseInstance);
+    if (asPoints) {
+        glDrawArraysInstanced(GL_POINTS, 0, 1, instanceCount);
+    } else {
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, indexType, firstIndex,
+                                          instanceCount, mesh.baseVertex);
+    }
+}
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glEnable(GL_TEXTURE_2D);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, gTextureID);
-    GLint textureLocation = glGetUniformLocation(gGraphicsPipelineShaderProgram, "u_Texture");
-    glUniform1i(textureLocation, 0);    
+// Fills the occlusion buffer with the cubes of the nearest visible
+// chunks, up to gOccluderBudget of them. Only the box that fits inside
+// every cube, whatever its rotation and scale, is rasterized, so an
+// occluder never covers more than the cube drawn there. Chunks of
+// the other meshes do not occlude.
+void RasterizeOccluders(const Frustum& frustum) {
+    // Occluders and chunk bounds are in model space
+    glm::vec3 eye = GetModelSpaceEyePosition();
+    gOcclusionCuller.BeginFrame(gModelViewProjection, eye);
+    std::vector<std::pair<float, std::size_t>> nearest;
+    for (std::size_t c = 0; c < gInstanceChunks.size(); ++c) {
+        const InstanceChunk& chunk = gInstanceChunks[c];
+        if (chunk.mesh == 0 && frustum.IntersectsBox(chunk.boundsMin, chunk.boundsMax)) {
+            glm::vec3 toChunk = glm::clamp(eye, chunk.boundsMin, chunk.boundsMax) - eye;
+            nearest.push_back(std::make_pair(glm::dot(toChunk, toChunk), c));
+        }
+    }
+    std::sort(nearest.begin(), nearest.end());
+    // A rotated cube still contains its inscribed sphere, and the
+    // sphere the axis aligned box of half its radius / sqrt(3)
+    bool transformed = gInstanceTransformFormat != InstanceTransformFormat::None;
+    float half = gInstancePadding * (transformed ? gInstanceMinScale / std::sqrt(3.0f) : 1.0f);
+    int budget = gOccluderBudget;
+    for (const auto& entry : nearest) {
+        const InstanceChunk& chunk = gInstanceChunks[entry.second];
+        for (GLint i = chunk.firstInstance; i < chunk.firstInstance + chunk.instanceCount && budget > 0; ++i, --budget) {
+            glm::vec3 position = gOccluderOffsets.empty()
+                ? GetBrickInstancePosition(gInstanceGrid, gGridBrickCells, i)
+                : glm::vec3(gOccluderOffsets[i * 3], gOccluderOffsets[i * 3 + 1], gOccluderOffsets[i * 3 + 2]);
+            gOcclusionCuller.AddOccluder(position - glm::vec3(half), position + glm::vec3(half));
+        }
+        if (budget <= 0) {
+            break;
+        }
+    }
+    gOcclusionCuller.BuildPyramid();
+}
 
+// Draws the near runs. The snorm16 and procedural formats need
+// u_BaseInstance per run, which a multi-draw cannot change between
+// its commands, so they always take one draw per run.
+void DrawMeshRuns(const std::vector<InstanceRun>& runs) {
+    gDrawCommands.clear();
+    for (const InstanceRun& run : runs) {
+        const Mesh& mesh = gMeshRegistry.GetMesh(run.mesh);
+        DrawElementsIndirectCommand command;
+        command.count = mesh.indexCount;
+        command.instanceCount = run.instanceCount;
+        command.firstIndex = mesh.firstIndex;
+        command.baseVertex = mesh.baseVertex;
+        command.baseInstance = run.firstInstance;
+        gDrawCommands.push_back(command);
+        gMeshDrawStats.vertices += (long long)mesh.indexCount * run.instanceCount;
+    }
+    gMeshDrawStats.commands = (int)gDrawCommands.size();
+    bool perRunBase = gInstanceFormat == InstanceFormat::Snorm16 || gInstanceFormat == InstanceFormat::Procedural;
+    if (gMultiDrawEnabled && GLAD_GL_VERSION_4_2 && !perRunBase) {
+        gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.baseInstance, 0);
+        gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.pointProxy, false);
+        gMeshDrawStats.drawCalls += gMeshRegistry.MultiDraw(gDrawCommands);
+        return;
+    }
+    for (const InstanceRun& run : runs) {
+        DrawInstances(run.firstInstance, run.instanceCount, false, run.mesh);
+    }
+    gMeshDrawStats.drawCalls += (int)runs.size();
 }
 
 void Draw() {
 
-    // Enable our attributes
-    glBindVertexArray(gVertexArrayObject);
-    // Select the vertex buffer object we want to enable
-    glBindBuffer(GL_ARRAY_BUFFER, gVertexBufferObject);
+    if (gStreamingEnabled) {
+        // Bring in the chunks around the camera before culling them
+        TraceScope scope("StreamChunks", true);
+        gChunkStreamer.Update(GetModelSpaceEyePosition(), gInstanceVBO, gStreamingUploadsPerFrame);
+        gInstanceChunks = gChunkStreamer.GetResidentChunks();
+        AssignChunkMeshes(gInstanceChunks, gMeshTypes);
+    }
+    gMeshDrawStats = MeshDrawStats();
+
+    // Enable our attributes, the VAO already references the vertex buffer
+    GLStateCache::Instance().BindVertexArray(gVertexArrayObject);
     // render data
-    glDrawElementsInstanced(GL_TRIANGLES, gIndices.size(), GL_UNSIGNED_INT, nullptr, gNumberOfInstances);
-    glBindVertexArray(0);
-    // Stop using our current graphics pipeline
-    glUseProgram(0);
+    if (gGpuCullingEnabled) {
+        // The compute pass leaves the program bound, switch back after
+        {
+            TraceScope scope("GpuCull", true);
+            gGpuCuller.Cull(gFrustum, gInstancePadding);
+        }
+        gGraphicsPipelineShaderProgram.Use();
+        // Compacted offsets are plain floats starting at instance 0
+        gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.instanceFormat, (GLint)InstanceFormat::Float32);
+        gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.baseInstance, 0);
+        GLStateCache::Instance().BindVertexArray(gCulledVertexArrayObject);
+        gGpuCuller.Draw(gMeshRegistry.GetIndexType());
+        gMeshDrawStats.commands = 1;
+        gMeshDrawStats.drawCalls = 1;
+    } else if (gCullingEnabled || gStreamingEnabled || gMeshTypes > 1 || gFrontToBackEnabled || gOcclusionCullingEnabled) {
+        // The near runs of visible chunks go out as one multi-draw, far
+        // chunks as points. The streaming pool has empty slots and the
+        // meshes are picked per chunk, so both always go through the
+        // chunk list, with a frustum that accepts all if culling is off.
+        // So does the front to back order, which is an order of chunks.
+        Frustum frustum = gCullingEnabled ? gFrustum : Frustum();
+        float lodDistance = gLodEnabled ? gLodDistance : INFINITY;
+        const std::vector<InstanceChunk>* chunks = &gInstanceChunks;
+        if (gOcclusionCullingEnabled) {
+            // Occluders only help where the frustum already is
+            TraceScope scope("OcclusionCull");
+            RasterizeOccluders(gFrustum);
+            gOcclusionStats = gOcclusionCuller.CullChunks(gInstanceChunks, gFrustum, gUnoccludedChunks);
+            chunks = &gUnoccludedChunks;
+        }
+        {
+            TraceScope scope("CullChunks");
+            // The chunk bounds are in model space, like for the occluders
+            glm::vec3 eye = GetModelSpaceEyePosition();
+            if (gFrontToBackEnabled) {
+                glm::vec3 viewDirection(Camera::Instance().GetViewXDirection(),
+                                        Camera::Instance().GetViewYDirection(),
+                                        Camera::Instance().GetViewZDirection());
+                viewDirection = glm::vec3(glm::inverse(gModel) * glm::vec4(viewDirection, 0.0f));
+                gCullStats = CullChunksLodFrontToBack(*chunks, frustum, eye, viewDirection,
+                                                      lodDistance, gVisibleRuns, gFarRuns, gDepthOrderStats);
+            } else {
+                gCullStats = CullChunksLod(*chunks, frustum, eye, lodDistance, gVisibleRuns, gFarRuns);
+            }
+        }
+        DrawMeshRuns(gVisibleRuns);
+        for (const InstanceRun& run : gFarRuns) {
+            DrawInstances(run.firstInstance, run.instanceCount, true);
+        }
+        gMeshDrawStats.drawCalls += (int)gFarRuns.size();
+        gMeshDrawStats.vertices += gCullStats.instancesFar;
+        gGraphicsPipelineShaderProgram.SetUniform(gPipelineUniforms.pointProxy, false);
+    } else {
+        gCullStats = CullStats();
+        DrawInstances(0, gNumberOfInstances);
+        gMeshDrawStats.commands = 1;
+        gMeshDrawStats.drawCalls = 1;
+        gMeshDrawStats.vertices = (long long)gMeshRegistry.GetMesh(0).indexCount * gNumberOfInstances;
+    }
+    // The VAO and program stay bound, next frame's binds are filtered
 
 }
 
-void MainLoop() {
-    while (!gQuit) {
-        Input();
+// Writes this frame's instance data into the next ring slot and
+// points attribute 2 at it
+void UpdateInstances() {
+    if (!gInstanceRing.IsInitialized()) {
+        return;
+    }
+    void* data = gInstanceRing.BeginWrite();
+    if (data != nullptr && gInstanceStore.IsInitialized()) {
+        float seconds = gBenchmarkFrame >= 0 ? gBenchmarkFrame / 60.0f : SDL_GetTicks() / 1000.0f;
+        gInstanceStore.Update(gInstanceAnimation, seconds, (GLfloat*)data);
+    } else if (data != nullptr) {
+        memcpy(data, gInstanceData.data(), gInstanceData.size());
+    }
+    gInstanceRing.EndWrite();
+    gInstanceBufferOffset = gInstanceRing.GetWriteOffset();
+    GLStateCache::Instance().BindVertexArray(gVertexArrayObject);
+    GLStateCache::Instance().BindBuffer(GL_ARRAY_BUFFER, gInstanceVBO);
+    glVertexAttribPointer(2, gInstanceAttribute.components, gInstanceAttribute.type,
+                          gInstanceAttribute.normalized, gInstanceAttribute.stride, (void*)gInstanceBufferOffset);
+}
+
+// Everything that goes into one frame, apart from input and the swap
+void DrawFrame() {
+    {
+        ProfileScope scope(ProfileStage::UpdateInstances);
+        UpdateInstances();
+    }
+    {
+        ProfileScope scope(ProfileStage::PreDraw, true);
         PreDraw();
+    }
+    {
+        ProfileScope scope(ProfileStage::Draw, true);
+        glBeginQuery(GL_PRIMITIVES_GENERATED, gPrimitiveQuery);
+        glBeginQuery(GL_SAMPLES_PASSED, gFragmentQuery);
         Draw();
-        // Update the screen
-        SDL_GL_SwapWindow(gGraphicsApplicationWindow);
+        glEndQuery(GL_SAMPLES_PASSED);
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+    }
+    // The GPU may reuse the slot once this frame's draws are done
+    if (gInstanceRing.IsInitialized()) {
+        gInstanceRing.FinishFrame();
     }
+    gFrameConstants.FinishFrame();
+    gMeshRegistry.FinishFrame();
+}
+
+// Renders the same view with each transform format that has a buffer
+// and reports bytes per instance and the average frame time. glFinish
+// makes every frame include the GPU time.
+void BenchmarkInstanceTransforms() {
+    const int warmupFrames = 10;
+    const int measuredFrames = 100;
+    InstanceTransformFormat requested = gInstanceTransformFormat;
+    for (int i = 0; i <= (int)InstanceTransformFormat::Matrix; ++i) {
+        InstanceTransformFormat format = (InstanceTransformFormat)i;
+        GLsizei bytes = gInstanceVBO != 0 ? gInstanceAttribute.stride : 0;
+        if (format == InstanceTransformFormat::Packed) {
+            if (gInstanceTransformVBO == 0) {
+                continue;
+            }
+            bytes += sizeof(PackedInstanceTransform);
+        } else if (format == InstanceTransformFormat::Matrix) {
+            if (gInstanceMatrixVBO == 0) {
+                continue;
+            }
+            bytes = sizeof(glm::mat4);
+        }
+        UseInstanceTransformFormat(format);
+        double totalMs = 0.0;
+        for (int frame = 0; frame < warmupFrames + measuredFrames; ++frame) {
+            auto start = std::chrono::steady_clock::now();
+            DrawFrame();
+            glFinish();
+            if (frame >= warmupFrames) {
+                totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+        }
+        std::cout << "Transform benchmark: " << GetInstanceTransformFormatName(format) << ", "
+                  << bytes << " bytes per instance, "
+                  << (double)bytes * gNumberOfInstances / (1024.0 * 1024.0) << " MB, "
+                  << totalMs / measuredFrames << " ms per frame" << std::endl;
+    }
+    UseInstanceTransformFormat(requested);
+}
+
+// Corners of the lattice of cube positions
+void GetLatticeBounds(glm::vec3& boxMin, glm::vec3& boxMax) {
+    boxMin = glm::vec3(0.0f);
+    boxMax = glm::vec3(0.0f);
+    for (int axis = 0; axis < gInstanceGrid.dimensions; ++axis) {
+        boxMin[axis] = gInstanceGrid.start * gInstanceGrid.spacing;
+        boxMax[axis] = (gInstanceGrid.end - 1) * gInstanceGrid.spacing;
+    }
+}
+
+// Times the mip generators on the texture and on a 4096x4096 tiling
+// of it, then renders the lattice from far outside, where a cube
+// covers a few pixels and the texture is minified the most, with each
+// filtering mode. glFinish makes every frame include the GPU time.
+void BenchmarkTextures() {
+    const int runs = 5;
+    const int warmupFrames = 10;
+    const int measuredFrames = 100;
+    Image source;
+    if (gTextureFile.empty() || !LoadPPMImage(gTextureFile, true, source)) {
+        std::cout << "Texture benchmark: no texture to measure" << std::endl;
+        return;
+    }
+    Image tiled;
+    tiled.Allocate(4096, 4096, source.GetChannels());
+    std::size_t sourceRow = (std::size_t)source.GetWidth() * source.GetChannels();
+    for (int y = 0; y < tiled.GetHeight(); ++y) {
+        const unsigned char* from = source.GetPixels() + (std::size_t)(y % source.GetHeight()) * sourceRow;
+        unsigned char* to = tiled.GetPixels() + (std::size_t)y * tiled.GetWidth() * tiled.GetChannels();
+        for (int x = 0; x < tiled.GetWidth(); ++x) {
+            memcpy(to + (std::size_t)x * tiled.GetChannels(), from + (std::size_t)(x % source.GetWidth()) * source.GetChannels(),
+                   tiled.GetChannels());
+        }
+    }
+
+    GLenum format = source.GetChannels() == 1 ? GL_RED : GL_RGB;
+    for (const Image* image : {&source, &tiled}) {
+        // Best of a few runs of a chain builder, in ms
+        auto bestOf = [&](auto build) {
+            double bestMs = INFINITY;
+            for (int run = 0; run < runs; ++run) {
+                auto start = std::chrono::steady_clock::now();
+                build();
+                bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+            return bestMs;
+        };
+        std::vector<Image> scalarLevels;
+        double scalarMs = bestOf([&]() {
+            scalarLevels.clear();
+            scalarLevels.resize(GetMipLevelCount(image->GetWidth(), image->GetHeight()) - 1);
+            const Image* above = image;
+            for (Image& level : scalarLevels) {
+                DownsampleImageScalar(*above, level);
+                above = &level;
+            }
+        });
+        std::vector<Image> boxLevels;
+        double boxMs = bestOf([&]() { BuildMipChain(*image, boxLevels, MipFilter::Box); });
+        std::vector<Image> kaiserLevels;
+        double kaiserMs = bestOf([&]() { BuildMipChain(*image, kaiserLevels, MipFilter::Kaiser); });
+        bool same = scalarLevels.size() == boxLevels.size();
+        for (std::size_t i = 0; same && i < boxLevels.size(); ++i) {
+            same = memcmp(scalarLevels[i].GetPixels(), boxLevels[i].GetPixels(), boxLevels[i].GetSize()) == 0;
+        }
+
+        // The driver's chain from a base level that is already uploaded.
+        // Bound through the cache, the frames after this draw with it.
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        GLStateCache::Instance().ActiveTexture(GL_TEXTURE0);
+        GLStateCache::Instance().BindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format == GL_RED ? GL_R8 : GL_RGB8, image->GetWidth(), image->GetHeight(), 0,
+                     format, GL_UNSIGNED_BYTE, image->GetPixels());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glFinish();
+        double gpuMs = bestOf([&]() {
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glFinish();
+        });
+        GLStateCache::Instance().BindTexture(GL_TEXTURE_2D, 0);
+        glDeleteTextures(1, &texture);
+
+        std::cout << "Mip benchmark: " << image->GetWidth() << "x" << image->GetHeight() << "x" << image->GetChannels()
+                  << ", scalar box " << scalarMs << " ms, " << GetMipKernelName() << " box on " << GetWorkerCount() << " threads "
+                  << boxMs << " ms (" << scalarMs / boxMs << "x, levels " << (same ? "identical" : "DIFFER")
+                  << "), kaiser " << kaiserMs << " ms, glGenerateMipmap " << gpuMs << " ms" << std::endl;
+    }
+
+    // Points would not sample the texture, so every cube is drawn
+    bool lodEnabled = gLodEnabled;
+    gLodEnabled = false;
+    Camera& camera = Camera::Instance();
+    glm::vec3 eye(camera.GetEyeXPosition(), camera.GetEyeYPosition(), camera.GetEyeZPosition());
+    glm::vec3 viewDirection(camera.GetViewXDirection(), camera.GetViewYDirection(), camera.GetViewZDirection());
+    glm::vec3 boxMin;
+    glm::vec3 boxMax;
+    GetLatticeBounds(boxMin, boxMax);
+    glm::vec3 center = 0.5f * (boxMin + boxMax);
+    float halfSize = 0.5f * std::max(boxMax.x - boxMin.x, std::max(boxMax.y - boxMin.y, boxMax.z - boxMin.z));
+    // Far enough that the lattice is a few hundred pixels across, near
+    // enough that its back stays in front of the far plane
+    float distance = std::max(4.0f * halfSize, std::min(8.0f * halfSize, 1000.0f - 2.0f * halfSize));
+    glm::vec3 farEye = center + distance * glm::normalize(glm::vec3(0.3f, 0.4f, 1.0f));
+    camera.SetPose(farEye, glm::normalize(center - farEye));
+
+    std::vector<TextureSampling> modes(3);
+    modes[0].filter = TextureFilter::Linear;
+    modes[1].filter = TextureFilter::Bilinear;
+    float maximumAnisotropy = GetMaxTextureAnisotropy();
+    for (float anisotropy = 2.0f; anisotropy <= maximumAnisotropy; anisotropy *= 2.0f) {
+        modes.push_back(TextureSampling());
+        modes.back().anisotropy = anisotropy;
+    }
+    GLStateCache::Instance().ActiveTexture(GL_TEXTURE0);
+    GLStateCache::Instance().BindTexture(GL_TEXTURE_2D, gTextureID);
+    double linearMs = 0.0;
+    for (const TextureSampling& mode : modes) {
+        float anisotropy = ApplyTextureSampling(mode);
+        std::vector<double> frameTimesMs;
+        for (int frame = 0; frame < warmupFrames + measuredFrames; ++frame) {
+            auto start = std::chrono::steady_clock::now();
+            DrawFrame();
+            glFinish();
+            if (frame >= warmupFrames) {
+                frameTimesMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+        ProfileSummary summary = SummarizeTimes(frameTimesMs);
+        if (mode.filter == TextureFilter::Linear) {
+            linearMs = summary.meanMs;
+        }
+        std::cout << "Texture benchmark: far field, " << GetTextureFilterName(mode.filter) << ", " << anisotropy
+                  << "x anisotropy, average " << summary.meanMs << " ms, p99 " << summary.p99Ms << " ms, "
+                  << 100.0 * (summary.meanMs - linearMs) / linearMs << "% over linear" << std::endl;
+    }
+    ApplyTextureSampling(gTextureSampling);
+    camera.SetPose(eye, viewDirection);
+    gLodEnabled = lodEnabled;
+}
+
+void MainLoop() {
+    auto lastFrame = std::chrono::steady_clock::now();
+    while (!gQuit) {
+        Tracer::Instance().BeginFrame();
+        FrameProfiler::Instance().BeginFrame();
+        {
+            ProfileScope frameScope(ProfileStage::Frame);
+            {
+                ProfileScope scope(ProfileStage::Input);
+                Input();
+            }
+            if (!gRecordPathFile.empty()) {
+                CameraPose pose;
+                pose.eye = GetEyePosition();
+                pose.viewDirection = glm::vec3(Camera::Instance().GetViewXDirection(),
+                                               Camera::Instance().GetViewYDirection(),
+                                               Camera::Instance().GetViewZDirection());
+                gRecordedPath.Add(pose);
+            }
+            DrawFrame();
+            // Update the screen
+            ProfileScope scope(ProfileStage::Swap);
+            SDL_GL_SwapWindow(gGraphicsApplicationWindow);
+        }
+        auto now = std::chrono::steady_clock::now();
+        double frameTimeMs = std::chrono::duration<double, std::milli>(now - lastFrame).count();
+        lastFrame = now;
+        gAverageFrameTimeMs += (frameTimeMs - gAverageFrameTimeMs) * 0.05;
+    }
+}
+
+// Draws gHeadlessFrames frames without input. glFinish makes every
+// frame include the GPU time, the first frame is reported on its own
+// since it also pays for shader and buffer setup in the driver.
+void HeadlessLoop() {
+    double firstMs = 0.0;
+    double totalMs = 0.0;
+    double minMs = INFINITY;
+    double maxMs = 0.0;
+    for (int frame = 0; frame < gHeadlessFrames; ++frame) {
+        Tracer::Instance().BeginFrame();
+        FrameProfiler::Instance().BeginFrame();
+        auto start = std::chrono::steady_clock::now();
+        {
+            ProfileScope frameScope(ProfileStage::Frame);
+            DrawFrame();
+            ProfileScope scope(ProfileStage::Swap);
+            glFinish();
+        }
+        double frameTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        gAverageFrameTimeMs = frameTimeMs;
+        if (frame == 0) {
+            firstMs = frameTimeMs;
+            continue;
+        }
+        totalMs += frameTimeMs;
+        minMs = std::min(minMs, frameTimeMs);
+        maxMs = std::max(maxMs, frameTimeMs);
+    }
+    std::cout << "Headless: first frame " << firstMs << " ms";
+    if (gHeadlessFrames > 1) {
+        std::cout << ", then " << totalMs / (gHeadlessFrames - 1) << " ms average, " << minMs << " ms min, "
+                  << maxMs << " ms max over " << gHeadlessFrames - 1 << " frames";
+    }
+    std::cout << std::endl;
+    if (!gHeadlessOutput.empty() && gHeadlessContext.WritePPM(gHeadlessOutput)) {
+        std::cout << "Headless: last frame written to " << gHeadlessOutput << std::endl;
+    }
+}
+
+// Loads the benchmark path, or lays one lap around the lattice
+void BenchmarkPathSpecification() {
+    if (!gBenchmarkPathFile.empty()) {
+        if (!gCameraPath.Load(gBenchmarkPathFile)) {
+            exit(1);
+        }
+        if (gBenchmarkFrames == 0) {
+            gBenchmarkFrames = gCameraPath.GetPoseCount();
+        }
+        return;
+    }
+    if (gBenchmarkFrames == 0) {
+        gBenchmarkFrames = 100;
+    }
+    glm::vec3 boxMin;
+    glm::vec3 boxMax;
+    GetLatticeBounds(boxMin, boxMax);
+    gCameraPath = CameraPath::MakeOrbit(boxMin, boxMax, gBenchmarkFrames);
+}
+
+// Finds "key": number in a report written by BenchmarkLoop()
+bool ReadBenchmarkValue(const std::string& json, const std::string& key, double& value) {
+    std::size_t at = json.find("\"" + key + "\":");
+    if (at == std::string::npos) {
+        return false;
+    }
+    value = atof(json.c_str() + at + key.size() + 3);
+    return true;
+}
+
+// Checks the report against gBenchmarkBaseline, true if it is no
+// slower than the tolerance allows
+bool CompareWithBaseline(const ProfileSummary& summary) {
+    std::ifstream file(gBenchmarkBaseline.c_str());
+    if (!file.is_open()) {
+        std::cout << "Benchmark: could not open baseline " << gBenchmarkBaseline << std::endl;
+        return false;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    double baselineAverageMs = 0.0;
+    double baselineP99Ms = 0.0;
+    if (!ReadBenchmarkValue(contents.str(), "avg_ms", baselineAverageMs)
+        || !ReadBenchmarkValue(contents.str(), "p99_ms", baselineP99Ms)) {
+        std::cout << "Benchmark: baseline " << gBenchmarkBaseline << " has no avg_ms and p99_ms" << std::endl;
+        return false;
+    }
+    double limit = 1.0 + gBenchmarkTolerance / 100.0;
+    bool passed = summary.meanMs <= baselineAverageMs * limit && summary.p99Ms <= baselineP99Ms * limit;
+    std::cout << "Benchmark: average " << summary.meanMs << " ms against " << baselineAverageMs
+              << " ms, p99 " << summary.p99Ms << " ms against " << baselineP99Ms << " ms, "
+              << (passed ? "passed" : "FAILED") << " (" << gBenchmarkTolerance << "% tolerance)" << std::endl;
+    return passed;
+}
+
+// Flies the camera along gCameraPath for the warm-up and measured
+// frames, without input. Every frame ends with glFinish so it includes
+// the GPU time. Returns false if the run is slower than the baseline.
+bool BenchmarkLoop() {
+    if (!gHeadless) {
+        // Timing the driver waiting for vsync tells nothing
+        SDL_GL_SetSwapInterval(0);
+    }
+    std::vector<double> frameTimesMs;
+    frameTimesMs.reserve(gBenchmarkFrames);
+    for (int frame = -gBenchmarkWarmupFrames; frame < gBenchmarkFrames && !gQuit; ++frame) {
+        if (!gHeadless) {
+            // Only closing the window is handled, the camera is scripted
+            SDL_Event e;
+            while (SDL_PollEvent(&e) != 0) {
+                gQuit = gQuit || e.type == SDL_QUIT;
+            }
+        }
+        gBenchmarkFrame = std::max(frame, 0);
+        const CameraPose& pose = gCameraPath.GetPose(gBenchmarkFrame);
+        Camera::Instance().SetPose(pose.eye, pose.viewDirection);
+        Tracer::Instance().BeginFrame();
+        FrameProfiler::Instance().BeginFrame();
+        auto start = std::chrono::steady_clock::now();
+        {
+            ProfileScope frameScope(ProfileStage::Frame);
+            DrawFrame();
+            ProfileScope scope(ProfileStage::Swap);
+            if (!gHeadless) {
+                SDL_GL_SwapWindow(gGraphicsApplicationWindow);
+            }
+            glFinish();
+        }
+        double frameTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        gAverageFrameTimeMs = frameTimeMs;
+        if (frame >= 0) {
+            frameTimesMs.push_back(frameTimeMs);
+        }
+    }
+    gBenchmarkFrame = -1;
+    if (frameTimesMs.empty()) {
+        std::cout << "Benchmark: no frames measured" << std::endl;
+        return false;
+    }
+
+    ProfileSummary summary = SummarizeTimes(frameTimesMs);
+    double totalSeconds = summary.meanMs * summary.samples / 1000.0;
+    double instancesPerSecond = (double)gNumberOfInstances * summary.samples / totalSeconds;
+    std::ostringstream report;
+    report << "{\"frames\":" << summary.samples
+           << ",\"warmup_frames\":" << gBenchmarkWarmupFrames
+           << ",\"instances\":" << gNumberOfInstances
+           << ",\"width\":" << gScreenWidth
+           << ",\"height\":" << gScreenHeight
+           << ",\"min_ms\":" << summary.minMs
+           << ",\"avg_ms\":" << summary.meanMs
+           << ",\"p50_ms\":" << summary.p50Ms
+           << ",\"p99_ms\":" << summary.p99Ms
+           << ",\"max_ms\":" << summary.maxMs
+           << ",\"fps\":" << 1000.0 / summary.meanMs
+           << ",\"instances_per_second\":" << instancesPerSecond << "}";
+    std::cout << "Benchmark: " << summary.samples << " frames of " << gNumberOfInstances << " instances, min "
+              << summary.minMs << " ms, average " << summary.meanMs << " ms, p99 " << summary.p99Ms << " ms, "
+              << instancesPerSecond / 1.0e6 << " M instances/s" << std::endl;
+    std::ofstream file(gBenchmarkOutput.c_str());
+    if (file.is_open()) {
+        file << report.str() << "\n";
+        std::cout << "Benchmark report written to " << gBenchmarkOutput << std::endl;
+    } else {
+        std::cout << "Could not write " << gBenchmarkOutput << std::endl;
+    }
+    if (!gHeadlessOutput.empty() && gHeadless && gHeadlessContext.WritePPM(gHeadlessOutput)) {
+        std::cout << "Headless: last frame written to " << gHeadlessOutput << std::endl;
+    }
+    return gBenchmarkBaseline.empty() || CompareWithBaseline(summary);
 }
 
 void Cleanup() {
-    SDL_DestroyWindow(gGraphicsApplicationWindow);
+    // Writes the trace if the frame range was not over yet
+    Tracer::Instance().Finish();
+    if (!gRecordPathFile.empty() && gRecordedPath.Save(gRecordPathFile)) {
+        std::cout << "Camera path of " << gRecordedPath.GetPoseCount() << " frames written to "
+                  << gRecordPathFile << std::endl;
+    }
+    if (FrameProfiler::Instance().IsEnabled()) {
+        FrameProfiler::Instance().Print();
+        if (FrameProfiler::Instance().WriteCSV(gProfileOutput)) {
+            std::cout << "Profile written to " << gProfileOutput << std::endl;
+        }
+        FrameProfiler::Instance().Destroy();
+    }
+    if (!gHeadless) {
+        SDL_DestroyWindow(gGraphicsApplicationWindow);
+    }
     // Delete OpenGL objects
-    glDeleteBuffers(1, &gVertexBufferObject);
+    gMeshRegistry.Destroy();
+    if (gInstanceRing.IsInitialized()) {
+        // The ring owns gInstanceVBO
+        gInstanceRing.Destroy();
+        gInstanceVBO = 0;
+    }
+    glDeleteBuffers(1, &gInstanceVBO);
+    glDeleteBuffers(1, &gChunkScaleBiasBuffer);
+    glDeleteBuffers(1, &gInstanceTransformVBO);
+    glDeleteBuffers(1, &gInstanceMatrixVBO);
+    glDeleteTextures(1, &gChunkScaleBiasTexture);
     glDeleteVertexArrays(1, &gVertexArrayObject);
+    glDeleteVertexArrays(1, &gCulledVertexArrayObject);
+    glDeleteQueries(1, &gPrimitiveQuery);
+    glDeleteQueries(1, &gFragmentQuery);
+    gGpuCuller.Destroy();
+    gChunkStreamer.Shutdown();
+    glDeleteProgram(gCullShaderProgram);
     // Delete Graphics Pipeline
-    glDeleteProgram(gGraphicsPipelineShaderProgram);
+    gGraphicsPipelineShaderProgram.Destroy();
+    gFrameConstants.Destroy();
+    if (gHeadless) {
+        gHeadlessContext.Destroy();
+        return;
+    }
     // Quit SDL subsystems
     SDL_Quit();
 }
 
+// Reads the command line options. Unknown options are reported
+// and ignored so the program still starts with the defaults.
+void ParseArguments(int argc, char* args[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = args[i];
+        std::string value;
+        std::size_t equals = argument.find('=');
+        if (equals != std::string::npos) {
+            value = argument.substr(equals + 1);
+            argument = argument.substr(0, equals);
+        }
+
+        if (argument == "--instance-format") {
+            if (!ParseInstanceFormat(value, gInstanceFormat)) {
+                std::cout << "Unknown instance format '" << value << "', expected float, half, snorm16, grid16 or procedural" << std::endl;
+            }
+        } else if (argument == "--stream") {
+            gStreamingEnabled = true;
+        } else if (argument == "--stream-radius") {
+            // Chunks kept in each direction around the camera
+            int radius = atoi(value.c_str());
+            if (radius > 0) {
+                gStreamingEnabled = true;
+                gStreamingRadius = radius;
+            }
+        } else if (argument == "--dynamic-instances") {
+            gDynamicInstances = true;
+        } else if (argument == "--ring-frames") {
+            // Frame slots of the dynamic instance ring
+            int frames = atoi(value.c_str());
+            if (frames > 0) {
+                gDynamicInstances = true;
+                gInstanceRingFrames = frames;
+            }
+        } else if (argument == "--animate") {
+            // Animation needs the instances rewritten every frame
+            if (ParseInstanceAnimation(value, gInstanceAnimation)) {
+                gDynamicInstances = gDynamicInstances || gInstanceAnimation != InstanceAnimation::None;
+            } else {
+                std::cout << "Unknown animation '" << value << "', expected none, wave, orbit or drift" << std::endl;
+            }
+        } else if (argument == "--instance-transform") {
+            if (!ParseInstanceTransformFormat(value, gInstanceTransformFormat)) {
+                std::cout << "Unknown instance transform '" << value << "', expected none, packed or matrix" << std::endl;
+            }
+        } else if (argument == "--benchmark-transforms") {
+            gTransformBenchmark = true;
+        } else if (argument == "--meshes") {
+            // Mesh types to spread the instances over, 1 is cubes only
+            int meshes = atoi(value.c_str());
+            if (meshes > 0) {
+                gMeshTypes = meshes;
+            }
+        } else if (argument == "--vertex-format") {
+            if (!ParseMeshVertexFormat(value, gMeshVertexFormat)) {
+                std::cout << "Unknown vertex format '" << value << "', expected float, snorm16 or snorm8" << std::endl;
+            }
+        } else if (argument == "--no-multi-draw") {
+            gMultiDrawEnabled = false;
+        } else if (argument == "--gpu-cull") {
+            gGpuCullingRequested = true;
+        } else if (argument == "--no-cull") {
+            gCullingEnabled = false;
+        } else if (argument == "--no-backface-cull") {
+            gBackFaceCullingEnabled = false;
+        } else if (argument == "--front-to-back") {
+            gFrontToBackEnabled = true;
+        } else if (argument == "--profile") {
+            // Optionally the CSV file, profile.csv otherwise
+            gProfilingRequested = true;
+            if (!value.empty()) {
+                gProfileOutput = value;
+            }
+        } else if (argument == "--trace") {
+            // Optionally the JSON file, trace.json otherwise
+            gTraceOutput = value.empty() ? "trace.json" : value;
+        } else if (argument == "--trace-frames") {
+            // Frames to trace as FIRST-LAST, both included
+            int first = 0;
+            int last = 0;
+            if (sscanf(value.c_str(), "%d-%d", &first, &last) == 2 && first >= 0 && last >= first) {
+                gTraceFirstFrame = first;
+                gTraceLastFrame = last;
+                if (gTraceOutput.empty()) {
+                    gTraceOutput = "trace.json";
+                }
+            } else {
+                std::cout << "Ignoring trace frames '" << value << "', expected FIRST-LAST" << std::endl;
+            }
+        } else if (argument == "--headless") {
+            gHeadless = true;
+        } else if (argument == "--frames") {
+            // Frames the headless mode or the benchmark renders
+            int frames = atoi(value.c_str());
+            if (frames > 0) {
+                gHeadlessFrames = frames;
+                gBenchmarkFrames = frames;
+            }
+        } else if (argument == "--self-test") {
+            gSelfTest = true;
+        } else if (argument == "--benchmark-ppm") {
+            // Comma separated image files, only the loaders run
+            std::stringstream files(value);
+            std::string file;
+            while (std::getline(files, file, ',')) {
+                if (!file.empty()) {
+                    gPPMBenchmarkFiles.push_back(file);
+                }
+            }
+        } else if (argument == "--texture-cache") {
+            // Directory of the decoded textures, texture_cache otherwise
+            if (!value.empty()) {
+                gTextureCache.SetDirectory(value);
+            }
+        } else if (argument == "--no-texture-cache") {
+            gTextureCache.SetEnabled(false);
+        } else if (argument == "--mips") {
+            if (!ParseMipGeneration(value, gMipGeneration)) {
+                std::cout << "Unknown mip generation '" << value << "', expected cpu, gpu or none" << std::endl;
+            }
+        } else if (argument == "--mip-filter") {
+            // Filter of the CPU mip levels
+            if (ParseMipFilter(value, gMipFilter)) {
+                gTextureCache.SetMipFilter(gMipFilter);
+            } else {
+                std::cout << "Unknown mip filter '" << value << "', expected box or kaiser" << std::endl;
+            }
+        } else if (argument == "--texture-filter") {
+            if (!ParseTextureFilter(value, gTextureSampling.filter)) {
+                std::cout << "Unknown texture filter '" << value << "', expected linear, bilinear or trilinear" << std::endl;
+            }
+        } else if (argument == "--anisotropy") {
+            // Maximum anisotropy, 1 is off
+            float anisotropy = (float)atof(value.c_str());
+            if (anisotropy >= 1.0f) {
+                gTextureSampling.anisotropy = anisotropy;
+            }
+        } else if (argument == "--benchmark-textures") {
+            gTextureBenchmark = true;
+        } else if (argument == "--benchmark") {
+            // Optionally a camera path file to replay
+            gBenchmark = true;
+            gBenchmarkPathFile = value;
+        } else if (argument == "--warmup") {
+            int frames = atoi(value.c_str());
+            if (frames >= 0) {
+                gBenchmarkWarmupFrames = frames;
+            }
+        } else if (argument == "--benchmark-output") {
+            gBenchmarkOutput = value;
+        } else if (argument == "--benchmark-baseline") {
+            gBenchmarkBaseline = value;
+        } else if (argument == "--benchmark-tolerance") {
+            // Percent the frame times may grow over the baseline
+            double tolerance = atof(value.c_str());
+            if (tolerance >= 0.0) {
+                gBenchmarkTolerance = tolerance;
+            }
+        } else if (argument == "--record-path") {
+            gRecordPathFile = value;
+        } else if (argument == "--instances") {
+            // Roughly this many cubes, rounded to a lattice of even width
+            long long instances = atoll(value.c_str());
+            if (instances > 0) {
+                int halfWidth = std::max(1, (int)std::lround(std::cbrt((double)instances) / 2.0));
+                gInstanceGrid.start = -halfWidth;
+                gInstanceGrid.end = halfWidth;
+            }
+        } else if (argument == "--size") {
+            // Window or offscreen framebuffer size as WIDTHxHEIGHT
+            int width = 0;
+            int height = 0;
+            if (sscanf(value.c_str(), "%dx%d", &width, &height) == 2 && width > 0 && height > 0) {
+                gScreenWidth = width;
+                gScreenHeight = height;
+            } else {
+                std::cout << "Ignoring size '" << value << "', expected WIDTHxHEIGHT" << std::endl;
+            }
+        } else if (argument == "--headless-output") {
+            gHeadlessOutput = value;
+        } else if (argument == "--occlusion-cull") {
+            gOcclusionCullingRequested = true;
+        } else if (argument == "--occluders") {
+            // Cubes rasterized into the occlusion buffer per frame
+            int budget = atoi(value.c_str());
+            if (budget > 0) {
+                gOccluderBudget = budget;
+            }
+        } else if (argument == "--chunk-extent") {
+            // World space size of one culling chunk
+            float extent = (float)atof(value.c_str());
+            if (extent > 0.0f) {
+                gChunkExtent = extent;
+            }
+        } else if (argument == "--lod-distance") {
+            // 0 turns the point level of detail off
+            float distance = (float)atof(value.c_str());
+            gLodEnabled = distance > 0.0f;
+            if (gLodEnabled) {
+                gLodDistance = distance;
+            }
+        } else if (argument == "--grid") {
+            // Half width of the lattice, --grid=100 gives 200^3 = 8M cubes
+            int halfWidth = atoi(value.c_str());
+            if (halfWidth > 0) {
+                gInstanceGrid.start = -halfWidth;
+                gInstanceGrid.end = halfWidth;
+            }
+        } else {
+            std::cout << "Ignoring unknown argument: " << args[i] << std::endl;
+        }
+    }
+}
+
 int main(int argc, char* args[]) {
+    ParseArguments(argc, args);
+    if (gSelfTest) {
+        return RunSelfTests() ? 0 : 1;
+    }
+    if (!gPPMBenchmarkFiles.empty()) {
+        // Needs neither a window nor a context
+        BenchmarkPPMLoaders();
+        return 0;
+    }
+    if (!gTraceOutput.empty()) {
+        Tracer::Instance().Enable(gTraceOutput, gTraceFirstFrame, gTraceLastFrame);
+        Tracer::Instance().SetThreadName("main");
+    }
     // Set up graphics program
-    InitializeProgram();
+    if (gHeadless) {
+        InitializeHeadless();
+    } else {
+        InitializeProgram();
+    }
+    Tracer::Instance().InitializeGpu();
     // Setup geometry
     VertexSpecification();
     // Create graphics pipeline
     CreateGraphicsPipeline();
+    // Optional compute shader culling
+    GpuCullingSpecification();
+    // Setup bound objects directly, start the frames from a clean shadow
+    GLStateCache::Instance().Invalidate();
+    if (gProfilingRequested) {
+        FrameProfiler::Instance().Enable();
+    }
+    if (gTransformBenchmark) {
+        BenchmarkInstanceTransforms();
+    }
+    if (gTextureBenchmark) {
+        BenchmarkTextures();
+    }
     // Main loop
-    MainLoop();
+    int status = 0;
+    if (gBenchmark) {
+        BenchmarkPathSpecification();
+        status = BenchmarkLoop() ? 0 : 1;
+    } else if (gHeadless) {
+        HeadlessLoop();
+    } else {
+        MainLoop();
+    }
     // call the cleanup fnc
     Cleanup();
-    return 0;
+    return status;
 }